@@ -0,0 +1,247 @@
+#include <getopt.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench_common.h"
+#include "ice9_transport.h"
+
+// Roughly an FT232H in synchronous FIFO mode on a high speed port.
+#define SIM_LINK_BANDWIDTH 40e6
+#define SIM_LATENCY_US 125
+#define SIM_FIFO_DEPTH 4096
+// Spans kept by --trace; the most recent ones win.
+#define TRACE_EVENTS (1024*1024)
+
+// Info messages go to stdout, which is reserved for the JSON result.
+static void quiet_info_logger(const char *format, ...) {
+}
+
+static const char *trace_file;
+
+static void dump_trace(void) {
+    ice9_trace_stop();
+    enum Ice9Error ret = ice9_trace_dump(trace_file);
+    if (ret != OK) {
+        fprintf(stderr, "unable to write trace %s: %s\n", trace_file, ice9_error_string(ret));
+    }
+}
+
+void bench_parse_args(int argc, char **argv, struct bench_options *opts) {
+    ice9_set_info_logger(quiet_info_logger);
+    static const struct option long_options[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"address", required_argument, NULL, 'a'},
+        {"seconds", required_argument, NULL, 's'},
+        {"bitfile", required_argument, NULL, 'b'},
+        {"sim", no_argument, NULL, 'S'},
+        {"link-bandwidth", required_argument, NULL, 'B'},
+        {"latency-us", required_argument, NULL, 'L'},
+        {"fifo-depth", required_argument, NULL, 'F'},
+        {"stream-rate", required_argument, NULL, 'R'},
+        {"record", required_argument, NULL, 'r'},
+        {"replay", required_argument, NULL, 'p'},
+        {"paced", no_argument, NULL, 'P'},
+        {"loop", no_argument, NULL, 'O'},
+        {"trace", required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0},
+    };
+    opts->sim.link_bandwidth = SIM_LINK_BANDWIDTH;
+    opts->sim.latency_us = SIM_LATENCY_US;
+    opts->sim.fifo_depth = SIM_FIFO_DEPTH;
+    int c;
+    while ((c = getopt_long(argc, argv, "n:a:s:b:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': opts->iterations = atoi(optarg); break;
+            case 'a': opts->address = strtol(optarg, NULL, 0); break;
+            case 's': opts->seconds = atoi(optarg); break;
+            case 'b': opts->bitfile = optarg; break;
+            case 'S': opts->force_sim = 1; break;
+            case 'B': opts->sim.link_bandwidth = atof(optarg); break;
+            case 'L': opts->sim.latency_us = atoi(optarg); break;
+            case 'F': opts->sim.fifo_depth = atoi(optarg); break;
+            case 'R': opts->sim.stream_rate = atof(optarg); break;
+            case 'r': opts->record = optarg; break;
+            case 'p': opts->replay = optarg; break;
+            case 'P': opts->replay_flags |= ICE9_REPLAY_PACED; break;
+            case 'O': opts->replay_flags |= ICE9_REPLAY_LOOP; break;
+            case 'T': trace_file = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [--iterations N] [--address A] [--seconds S] [--bitfile F]\n"
+                                "          [--sim] [--link-bandwidth B/s] [--latency-us US] [--fifo-depth BYTES]\n"
+                                "          [--stream-rate B/s] [--record FILE] [--replay FILE [--paced] [--loop]]\n"
+                                "          [--trace FILE]\n",
+                        argv[0]);
+                exit(2);
+        }
+    }
+    // The trace covers the whole run and is written out when it exits.
+    if ((trace_file != NULL) && (ice9_trace_start(TRACE_EVENTS) == OK)) {
+        atexit(dump_trace);
+    }
+}
+
+// The simulator behind the open handle, if any.  The benchmarks only ever
+// have one device open at a time.
+static struct ice9_sim *bench_sim;
+static struct ice9_sim_config bench_sim_config;
+
+static enum Ice9Error init_device(struct ice9_handle *hnd) {
+    enum Ice9Error ret = ice9_open(hnd);
+    if (ret == OK) {
+        ret = ice9_usb_reset(hnd);
+    }
+    if (ret == OK) {
+        ret = ice9_fifo_mode(hnd);
+    }
+    return ret;
+}
+
+struct ice9_handle *bench_open_device(const struct bench_options *opts, struct ice9_config *config,
+                                      const char **device, const char **reason) {
+    struct ice9_config defaults = {0};
+    if (config == NULL) {
+        config = &defaults;
+    }
+    if (opts->replay != NULL) {
+        config->transport = ice9_replay_transport_new(opts->replay, opts->replay_flags);
+        struct ice9_handle *hnd = (config->transport != NULL) ? ice9_new_with_config(config) : NULL;
+        enum Ice9Error ret = (hnd != NULL) ? init_device(hnd) : Error;
+        if (ret != OK) {
+            *reason = "unable to replay recording";
+            if (hnd != NULL) {
+                ice9_free(hnd);
+            }
+            return NULL;
+        }
+        *device = "replay";
+        return hnd;
+    }
+    if (!opts->force_sim) {
+        config->transport = ice9_libusb_transport_new();
+        if ((config->transport != NULL) && (opts->record != NULL)) {
+            config->transport = ice9_recording_transport_new(config->transport, opts->record);
+        }
+        struct ice9_handle *hnd = ice9_new_with_config(config);
+        if (hnd == NULL) {
+            *reason = "unable to create handle";
+            return NULL;
+        }
+        if (init_device(hnd) == OK) {
+            *device = "hardware";
+            return hnd;
+        }
+        ice9_free(hnd);
+    }
+    bench_sim = ice9_sim_new(&opts->sim);
+    bench_sim_config = opts->sim;
+    config->transport = ice9_sim_transport_new(bench_sim);
+    if (opts->record != NULL) {
+        config->transport = ice9_recording_transport_new(config->transport, opts->record);
+    }
+    struct ice9_handle *hnd = ice9_new_with_config(config);
+    if (hnd == NULL) {
+        *reason = "unable to create simulated device";
+        ice9_sim_free(bench_sim);
+        bench_sim = NULL;
+        return NULL;
+    }
+    enum Ice9Error ret = init_device(hnd);
+    if (ret != OK) {
+        *reason = ice9_error_string(ret);
+        bench_close_device(hnd);
+        return NULL;
+    }
+    *device = "simulated";
+    return hnd;
+}
+
+void bench_close_device(struct ice9_handle *hnd) {
+    ice9_close(hnd);
+    ice9_free(hnd);
+    ice9_sim_free(bench_sim);
+    bench_sim = NULL;
+}
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Tracks whether a separator is needed before the next member.
+static int json_need_comma;
+
+static void json_key(const char *key) {
+    printf("%s\"%s\": ", json_need_comma ? ", " : "", key);
+    json_need_comma = 1;
+}
+
+void json_begin(const char *benchmark, const char *device) {
+    printf("{");
+    json_need_comma = 0;
+    json_string("benchmark", benchmark);
+    json_string("device", device);
+    if (bench_sim != NULL) {
+        json_key("sim");
+        printf("{\"link_bandwidth\": %.6g, \"stream_rate\": %.6g, \"latency_us\": %d, \"fifo_depth\": %d}",
+               bench_sim_config.link_bandwidth, bench_sim_config.stream_rate,
+               bench_sim_config.latency_us, bench_sim_config.fifo_depth);
+    }
+}
+
+void json_int(const char *key, int64_t value) {
+    json_key(key);
+    printf("%lld", (long long) value);
+}
+
+void json_double(const char *key, double value) {
+    json_key(key);
+    printf("%.6g", value);
+}
+
+void json_string(const char *key, const char *value) {
+    json_key(key);
+    printf("\"%s\"", value);
+}
+
+void json_latency(const char *key, const struct ice9_latency_stats *stats) {
+    json_key(key);
+    printf("{\"count\": %llu, \"min_ns\": %llu, \"mean_ns\": %llu, \"p50_ns\": %llu, "
+           "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+           (unsigned long long) stats->count, (unsigned long long) stats->min_ns,
+           (unsigned long long) stats->mean_ns, (unsigned long long) stats->p50_ns,
+           (unsigned long long) stats->p99_ns, (unsigned long long) stats->p999_ns,
+           (unsigned long long) stats->max_ns);
+}
+
+void json_array_begin(const char *key) {
+    json_key(key);
+    printf("[");
+    json_need_comma = 0;
+}
+
+void json_array_end(void) {
+    printf("]");
+    json_need_comma = 1;
+}
+
+void json_object_begin(void) {
+    printf("%s{", json_need_comma ? ", " : "");
+    json_need_comma = 0;
+}
+
+void json_object_end(void) {
+    printf("}");
+    json_need_comma = 1;
+}
+
+void json_end(void) {
+    printf("}\n");
+}
+
+int bench_skip(const char *benchmark, const char *reason) {
+    json_begin(benchmark, "none");
+    json_string("skipped", reason);
+    json_end();
+    return 0;
+}
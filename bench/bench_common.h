@@ -0,0 +1,55 @@
+#ifndef _ICE9_BENCH_COMMON_H_
+#define _ICE9_BENCH_COMMON_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ice9.h"
+#include "ice9_sim.h"
+
+// Options shared by all of the benchmarks.
+struct bench_options {
+    int iterations;
+    int address;
+    int seconds;
+    const char *bitfile;
+    int force_sim;
+    struct ice9_sim_config sim;
+    const char *record;
+    const char *replay;
+    int replay_flags;
+};
+
+void bench_parse_args(int argc, char **argv, struct bench_options *opts);
+
+// Open and initialise an ice9 device.  Real hardware is used when present
+// (unless --sim is given), otherwise a simulated device with the timing from
+// opts->sim.  --replay plays back a recording instead, and --record captures
+// the session to a file.  *device is set to "hardware", "simulated" or
+// "replay".  Returns NULL (and fills in reason) if no device can be set up.
+struct ice9_handle *bench_open_device(const struct bench_options *opts, struct ice9_config *config,
+                                      const char **device, const char **reason);
+
+// Close and free a handle from bench_open_device, along with any simulator.
+void bench_close_device(struct ice9_handle *hnd);
+
+double bench_now(void);
+
+// Minimal JSON emitter.  Each benchmark prints a single object to stdout so
+// the results can be collected by a script without any parsing heuristics.
+// When the device is simulated, json_begin also records the simulator timing.
+void json_begin(const char *benchmark, const char *device);
+void json_int(const char *key, int64_t value);
+void json_double(const char *key, double value);
+void json_string(const char *key, const char *value);
+void json_latency(const char *key, const struct ice9_latency_stats *stats);
+void json_array_begin(const char *key);
+void json_array_end(void);
+void json_object_begin(void);
+void json_object_end(void);
+void json_end(void);
+
+// Emit a result recording that the benchmark could not run.
+int bench_skip(const char *benchmark, const char *reason);
+
+#endif  // _ICE9_BENCH_COMMON_H_
@@ -0,0 +1,50 @@
+// Time taken to load a bitstream into the FPGA SRAM with ice9_flash_fpga_mem.
+// The bitfile is read into memory first so that only the transfer is timed.
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+
+int main(int argc, char **argv) {
+    struct bench_options opts = { .iterations = 1 };
+    bench_parse_args(argc, argv, &opts);
+    if (opts.bitfile == NULL) {
+        return bench_skip("flash", "no --bitfile given");
+    }
+
+    FILE *f = fopen(opts.bitfile, "rb");
+    if (f == NULL) {
+        return bench_skip("flash", ice9_error_string(UnableToOpenBitFile));
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *bitstream = malloc(size);
+    if (fread(bitstream, 1, size, f) != (size_t) size) {
+        fclose(f);
+        free(bitstream);
+        return bench_skip("flash", ice9_error_string(UnableToOpenBitFile));
+    }
+    fclose(f);
+
+    json_begin("flash", "hardware");
+    json_int("bitstream_bytes", size);
+    json_array_begin("seconds");
+    int failures = 0;
+    double total = 0;
+    for (int i = 0; i < opts.iterations; i++) {
+        double start = bench_now();
+        if (ice9_flash_fpga_mem(bitstream, size) != OK) {
+            failures++;
+        }
+        double elapsed = bench_now() - start;
+        total += elapsed;
+        printf("%s%.6f", i ? ", " : "", elapsed);
+    }
+    json_array_end();
+    json_double("megabytes_per_second", (double) size * opts.iterations / total / 1e6);
+    json_int("failures", failures);
+    json_end();
+    free(bitstream);
+    return failures ? 1 : 0;
+}
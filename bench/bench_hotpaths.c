@@ -0,0 +1,266 @@
+// Per-byte CPU cost of the host side hot paths, measured in isolation with
+// no device attached: the read ring buffer, status byte stripping, the
+// read_callback/bank_bytes path, the word to int conversion and sample
+// conversion to float.  Each path is swept over sizes and source/destination
+// misalignments.
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "bench_common.h"
+#include "convert.h"
+#include "ice9_internal.h"
+#include "ice9_transport.h"
+
+static const int sizes[] = { 16, 64, 510, 4096, 16384, 65536, 1048576 };
+static const int alignments[] = { 0, 1, 3, 8 };
+
+#define COUNT(x) ((int)(sizeof(x) / sizeof((x)[0])))
+// Enough work per measurement to swamp the timer overhead.
+#define BYTES_PER_MEASUREMENT (16*1024*1024)
+#define MAX_SIZE (1048576)
+
+// Cycle counter.  On x86 this is the TSC, which ticks at a constant rate
+// close to the nominal clock; elsewhere it falls back to nanoseconds.
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)(bench_now() * 1e9);
+#endif
+}
+
+static const char *cycle_unit(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return "tsc";
+#else
+    return "ns";
+#endif
+}
+
+struct measurement {
+    uint64_t cycles;
+    double seconds;
+    uint64_t bytes;
+};
+
+static void report(const char *path, int size, int alignment, const struct measurement *m) {
+    json_object_begin();
+    json_string("path", path);
+    json_int("size", size);
+    json_int("alignment", alignment);
+    json_int("bytes", m->bytes);
+    json_double("cycles_per_byte", (double) m->cycles / m->bytes);
+    json_double("ns_per_byte", m->seconds * 1e9 / m->bytes);
+    json_double("gigabytes_per_second", m->bytes / m->seconds / 1e9);
+    json_object_end();
+}
+
+static int repetitions(int size) {
+    int reps = BYTES_PER_MEASUREMENT / size;
+    return reps ? reps : 1;
+}
+
+// The paths under test never touch the transport, but a handle needs one;
+// a simulator keeps libusb out of the picture.
+static struct ice9_sim *sim;
+
+static struct ice9_handle *new_handle(struct ice9_config *config) {
+    config->transport = ice9_sim_transport_new(sim);
+    return ice9_new_with_config(config);
+}
+
+static void start(struct measurement *m) {
+    m->bytes = 0;
+    m->seconds = bench_now();
+    m->cycles = cycles();
+}
+
+static void stop(struct measurement *m) {
+    m->cycles = cycles() - m->cycles;
+    m->seconds = bench_now() - m->seconds;
+}
+
+// Enqueue then drain size bytes through a ring of 4x that size, so the
+// copies regularly wrap.  The two halves are timed separately.
+static void bench_ring(uint8_t *src, uint8_t *dst, int size, int alignment) {
+    struct ice9_config config = { .ring_buffer_size = 4 * size + 1 };
+    struct ice9_handle *hnd = new_handle(&config);
+    struct measurement enqueue = {0}, drain = {0};
+    int reps = repetitions(size);
+    for (int i = 0; i < reps; i++) {
+        uint64_t t0 = cycles();
+        double s0 = bench_now();
+        enqueue.bytes += enqueue_to_read_buffer(hnd, src + alignment, size);
+        uint64_t t1 = cycles();
+        double s1 = bench_now();
+        drain.bytes += drain_from_read_buffer(hnd, dst + alignment, size);
+        enqueue.cycles += t1 - t0;
+        enqueue.seconds += s1 - s0;
+        drain.cycles += cycles() - t1;
+        drain.seconds += bench_now() - s1;
+    }
+    report("enqueue_to_read_buffer", size, alignment, &enqueue);
+    report("drain_from_read_buffer", size, alignment, &drain);
+    ice9_free(hnd);
+}
+
+// Strip a transfer of size bytes worth of 512 byte packets.  Stripping is
+// in place, so the buffer is refilled from a pristine copy each time; the
+// refill is timed separately and subtracted.
+static void bench_strip(uint8_t *src, uint8_t *dst, int size, int alignment) {
+    int raw = ((size + 509) / 510) * 512;
+    if (raw + alignment > MAX_SIZE + 8192) {
+        return;
+    }
+    struct measurement m;
+    int overruns = 0;
+    int reps = repetitions(raw);
+    uint64_t copy_cycles = cycles();
+    double copy_seconds = bench_now();
+    for (int i = 0; i < reps; i++) {
+        memcpy(dst + alignment, src, raw);
+    }
+    copy_cycles = cycles() - copy_cycles;
+    copy_seconds = bench_now() - copy_seconds;
+    start(&m);
+    for (int i = 0; i < reps; i++) {
+        memcpy(dst + alignment, src, raw);
+        m.bytes += strip_status_bytes(dst + alignment, raw, &overruns);
+    }
+    stop(&m);
+    m.cycles -= copy_cycles;
+    m.seconds -= copy_seconds;
+    report("strip_status_bytes", size, alignment, &m);
+}
+
+// Fill a size byte read from 510 byte packet payloads, as ftdi_readstream
+// would, banking the tail of the last packet for the next read.  An empty
+// callback first serves the read from the bank alone where it can, so small
+// reads do not grow the bank without limit.
+static void bench_callback(uint8_t *src, uint8_t *dst, int size, int alignment) {
+    struct ice9_config config = {0};
+    struct ice9_handle *hnd = new_handle(&config);
+    struct measurement m;
+    int reps = repetitions(size);
+    start(&m);
+    for (int i = 0; i < reps; i++) {
+        begin_callback_read(hnd, dst + alignment, size);
+        int offset = 0;
+        if (read_callback(src + alignment, 0, NULL, hnd) != 0) {
+            m.bytes += size;
+            continue;
+        }
+        while (read_callback(src + alignment + (offset % 4096), 510, NULL, hnd) == 0) {
+            offset += 510;
+        }
+        m.bytes += size;
+    }
+    stop(&m);
+    report("read_callback", size, alignment, &m);
+    ice9_free(hnd);
+}
+
+static void bench_words_to_int(uint8_t *src, uint8_t *dst, int size, int alignment) {
+    const uint16_t *words = (const uint16_t *)(src + (alignment & ~1));
+    uint32_t *ints = (uint32_t *)(dst + (alignment & ~3));
+    int count = size / 4;
+    if (count == 0) {
+        return;
+    }
+    struct measurement m;
+    int reps = repetitions(size);
+    start(&m);
+    for (int i = 0; i < reps; i++) {
+        for (int j = 0; j < count; j++) {
+            ints[j] = words_to_int(words + 2 * j);
+        }
+        // Keep the compiler from collapsing the repetitions.
+        __asm__ volatile("" : : "r"(ints) : "memory");
+        m.bytes += count * 4;
+    }
+    stop(&m);
+    report("words_to_int", size, alignment, &m);
+}
+
+// The array form used by ice9_read_ints, with and without the byte swap.
+static void bench_swap_int_halves(uint8_t *src, uint8_t *dst, int size, int alignment, int flags) {
+    const uint32_t *from = (const uint32_t *)(src + (alignment & ~3));
+    uint32_t *to = (uint32_t *)(dst + (alignment & ~3));
+    int count = size / 4;
+    if (count == 0) {
+        return;
+    }
+    struct measurement m;
+    int reps = repetitions(size);
+    start(&m);
+    for (int i = 0; i < reps; i++) {
+        swap_int_halves(to, from, count, flags);
+        __asm__ volatile("" : : "r"(to) : "memory");
+        m.bytes += count * 4;
+    }
+    stop(&m);
+    report((flags & ICE9_BYTESWAP) ? "swap_int_halves_byteswap" : "swap_int_halves", size, alignment, &m);
+}
+
+// Samples to float through whichever kernels the CPU gets.  Bytes are
+// counted on the input side; the output is kept within size bytes.
+static void bench_convert(uint8_t *src, uint8_t *dst, int size, int alignment, int sample_bits) {
+    struct ice9_sample_format format = { sample_bits, 0, 0, 1.0f / 32768, 0.0f };
+    struct ice9_conversion conversion;
+    ice9_conversion_init(&conversion, &format);
+    float *to = (float *)(dst + (alignment & ~3));
+    int count = size / 4;
+    if (count == 0) {
+        return;
+    }
+    struct measurement m;
+    int reps = repetitions(size);
+    start(&m);
+    for (int i = 0; i < reps; i++) {
+        ice9_convert_samples(&conversion, src + alignment, to, count);
+        __asm__ volatile("" : : "r"(to) : "memory");
+        m.bytes += count * conversion.sample_bytes;
+    }
+    stop(&m);
+    report((sample_bits == 16) ? "convert_int16" : "convert_int32", size, alignment, &m);
+}
+
+int main(int argc, char **argv) {
+    struct bench_options opts = {0};
+    bench_parse_args(argc, argv, &opts);
+
+    uint8_t *src = malloc(MAX_SIZE + 8192);
+    uint8_t *dst = malloc(MAX_SIZE + 8192);
+    for (int i = 0; i < MAX_SIZE + 8192; i++) {
+        src[i] = i * 7;
+    }
+    memset(dst, 0, MAX_SIZE + 8192);
+    sim = ice9_sim_new(NULL);
+
+    json_begin("hotpaths", "none");
+    json_string("cycle_unit", cycle_unit());
+    json_string("convert_isa", ice9_convert_isa());
+    json_array_begin("results");
+    for (int s = 0; s < COUNT(sizes); s++) {
+        for (int a = 0; a < COUNT(alignments); a++) {
+            bench_ring(src, dst, sizes[s], alignments[a]);
+            bench_strip(src, dst, sizes[s], alignments[a]);
+            bench_callback(src, dst, sizes[s], alignments[a]);
+            bench_words_to_int(src, dst, sizes[s], alignments[a]);
+            bench_swap_int_halves(src, dst, sizes[s], alignments[a], 0);
+            bench_swap_int_halves(src, dst, sizes[s], alignments[a], ICE9_BYTESWAP);
+            bench_convert(src, dst, sizes[s], alignments[a], 16);
+            bench_convert(src, dst, sizes[s], alignments[a], 32);
+        }
+    }
+    json_array_end();
+    json_end();
+    ice9_sim_free(sim);
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,38 @@
+// Round trip latency of ice9_ping_bridge.
+
+#include "bench_common.h"
+
+int main(int argc, char **argv) {
+    struct bench_options opts = { .iterations = 10000 };
+    bench_parse_args(argc, argv, &opts);
+
+    const char *device = NULL;
+    const char *reason = NULL;
+    struct ice9_handle *hnd = bench_open_device(&opts, NULL, &device, &reason);
+    if (hnd == NULL) {
+        return bench_skip("ping", reason);
+    }
+
+    ice9_reset_latency(hnd, ICE9_OP_PING_BRIDGE);
+    int failures = 0;
+    double start = bench_now();
+    for (int i = 0; i < opts.iterations; i++) {
+        if (ice9_ping_bridge(hnd, i & 0xFF) != OK) {
+            failures++;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    struct ice9_latency_stats latency;
+    ice9_get_latency(hnd, ICE9_OP_PING_BRIDGE, &latency);
+    json_begin("ping", device);
+    json_int("iterations", opts.iterations);
+    json_int("failures", failures);
+    json_double("seconds", elapsed);
+    json_double("pings_per_second", opts.iterations / elapsed);
+    json_latency("latency", &latency);
+    json_end();
+
+    bench_close_device(hnd);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+// Register transaction rate: 32-bit writes, 32-bit reads and write/read-back
+// pairs against a single address.
+
+#include "bench_common.h"
+
+int main(int argc, char **argv) {
+    struct bench_options opts = { .iterations = 10000 };
+    bench_parse_args(argc, argv, &opts);
+
+    const char *device = NULL;
+    const char *reason = NULL;
+    struct ice9_handle *hnd = bench_open_device(&opts, NULL, &device, &reason);
+    if (hnd == NULL) {
+        return bench_skip("registers", reason);
+    }
+
+    json_begin("registers", device);
+    json_int("address", opts.address);
+    json_int("iterations", opts.iterations);
+    int failures = 0;
+
+    ice9_reset_latency(hnd, ICE9_OP_WRITE_DATA_TO_ADDRESS);
+    double start = bench_now();
+    for (int i = 0; i < opts.iterations; i++) {
+        if (ice9_write_int_to_address(hnd, opts.address, i) != OK) {
+            failures++;
+        }
+    }
+    double elapsed = bench_now() - start;
+    struct ice9_latency_stats latency;
+    ice9_get_latency(hnd, ICE9_OP_WRITE_DATA_TO_ADDRESS, &latency);
+    json_double("writes_per_second", opts.iterations / elapsed);
+    json_latency("write_latency", &latency);
+
+    ice9_reset_latency(hnd, ICE9_OP_READ_DATA_FROM_ADDRESS);
+    start = bench_now();
+    for (int i = 0; i < opts.iterations; i++) {
+        uint32_t value;
+        if (ice9_read_int_from_address(hnd, opts.address, &value) != OK) {
+            failures++;
+        }
+    }
+    elapsed = bench_now() - start;
+    ice9_get_latency(hnd, ICE9_OP_READ_DATA_FROM_ADDRESS, &latency);
+    json_double("reads_per_second", opts.iterations / elapsed);
+    json_latency("read_latency", &latency);
+
+    int mismatches = 0;
+    start = bench_now();
+    for (int i = 0; i < opts.iterations; i++) {
+        uint32_t value = 0;
+        if ((ice9_write_int_to_address(hnd, opts.address, i) != OK) ||
+            (ice9_read_int_from_address(hnd, opts.address, &value) != OK)) {
+            failures++;
+        } else if (value != (uint32_t) i) {
+            mismatches++;
+        }
+    }
+    elapsed = bench_now() - start;
+    json_double("write_read_pairs_per_second", opts.iterations / elapsed);
+    json_int("mismatches", mismatches);
+    json_int("failures", failures);
+    json_end();
+
+    bench_close_device(hnd);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+// Stream read throughput of ice9_stream_read across transfer sizes and read
+// sizes.  ice9_stream_read keeps a single bulk transfer in flight, so the
+// queue depth is reported as 1.
+
+#include <stdlib.h>
+
+#include "bench_common.h"
+
+static const int transfer_sizes[] = { 4096, 16384, 65536, 262144 };
+static const int read_sizes[] = { 4096, 65536, 1048576 };
+
+#define COUNT(x) ((int)(sizeof(x) / sizeof((x)[0])))
+
+int main(int argc, char **argv) {
+    struct bench_options opts = { .seconds = 2 };
+    bench_parse_args(argc, argv, &opts);
+
+    uint8_t *data = malloc(read_sizes[COUNT(read_sizes) - 1]);
+    const char *device = NULL;
+    int failures = 0;
+    for (int t = 0; t < COUNT(transfer_sizes); t++) {
+        struct ice9_config config = { .transfer_size = transfer_sizes[t] };
+        const char *reason = NULL;
+        const char *opened = NULL;
+        struct ice9_handle *hnd = bench_open_device(&opts, &config, &opened, &reason);
+        if (hnd == NULL) {
+            if (device != NULL) {
+                json_array_end();
+                json_end();
+            }
+            free(data);
+            return (device == NULL) ? bench_skip("stream", reason) : 1;
+        }
+        if (device == NULL) {
+            device = opened;
+            json_begin("stream", device);
+            json_int("address", opts.address);
+            json_array_begin("results");
+        }
+        for (int r = 0; r < COUNT(read_sizes); r++) {
+            ice9_enable_streaming(hnd, opts.address);
+            ice9_reset_latency(hnd, ICE9_OP_STREAM_READ);
+            struct ice9_stats before, after;
+            ice9_get_stats(hnd, &before);
+            uint64_t bytes = 0;
+            double start = bench_now();
+            double elapsed = 0;
+            while (elapsed < opts.seconds) {
+                if (ice9_stream_read(hnd, data, read_sizes[r]) != OK) {
+                    failures++;
+                    break;
+                }
+                bytes += read_sizes[r];
+                elapsed = bench_now() - start;
+            }
+            ice9_disable_streaming(hnd);
+            struct ice9_latency_stats latency;
+            ice9_get_latency(hnd, ICE9_OP_STREAM_READ, &latency);
+            ice9_get_stats(hnd, &after);
+            json_object_begin();
+            json_int("transfer_size", transfer_sizes[t]);
+            json_int("queue_depth", 1);
+            json_int("read_size", read_sizes[r]);
+            json_int("bytes", bytes);
+            json_double("seconds", elapsed);
+            json_double("megabytes_per_second", bytes / elapsed / 1e6);
+            json_latency("read_latency", &latency);
+            json_int("transfers", after.transfers_in - before.transfers_in);
+            json_int("short_packets", after.short_packets - before.short_packets);
+            json_int("overruns", after.overruns - before.overruns);
+            json_int("bytes_dropped", after.bytes_dropped - before.bytes_dropped);
+            json_int("ring_high_water", after.ring_high_water);
+            json_object_end();
+        }
+        bench_close_device(hnd);
+    }
+    json_array_end();
+    json_int("failures", failures);
+    json_end();
+    free(data);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "buffers.h"
+#include "logger.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define SIZE_2MB (2UL*1024*1024)
+#define SIZE_1GB (1024UL*1024*1024)
+
+static size_t round_up(size_t size, size_t page) {
+    return ((size + page - 1) / page) * page;
+}
+
+// Explicit huge pages come from the hugetlbfs pool, which is usually empty
+// unless the administrator has reserved pages, so failure here is expected.
+static uint8_t *map_hugetlb(size_t size, int log2_page, size_t *mapped_size) {
+#ifdef MAP_HUGETLB
+    size_t len = round_up(size, 1UL << log2_page);
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (log2_page << MAP_HUGE_SHIFT), -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    *mapped_size = len;
+    return (uint8_t*) p;
+#else
+    return NULL;
+#endif
+}
+
+// Fall back to a 2MB aligned anonymous mapping and ask for transparent huge
+// pages.  The kernel may or may not honour this - see thp_page_size.
+static uint8_t *map_thp(size_t size, size_t *mapped_size) {
+    size_t len = round_up(size, SIZE_2MB);
+    uint8_t *p = mmap(NULL, len + SIZE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    // Trim the mapping so that it starts and ends on a 2MB boundary.
+    uint8_t *aligned = (uint8_t*) round_up((size_t) p, SIZE_2MB);
+    if (aligned != p) {
+        munmap(p, aligned - p);
+    }
+    munmap(aligned + len, (p + len + SIZE_2MB) - (aligned + len));
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    *mapped_size = len;
+    return aligned;
+}
+
+// Work out whether the kernel actually backed a THP mapping with huge pages by
+// looking it up in /proc/self/smaps.  Only meaningful once the pages are faulted in.
+static size_t thp_page_size(const uint8_t *data) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL) {
+        return page_size;
+    }
+    char line[256];
+    int in_mapping = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in_mapping = ((unsigned long) data >= start) && ((unsigned long) data < end);
+            continue;
+        }
+        unsigned long huge_kb;
+        if (in_mapping && (sscanf(line, "AnonHugePages: %lu kB", &huge_kb) == 1)) {
+            if (huge_kb > 0) {
+                page_size = SIZE_2MB;
+            }
+            break;
+        }
+    }
+    fclose(f);
+    return page_size;
+}
+
+enum Ice9Error ice9_buffer_alloc(struct ice9_buffer *buf, int flags) {
+    if (buf->data != NULL) {
+        return OK;
+    }
+    if (flags == 0) {
+        buf->data = (uint8_t*) malloc(buf->size);
+        if (buf->data == NULL) {
+            LOG_ERROR("Unable to allocate %d byte buffer\n", buf->size);
+            return BufferAllocationFailed;
+        }
+        buf->mapped_size = 0;
+        buf->page_size = sysconf(_SC_PAGESIZE);
+        return OK;
+    }
+    size_t size = buf->size;
+    uint8_t *data = NULL;
+    size_t mapped_size = 0;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (flags & ICE9_BUFFER_HUGE_PAGES) {
+        if (size >= SIZE_1GB) {
+            data = map_hugetlb(size, 30, &mapped_size);
+            page_size = SIZE_1GB;
+        }
+        if (data == NULL) {
+            data = map_hugetlb(size, 21, &mapped_size);
+            page_size = SIZE_2MB;
+        }
+        if (data == NULL) {
+            data = map_thp(size, &mapped_size);
+            page_size = 0;
+        }
+    } else {
+        mapped_size = round_up(size, page_size);
+        data = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        }
+    }
+    if (data == NULL) {
+        LOG_ERROR("Unable to map %d byte buffer: %s\n", buf->size, strerror(errno));
+        return BufferAllocationFailed;
+    }
+    // Touch every page now so that the streaming path never takes a page fault.
+    memset(data, 0, mapped_size);
+    if (flags & ICE9_BUFFER_LOCKED) {
+        if (mlock(data, mapped_size) != 0) {
+            LOG_ERROR("Unable to lock %zu byte buffer in memory: %s (check RLIMIT_MEMLOCK)\n",
+                      mapped_size, strerror(errno));
+            munmap(data, mapped_size);
+            return BufferLockFailed;
+        }
+    }
+    if (page_size == 0) {
+        page_size = thp_page_size(data);
+    }
+    buf->data = data;
+    buf->mapped_size = mapped_size;
+    buf->page_size = page_size;
+    return OK;
+}
+
+void ice9_buffer_free(struct ice9_buffer *buf) {
+    if (buf->data == NULL) {
+        return;
+    }
+    if (buf->mapped_size != 0) {
+        // munmap also drops any mlock on the range.
+        munmap(buf->data, buf->mapped_size);
+    } else {
+        free(buf->data);
+    }
+    buf->data = NULL;
+    buf->mapped_size = 0;
+    buf->page_size = 0;
+}
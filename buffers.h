@@ -0,0 +1,24 @@
+#ifndef _ICE9_BUFFERS_H_
+#define _ICE9_BUFFERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ice9.h"
+
+// A streaming buffer owned by a handle.  size is fixed when the handle is
+// created; data stays NULL until ice9_buffer_alloc is called on first use.
+struct ice9_buffer {
+    uint8_t *data;
+    int size;
+    size_t mapped_size;   // Non-zero when data came from mmap rather than malloc
+    size_t page_size;     // Effective page size backing data
+};
+
+// Allocate buf->size bytes according to flags (ICE9_BUFFER_*).  Does nothing
+// if the buffer is already allocated.
+enum Ice9Error ice9_buffer_alloc(struct ice9_buffer *buf, int flags);
+
+void ice9_buffer_free(struct ice9_buffer *buf);
+
+#endif  // _ICE9_BUFFERS_H_
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "channels.h"
+#include "probes.h"
+
+#define MIN(a, b) ((a) < (b)) ? (a) : (b)
+#define COUNT(channel, counter, n) atomic_fetch_add_explicit(&(channel)->counter, (n), memory_order_relaxed)
+#define LOAD(channel, counter) atomic_load_explicit(&(channel)->counter, memory_order_relaxed)
+#define STORE(channel, counter, n) atomic_store_explicit(&(channel)->counter, (n), memory_order_relaxed)
+
+struct ice9_channel *ice9_channel_new(int ring_size, int buffer_flags) {
+    struct ice9_channel *channel = calloc(1, sizeof(struct ice9_channel));
+    if (channel == NULL) {
+        return NULL;
+    }
+    channel->ring.size = ring_size;
+    if (ice9_buffer_alloc(&channel->ring, buffer_flags) != OK) {
+        free(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+void ice9_channel_free(struct ice9_channel *channel) {
+    if (channel == NULL) {
+        return;
+    }
+    ice9_buffer_free(&channel->ring);
+    free(channel);
+}
+
+// As with the handle's read ring, one byte is left free so that head ==
+// tail always means empty.
+static int fill(const struct ice9_channel *channel) {
+    return (channel->head + channel->ring.size - channel->tail) % channel->ring.size;
+}
+
+void ice9_channel_received(struct ice9_channel *channel, int count) {
+    COUNT(channel, bytes, count);
+}
+
+int ice9_channel_put(struct ice9_channel *channel, const uint8_t *data, int count) {
+    COUNT(channel, bytes, count);
+    int stored = MIN(count, channel->ring.size - 1 - fill(channel));
+    int first = MIN(stored, channel->ring.size - channel->head);
+    memcpy(channel->ring.data + channel->head, data, first);
+    memcpy(channel->ring.data, data + first, stored - first);
+    channel->head = (channel->head + stored) % channel->ring.size;
+    if (stored < count) {
+        COUNT(channel, bytes_dropped, count - stored);
+        ICE9_PROBE1(bytes_dropped, count - stored);
+    }
+    uint64_t now = fill(channel);
+    STORE(channel, ring_occupancy, now);
+    if (now > LOAD(channel, ring_high_water)) {
+        STORE(channel, ring_high_water, now);
+    }
+    return stored;
+}
+
+int ice9_channel_get(struct ice9_channel *channel, uint8_t *data, int count) {
+    int taken = MIN(count, fill(channel));
+    int first = MIN(taken, channel->ring.size - channel->tail);
+    memcpy(data, channel->ring.data + channel->tail, first);
+    memcpy(data + first, channel->ring.data, taken - first);
+    channel->tail = (channel->tail + taken) % channel->ring.size;
+    STORE(channel, ring_occupancy, fill(channel));
+    return taken;
+}
+
+void ice9_channel_get_stats(struct ice9_channel *channel, struct ice9_channel_stats *stats) {
+    stats->bytes = LOAD(channel, bytes);
+    stats->bytes_dropped = LOAD(channel, bytes_dropped);
+    stats->ring_occupancy = LOAD(channel, ring_occupancy);
+    stats->ring_high_water = LOAD(channel, ring_high_water);
+}
@@ -0,0 +1,41 @@
+#ifndef _ICE9_CHANNELS_H_
+#define _ICE9_CHANNELS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "buffers.h"
+#include "ice9.h"
+
+// The receive ring for one multi-channel streaming address.  Filled and
+// drained under the handle's IN lock; the counters may be read from any
+// thread.
+struct ice9_channel {
+    struct ice9_buffer ring;
+    int head;
+    int tail;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t bytes_dropped;
+    _Atomic uint64_t ring_occupancy;
+    _Atomic uint64_t ring_high_water;
+};
+
+// A channel with a ring of ring_size bytes, allocated according to
+// buffer_flags (ICE9_BUFFER_*).  NULL if the memory could not be had.
+struct ice9_channel *ice9_channel_new(int ring_size, int buffer_flags);
+
+void ice9_channel_free(struct ice9_channel *channel);
+
+// Count bytes that went straight to a reader without touching the ring.
+void ice9_channel_received(struct ice9_channel *channel, int count);
+
+// Queue received bytes.  Whatever does not fit is dropped and counted.
+// Returns the number queued.
+int ice9_channel_put(struct ice9_channel *channel, const uint8_t *data, int count);
+
+// Take up to count queued bytes.  Returns the number taken.
+int ice9_channel_get(struct ice9_channel *channel, uint8_t *data, int count);
+
+void ice9_channel_get_stats(struct ice9_channel *channel, struct ice9_channel_stats *stats);
+
+#endif  // _ICE9_CHANNELS_H_
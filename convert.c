@@ -0,0 +1,320 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "convert.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+enum Ice9Error ice9_conversion_init(struct ice9_conversion *conversion, const struct ice9_sample_format *format) {
+    if ((format == NULL) || ((format->sample_bits != 16) && (format->sample_bits != 32)) ||
+        (format->sign_bits < 0) || (format->sign_bits > format->sample_bits) ||
+        (format->flags & ~ICE9_BYTESWAP)) {
+        return BadSampleFormat;
+    }
+    int sign_bits = format->sign_bits ? format->sign_bits : format->sample_bits;
+    conversion->sample_bytes = format->sample_bits / 8;
+    conversion->flags = format->flags;
+    conversion->shift = 32 - sign_bits;
+    conversion->scale = format->scale;
+    conversion->offset = format->offset;
+    return OK;
+}
+
+// The scalar versions define the conversion; the vector kernels must give
+// the same results bit for bit.  16-bit samples are little-endian words,
+// and 32-bit samples are laid out as for ice9_read_ints: two words, most
+// significant first, with ICE9_BYTESWAP reversing the bytes of the value.
+static inline float finish(const struct ice9_conversion *c, int32_t value) {
+    value = (int32_t) ((uint32_t) value << c->shift) >> c->shift;
+    return (float) value * c->scale + c->offset;
+}
+
+static void convert16_scalar(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    for (int i = 0; i < count; i++, src += 2) {
+        uint16_t word = (c->flags & ICE9_BYTESWAP) ? (src[0] << 8) | src[1] : src[0] | (src[1] << 8);
+        dst[i] = finish(c, (int16_t) word);
+    }
+}
+
+static void convert32_scalar(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    for (int i = 0; i < count; i++, src += 4) {
+        uint32_t raw = src[0] | (src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+        uint32_t value;
+        if (c->flags & ICE9_BYTESWAP) {
+            value = ((raw & 0x00FF00FF) << 8) | ((raw >> 8) & 0x00FF00FF);
+        } else {
+            value = (raw << 16) | (raw >> 16);
+        }
+        dst[i] = finish(c, (int32_t) value);
+    }
+}
+
+#if defined(CONVERT_X86)
+
+// SSE2 is part of x86-64, so this is only a run time choice on 32-bit x86.
+__attribute__((target("sse2")))
+static void convert16_sse2(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m128 scale = _mm_set1_ps(c->scale);
+    const __m128 offset = _mm_set1_ps(c->offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 2));
+        if (c->flags & ICE9_BYTESWAP) {
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+        // Each word into the top of a 32-bit lane, then arithmetic shifts
+        // down sign extend it.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        lo = _mm_sra_epi32(_mm_sll_epi32(lo, shift), shift);
+        hi = _mm_sra_epi32(_mm_sll_epi32(hi, shift), shift);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), offset));
+        _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), offset));
+    }
+    convert16_scalar(c, src + i * 2, dst + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void convert32_sse2(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m128 scale = _mm_set1_ps(c->scale);
+    const __m128 offset = _mm_set1_ps(c->offset);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        if (c->flags & ICE9_BYTESWAP) {
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        } else {
+            v = _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+        }
+        v = _mm_sra_epi32(_mm_sll_epi32(v, shift), shift);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), scale), offset));
+    }
+    convert32_scalar(c, src + i * 4, dst + i, count - i);
+}
+
+// Byte shuffles that put each 16 or 32-bit value in host order.
+#define SWAP16_BYTES 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define SWAP32_HALVES 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13
+
+__attribute__((target("avx2")))
+static void convert16_avx2(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m256 scale = _mm256_set1_ps(c->scale);
+    const __m256 offset = _mm256_set1_ps(c->offset);
+    const __m256i swap = _mm256_setr_epi8(SWAP16_BYTES, SWAP16_BYTES);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i * 2));
+        if (c->flags & ICE9_BYTESWAP) {
+            v = _mm256_shuffle_epi8(v, swap);
+        }
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+        lo = _mm256_sra_epi32(_mm256_sll_epi32(lo, shift), shift);
+        hi = _mm256_sra_epi32(_mm256_sll_epi32(hi, shift), shift);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale), offset));
+        _mm256_storeu_ps(dst + i + 8, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale), offset));
+    }
+    // The tail is SSE code, which runs slowly with the upper halves dirty.
+    _mm256_zeroupper();
+    convert16_sse2(c, src + i * 2, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void convert32_avx2(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m256 scale = _mm256_set1_ps(c->scale);
+    const __m256 offset = _mm256_set1_ps(c->offset);
+    const __m256i order = (c->flags & ICE9_BYTESWAP) ? _mm256_setr_epi8(SWAP16_BYTES, SWAP16_BYTES)
+                                                     : _mm256_setr_epi8(SWAP32_HALVES, SWAP32_HALVES);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (src + i * 4)), order);
+        v = _mm256_sra_epi32(_mm256_sll_epi32(v, shift), shift);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), scale), offset));
+    }
+    // The tail is SSE code, which runs slowly with the upper halves dirty.
+    _mm256_zeroupper();
+    convert32_sse2(c, src + i * 4, dst + i, count - i);
+}
+
+// AVX-512F only: the byte shuffles of AVX-512BW are avoided, so 16-bit
+// swaps are done on 256-bit halves and 32-bit ones with rotates and masks.
+__attribute__((target("avx512f")))
+static void convert16_avx512(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m512 scale = _mm512_set1_ps(c->scale);
+    const __m512 offset = _mm512_set1_ps(c->offset);
+    const __m256i swap = _mm256_setr_epi8(SWAP16_BYTES, SWAP16_BYTES);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (src + i * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + i * 2 + 32));
+        if (c->flags & ICE9_BYTESWAP) {
+            a = _mm256_shuffle_epi8(a, swap);
+            b = _mm256_shuffle_epi8(b, swap);
+        }
+        __m512i lo = _mm512_sra_epi32(_mm512_sll_epi32(_mm512_cvtepi16_epi32(a), shift), shift);
+        __m512i hi = _mm512_sra_epi32(_mm512_sll_epi32(_mm512_cvtepi16_epi32(b), shift), shift);
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(lo), scale), offset));
+        _mm512_storeu_ps(dst + i + 16, _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(hi), scale), offset));
+    }
+    convert16_avx2(c, src + i * 2, dst + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void convert32_avx512(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const __m128i shift = _mm_cvtsi32_si128(c->shift);
+    const __m512 scale = _mm512_set1_ps(c->scale);
+    const __m512 offset = _mm512_set1_ps(c->offset);
+    const __m512i low_bytes = _mm512_set1_epi32(0x00FF00FF);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void *) (src + i * 4));
+        if (c->flags & ICE9_BYTESWAP) {
+            v = _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(v, low_bytes), 8),
+                                _mm512_and_si512(_mm512_srli_epi32(v, 8), low_bytes));
+        } else {
+            v = _mm512_rol_epi32(v, 16);
+        }
+        v = _mm512_sra_epi32(_mm512_sll_epi32(v, shift), shift);
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(v), scale), offset));
+    }
+    convert32_avx2(c, src + i * 4, dst + i, count - i);
+}
+
+#elif defined(__ARM_NEON)
+
+static void convert16_neon(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    // vshlq with a negative count shifts right, arithmetically for signed lanes.
+    const int32x4_t left = vdupq_n_s32(c->shift);
+    const int32x4_t right = vdupq_n_s32(-c->shift);
+    const float32x4_t scale = vdupq_n_f32(c->scale);
+    const float32x4_t offset = vdupq_n_f32(c->offset);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x16_t bytes = vld1q_u8(src + i * 2);
+        if (c->flags & ICE9_BYTESWAP) {
+            bytes = vrev16q_u8(bytes);
+        }
+        int16x8_t v = vreinterpretq_s16_u8(bytes);
+        int32x4_t lo = vshlq_s32(vshlq_s32(vmovl_s16(vget_low_s16(v)), left), right);
+        int32x4_t hi = vshlq_s32(vshlq_s32(vmovl_s16(vget_high_s16(v)), left), right);
+        vst1q_f32(dst + i, vaddq_f32(vmulq_f32(vcvtq_f32_s32(lo), scale), offset));
+        vst1q_f32(dst + i + 4, vaddq_f32(vmulq_f32(vcvtq_f32_s32(hi), scale), offset));
+    }
+    convert16_scalar(c, src + i * 2, dst + i, count - i);
+}
+
+static void convert32_neon(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count) {
+    const int32x4_t left = vdupq_n_s32(c->shift);
+    const int32x4_t right = vdupq_n_s32(-c->shift);
+    const float32x4_t scale = vdupq_n_f32(c->scale);
+    const float32x4_t offset = vdupq_n_f32(c->offset);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t bytes = vld1q_u8(src + i * 4);
+        int32x4_t v;
+        if (c->flags & ICE9_BYTESWAP) {
+            v = vreinterpretq_s32_u8(vrev16q_u8(bytes));
+        } else {
+            v = vreinterpretq_s32_u16(vrev32q_u16(vreinterpretq_u16_u8(bytes)));
+        }
+        v = vshlq_s32(vshlq_s32(v, left), right);
+        vst1q_f32(dst + i, vaddq_f32(vmulq_f32(vcvtq_f32_s32(v), scale), offset));
+    }
+    convert32_scalar(c, src + i * 4, dst + i, count - i);
+}
+
+#endif
+
+typedef void (*convert_kernel)(const struct ice9_conversion *c, const uint8_t *src, float *dst, int count);
+
+struct kernels {
+    const char *isa;
+    convert_kernel convert16;
+    convert_kernel convert32;
+};
+
+static struct kernels s_kernels = { "scalar", convert16_scalar, convert32_scalar };
+static pthread_once_t s_kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels(void) {
+#if defined(CONVERT_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        s_kernels = (struct kernels) { "avx512", convert16_avx512, convert32_avx512 };
+    } else if (__builtin_cpu_supports("avx2")) {
+        s_kernels = (struct kernels) { "avx2", convert16_avx2, convert32_avx2 };
+    } else if (__builtin_cpu_supports("sse2")) {
+        s_kernels = (struct kernels) { "sse2", convert16_sse2, convert32_sse2 };
+    }
+#elif defined(__ARM_NEON)
+    s_kernels = (struct kernels) { "neon", convert16_neon, convert32_neon };
+#endif
+}
+
+void ice9_convert_samples(const struct ice9_conversion *conversion, const uint8_t *src, float *dst, int count) {
+    pthread_once(&s_kernels_once, pick_kernels);
+    if (conversion->sample_bytes == 2) {
+        s_kernels.convert16(conversion, src, dst, count);
+    } else {
+        s_kernels.convert32(conversion, src, dst, count);
+    }
+}
+
+const char *ice9_convert_isa(void) {
+    pthread_once(&s_kernels_once, pick_kernels);
+    return s_kernels.isa;
+}
+
+void ice9_sample_dest_init(struct ice9_sample_dest *dest, const struct ice9_conversion *conversion,
+                           float *samples, int count) {
+    dest->conversion = *conversion;
+    dest->samples = samples;
+    dest->remaining = count;
+    dest->partial_bytes = 0;
+}
+
+int ice9_sample_dest_fill(struct ice9_sample_dest *dest, const uint8_t *src, int length) {
+    int size = dest->conversion.sample_bytes;
+    int wanted = ice9_sample_dest_wanted(dest);
+    if (length > wanted) {
+        length = wanted;
+    }
+    int taken = 0;
+    // Finish the sample the last call left part way through.
+    if (dest->partial_bytes > 0) {
+        int n = size - dest->partial_bytes;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(dest->partial + dest->partial_bytes, src, n);
+        dest->partial_bytes += n;
+        taken += n;
+        if (dest->partial_bytes < size) {
+            return taken;
+        }
+        ice9_convert_samples(&dest->conversion, dest->partial, dest->samples, 1);
+        dest->samples++;
+        dest->remaining--;
+        dest->partial_bytes = 0;
+    }
+    int count = (length - taken) / size;
+    ice9_convert_samples(&dest->conversion, src + taken, dest->samples, count);
+    dest->samples += count;
+    dest->remaining -= count;
+    taken += count * size;
+    // Hold on to the start of a sample that runs past the end of src.
+    int rest = length - taken;
+    memcpy(dest->partial, src + taken, rest);
+    dest->partial_bytes = rest;
+    return length;
+}
@@ -0,0 +1,58 @@
+#ifndef _ICE9_CONVERT_H_
+#define _ICE9_CONVERT_H_
+
+#include <stdint.h>
+
+#include "ice9.h"
+
+// Integer samples to float, for ice9_stream_read_samples and
+// ice9_channel_read_samples.  The kernels are picked at run time for the
+// widest vector unit the CPU has (AVX-512, AVX2 or SSE2 on x86, NEON on
+// ARM), falling back to scalar code.
+
+// A checked ice9_sample_format, ready for the kernels.
+struct ice9_conversion {
+    int sample_bytes;
+    int flags;
+    // Sign extension is a left shift by this much then an arithmetic right
+    // shift back, on 32-bit values.
+    int shift;
+    float scale;
+    float offset;
+};
+
+// BadSampleFormat unless the format is one the kernels handle.
+enum Ice9Error ice9_conversion_init(struct ice9_conversion *conversion, const struct ice9_sample_format *format);
+
+// Convert count samples as they arrived from the device at src to floats
+// at dst.  Neither pointer needs to be aligned.
+void ice9_convert_samples(const struct ice9_conversion *conversion, const uint8_t *src, float *dst, int count);
+
+// The name of the kernel set in use ("avx512", "avx2", "sse2", "neon" or
+// "scalar"), for the benchmarks.
+const char *ice9_convert_isa(void);
+
+// A caller's float buffer being filled from a byte stream that need not
+// break at sample boundaries.  A sample split between calls is held until
+// the rest of it arrives.
+struct ice9_sample_dest {
+    struct ice9_conversion conversion;
+    float *samples;
+    int remaining;
+    uint8_t partial[4];
+    int partial_bytes;
+};
+
+void ice9_sample_dest_init(struct ice9_sample_dest *dest, const struct ice9_conversion *conversion,
+                           float *samples, int count);
+
+// Bytes still needed to fill the buffer.
+static inline int ice9_sample_dest_wanted(const struct ice9_sample_dest *dest) {
+    return dest->remaining * dest->conversion.sample_bytes - dest->partial_bytes;
+}
+
+// Convert as much of src as the buffer wants.  Returns the number of bytes
+// taken, which is all of length unless the buffer filled.
+int ice9_sample_dest_fill(struct ice9_sample_dest *dest, const uint8_t *src, int length);
+
+#endif  // _ICE9_CONVERT_H_
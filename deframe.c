@@ -0,0 +1,106 @@
+#include <stddef.h>
+
+#include "deframe.h"
+#include "ice9_internal.h"
+#include "probes.h"
+
+void ice9_deframer_reset(struct ice9_deframer *deframer) {
+    deframer->state = DEFRAME_WORD;
+    deframer->have_low_byte = 0;
+}
+
+// Data goes back into the buffer it was read from.  Each packet gives up its
+// two status bytes and at most one byte is held over, so the write position
+// never passes the read position.  Frame contents are handed to the sink
+// straight from the packet, as long a run as the packet holds.
+int ice9_deframe(struct ice9_deframer *deframer, uint8_t *buffer, int length, int *overruns, int *events,
+                 int *frame_errors) {
+    uint8_t *dest = buffer;
+    const uint8_t *src = buffer;
+    while (length >= 2) {
+        *overruns += (src[1] & FTDI_OVERRUN) != 0;
+        int payload = (length < USB_PACKET_SIZE) ? length - 2 : USB_PACKET_SIZE - 2;
+        const uint8_t *end = src + 2 + payload;
+        length -= payload + 2;
+        src += 2;
+        while (src < end) {
+            if ((deframer->state == DEFRAME_FRAME_DATA) && !deframer->have_low_byte) {
+                int run = (int) (end - src) & ~1;
+                if (run > deframer->frame_words * 2) {
+                    run = deframer->frame_words * 2;
+                }
+                if (run > 0) {
+                    if (!deframer->discard) {
+                        deframer->sink(deframer->sink_context, deframer->channel, src, run);
+                    }
+                    src += run;
+                    deframer->frame_words -= run / 2;
+                    if (deframer->frame_words == 0) {
+                        deframer->state = DEFRAME_WORD;
+                    }
+                    continue;
+                }
+            }
+            if (!deframer->have_low_byte) {
+                deframer->low_byte = *src++;
+                deframer->have_low_byte = 1;
+                continue;
+            }
+            deframer->have_low_byte = 0;
+            uint8_t word[2] = { deframer->low_byte, *src++ };
+            uint16_t value = word[0] | (word[1] << 8);
+            switch (deframer->state) {
+                case DEFRAME_ESCAPED:
+                    deframer->state = DEFRAME_WORD;
+                    break;
+                case DEFRAME_PAYLOAD:
+                    deframer->state = DEFRAME_WORD;
+                    (*events)++;
+                    ICE9_PROBE2(event, deframer->event, value);
+                    if (deframer->callback != NULL) {
+                        deframer->callback(deframer->userdata, deframer->event, value);
+                    }
+                    continue;
+                case DEFRAME_FRAME_HEADER:
+                    deframer->channel = word[0];
+                    deframer->frame_words = word[1];
+                    deframer->state = DEFRAME_FRAME_DATA;
+                    if (deframer->frame_words == 0) {
+                        if (!deframer->discard) {
+                            deframer->channels = 0;
+                        }
+                        deframer->state = DEFRAME_WORD;
+                    }
+                    continue;
+                case DEFRAME_FRAME_DATA:
+                    // A word split across packets.
+                    if (!deframer->discard) {
+                        deframer->sink(deframer->sink_context, deframer->channel, word, 2);
+                    }
+                    if (--deframer->frame_words == 0) {
+                        deframer->state = DEFRAME_WORD;
+                    }
+                    continue;
+                case DEFRAME_WORD:
+                    if (word[1] == ICE9_EVENT_WORD) {
+                        if (word[0] == ICE9_EVENT_ESCAPE) {
+                            deframer->state = DEFRAME_ESCAPED;
+                        } else if (word[0] == ICE9_EVENT_FRAME) {
+                            // Nowhere to deliver a frame unless channels are on.
+                            deframer->discard = !deframer->channels || (deframer->sink == NULL);
+                            *frame_errors += deframer->discard;
+                            deframer->state = DEFRAME_FRAME_HEADER;
+                        } else {
+                            deframer->event = word[0];
+                            deframer->state = DEFRAME_PAYLOAD;
+                        }
+                        continue;
+                    }
+                    break;
+            }
+            *dest++ = word[0];
+            *dest++ = word[1];
+        }
+    }
+    return dest - buffer;
+}
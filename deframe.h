@@ -0,0 +1,70 @@
+#ifndef _ICE9_DEFRAME_H_
+#define _ICE9_DEFRAME_H_
+
+#include <stdint.h>
+
+#include "ice9.h"
+
+// Splits device events and channel frames out of the IN stream while either
+// is enabled (see ice9_enable_events and ice9_enable_channels).  The stream
+// is then a sequence of 16-bit words where
+//
+//   0x0Eii payload    is event ii (0x00-0xFD) with a 16-bit payload
+//   0x0EFE cc|nn<<8   starts a frame of nn words for channel cc, which
+//                     follow as they are; nn = 0 ends channel streaming
+//   0x0EFF word       is the data word that follows, which had 0x0E as its
+//                     high byte
+//
+// and every other word is data.  A frame header while channel streaming is
+// off is a protocol error: the frame is read past and dropped.  State carries
+// across calls, so words, events and frames may straddle packets and
+// transfers.  Locking is up to the caller.
+#define ICE9_EVENT_WORD 0x0E
+#define ICE9_EVENT_FRAME 0xFE
+#define ICE9_EVENT_ESCAPE 0xFF
+
+enum ice9_deframe_state {
+    DEFRAME_WORD,
+    DEFRAME_ESCAPED,
+    DEFRAME_PAYLOAD,
+    DEFRAME_FRAME_HEADER,
+    DEFRAME_FRAME_DATA,
+};
+
+// Receives channel data, a run of whole words at a time.
+typedef void (*ice9_frame_sink)(void *context, uint8_t channel, const uint8_t *data, int length);
+
+struct ice9_deframer {
+    int events;
+    int channels;
+    enum ice9_deframe_state state;
+    int have_low_byte;
+    uint8_t low_byte;
+    uint8_t event;
+    uint8_t channel;
+    int frame_words;
+    // The frame being read is to be dropped.
+    int discard;
+    ice9_event_callback callback;
+    void *userdata;
+    ice9_frame_sink sink;
+    void *sink_context;
+};
+
+static inline int ice9_deframer_active(const struct ice9_deframer *deframer) {
+    return deframer->events || deframer->channels;
+}
+
+// Start again at a word boundary, e.g. after the device has been reset.
+void ice9_deframer_reset(struct ice9_deframer *deframer);
+
+// strip_status_bytes with de-framing folded in: compact a bulk IN transfer
+// of 512 byte packets in place to just its data, delivering events to the
+// callback and channel frames to the sink.  Returns the number of data
+// bytes, and adds to *overruns, *events and *frame_errors.  Data is only
+// released in whole words, so an odd byte at the end is held for the next
+// call.  The frame that ends channel streaming clears deframer->channels.
+int ice9_deframe(struct ice9_deframer *deframer, uint8_t *buffer, int length, int *overruns, int *events,
+                 int *frame_errors);
+
+#endif  // _ICE9_DEFRAME_H_
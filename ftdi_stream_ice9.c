@@ -49,6 +49,7 @@
 
 #include "ftdi.h"
 #include "logger.h"
+#include "probes.h"
 
 typedef struct
 {
@@ -73,6 +74,7 @@ ftdi_readstream_cb(struct libusb_transfer *transfer)
     int packet_size = state->packetsize;
 
     state->activity++;
+    ICE9_PROBE3(stream_complete, transfer, transfer->status, transfer->actual_length);
     if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
     {
         int i;
@@ -106,6 +108,7 @@ ftdi_readstream_cb(struct libusb_transfer *transfer)
         else
         {
             transfer->status = -1;
+            ICE9_PROBE2(stream_submit, transfer, transfer->length);
             state->result = libusb_submit_transfer(transfer);
         }
     }
@@ -194,6 +197,7 @@ ftdi_readstream_ice9(struct ftdi_context *ftdi,
         }
 
         transfer->status = -1;
+        ICE9_PROBE2(stream_submit, transfer, transfer->length);
         err = libusb_submit_transfer(transfer);
         if (err)
             goto cleanup;
@@ -249,6 +253,7 @@ ftdi_readstream_ice9(struct ftdi_context *ftdi,
                          progress->prev.totalBytes) / currentTime;
             }
 
+            ICE9_PROBE1(stream_progress, progress->current.totalBytes);
             state.callback(NULL, 0, progress, state.userdata);
             progress->prev = progress->current;
 
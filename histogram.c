@@ -0,0 +1,98 @@
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+#define SUB_COUNT (1 << ICE9_HISTOGRAM_SUB_BITS)
+
+uint64_t ice9_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < SUB_COUNT) {
+        return value;
+    }
+    if (value >> ICE9_HISTOGRAM_MAX_BITS) {
+        return ICE9_HISTOGRAM_BUCKETS - 1;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - ICE9_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << ICE9_HISTOGRAM_SUB_BITS) + (int)((value >> shift) - SUB_COUNT);
+}
+
+// Largest value that maps to the given bucket.
+static uint64_t bucket_upper_bound(int index) {
+    if (index < 2 * SUB_COUNT) {
+        return index;
+    }
+    int shift = (index >> ICE9_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((index & (SUB_COUNT - 1)) + SUB_COUNT) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+void ice9_histogram_reset(struct ice9_histogram *h) {
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->min_ns, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&h->max_ns, 0, memory_order_relaxed);
+    for (int i = 0; i < ICE9_HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+void ice9_histogram_record(struct ice9_histogram *h, uint64_t value_ns) {
+    atomic_fetch_add_explicit(&h->buckets[bucket_index(value_ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, value_ns, memory_order_relaxed);
+    // The extremes only need a compare-exchange when they actually move.
+    uint64_t seen = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while ((value_ns > seen) &&
+           !atomic_compare_exchange_weak_explicit(&h->max_ns, &seen, value_ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    seen = atomic_load_explicit(&h->min_ns, memory_order_relaxed);
+    while ((value_ns < seen) &&
+           !atomic_compare_exchange_weak_explicit(&h->min_ns, &seen, value_ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void ice9_histogram_snapshot(struct ice9_histogram *h, struct ice9_latency_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    // Take a copy of the buckets first and work out the total from it, so the
+    // percentiles are consistent even if recording carries on underneath us.
+    uint64_t total = 0;
+    uint64_t local[ICE9_HISTOGRAM_BUCKETS];
+    for (int i = 0; i < ICE9_HISTOGRAM_BUCKETS; i++) {
+        local[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        total += local[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    stats->count = total;
+    stats->min_ns = atomic_load_explicit(&h->min_ns, memory_order_relaxed);
+    stats->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    uint64_t recorded = atomic_load_explicit(&h->count, memory_order_relaxed);
+    if (recorded > 0) {
+        stats->mean_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed) / recorded;
+    }
+    const uint64_t targets[3] = {
+        (total * 500 + 999) / 1000,
+        (total * 990 + 999) / 1000,
+        (total * 999 + 999) / 1000,
+    };
+    uint64_t *results[3] = { &stats->p50_ns, &stats->p99_ns, &stats->p999_ns };
+    uint64_t cumulative = 0;
+    int next = 0;
+    for (int i = 0; (i < ICE9_HISTOGRAM_BUCKETS) && (next < 3); i++) {
+        cumulative += local[i];
+        while ((next < 3) && (cumulative >= targets[next])) {
+            uint64_t value = bucket_upper_bound(i);
+            *results[next++] = (value < stats->max_ns) ? value : stats->max_ns;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _ICE9_HISTOGRAM_H_
+#define _ICE9_HISTOGRAM_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "ice9.h"
+
+// Log-linear (HDR style) latency histogram in nanoseconds.  Each power of two
+// is split into 16 linear sub-buckets, so a bucket is at most 1/16 of its
+// value wide.  Values of 2^34 ns (~17s) and above land in the last bucket;
+// max_ns is always exact.  Recording is a handful of relaxed atomic adds, so
+// any number of threads may record while another takes a snapshot.
+#define ICE9_HISTOGRAM_SUB_BITS 4
+#define ICE9_HISTOGRAM_MAX_BITS 34
+#define ICE9_HISTOGRAM_BUCKETS ((ICE9_HISTOGRAM_MAX_BITS - ICE9_HISTOGRAM_SUB_BITS + 1) << ICE9_HISTOGRAM_SUB_BITS)
+
+struct ice9_histogram {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t min_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[ICE9_HISTOGRAM_BUCKETS];
+};
+
+uint64_t ice9_now_ns(void);
+
+void ice9_histogram_reset(struct ice9_histogram *h);
+
+void ice9_histogram_record(struct ice9_histogram *h, uint64_t value_ns);
+
+void ice9_histogram_snapshot(struct ice9_histogram *h, struct ice9_latency_stats *stats);
+
+#endif  // _ICE9_HISTOGRAM_H_
@@ -1,50 +1,134 @@
 #include "ice9.h"
 #include "logger.h"
+#include "buffers.h"
+#include "threads.h"
+#include "histogram.h"
+#include "ice9_transport.h"
+#include "ice9_internal.h"
+#include "probes.h"
+#include "trace.h"
+#include "shadow.h"
+#include "deframe.h"
+#include "channels.h"
+#include "convert.h"
+#include <stdatomic.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <time.h>
-#include <libusb-1.0/libusb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define ICE9_VENDOR_ID 0x3524
-#define ICE9_DATA_PRODUCT_ID 0x0002
-
 #define MIN(a, b) ((a) < (b)) ? (a) : (b)
 
+// Always-on counters behind ice9_get_stats.  Updates are relaxed atomic adds,
+// so they cost next to nothing and can be read from any thread.
+struct ice9_counters {
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t transfers_out;
+    _Atomic uint64_t transfers_in;
+    _Atomic uint64_t short_packets;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t retries;
+    _Atomic uint64_t overruns;
+    _Atomic uint64_t ring_occupancy;
+    _Atomic uint64_t ring_high_water;
+    _Atomic uint64_t bytes_banked;
+    _Atomic uint64_t bytes_dropped;
+    _Atomic uint64_t register_writes_elided;
+    _Atomic uint64_t register_writes_combined;
+    _Atomic uint64_t register_reads_cached;
+    _Atomic uint64_t events;
+    _Atomic uint64_t frame_errors;
+    _Atomic uint64_t stream_total_bytes;
+    _Atomic uint64_t stream_total_rate;
+    _Atomic uint64_t stream_current_rate;
+};
+
+#define COUNT(hnd, counter, n) atomic_fetch_add_explicit(&(hnd)->counters.counter, (n), memory_order_relaxed)
+#define LOAD(hnd, counter) atomic_load_explicit(&(hnd)->counters.counter, memory_order_relaxed)
+#define STORE(hnd, counter, n) atomic_store_explicit(&(hnd)->counters.counter, (n), memory_order_relaxed)
+
 struct ice9_handle {
-    struct libusb_context *context;
-    struct libusb_device_handle *device;
-    uint8_t *read_buffer;
-    int read_buffer_size;
+    struct ice9_transport *transport;
+    int buffer_flags;
+    struct ice9_buffer read_buffer;
     int read_buffer_head;
     int read_buffer_tail;
     int stream_bytes_to_read;
     int stream_bytes_read_so_far;
     uint8_t *stream_data_ptr;
-    uint8_t *extra_data_buffer;
+    struct ice9_buffer extra_data_buffer;
     uint8_t *extra_data_read_pointer;
     int extra_data_bytes;
-    uint8_t *bulk_sync_read_buffer;
+    struct ice9_buffer transfer_buffer;
+    struct ice9_thread_settings thread_settings;
+    struct ice9_histogram latency[ICE9_OP_COUNT];
+    struct ice9_counters counters;
+    // See the threading model in ice9.h.  in_lock covers the IN endpoint and
+    // everything the read paths touch (ring, bank, transfer buffer); out_lock
+    // the OUT endpoint.  In half duplex mode both point at locks[0].  When
+    // both are needed, out_lock is taken first.
+    pthread_mutex_t locks[2];
+    pthread_mutex_t *in_lock;
+    pthread_mutex_t *out_lock;
+    _Atomic int last_error;
+    // Allocated the first time a register policy or write combining is set,
+    // and guarded by out_lock.
+    struct ice9_shadow *shadow;
+    // Device events and channel frames, guarded by in_lock.
+    struct ice9_deframer deframer;
+    // Multi-channel streaming: a ring per enabled address, and the caller's
+    // buffer while ice9_channel_read (or, converting, ice9_channel_read_samples)
+    // is filling it.  Guarded by in_lock, except that a slot, once set, is
+    // published with a release store for ice9_get_channel_stats.
+    _Atomic(struct ice9_channel *) channels[256];
+    int channel_read_address;
+    uint8_t *channel_read_data;
+    int channel_read_bytes;
+    struct ice9_sample_dest *channel_read_samples;
 };
 
+// Defaults used when the config leaves a size at zero.
 #define BANK_SIZE (1024*1024)
-#define PACKET_SIZE 4096
 #define RING_BUFFER_SIZE (1024*1024)
+#define TRANSFER_SIZE 16384
 
-static enum Ice9Error ecode;
+// Remember a failure as the handle's last error, and pass it on.
+static enum Ice9Error set_error(struct ice9_handle *hnd, enum Ice9Error ret) {
+    if (ret != OK) {
+        atomic_store_explicit(&hnd->last_error, ret, memory_order_relaxed);
+    }
+    return ret;
+}
 
-#define lib_try(x) {ecode = (x); if (ecode != OK) {return ecode;}}
+#define lib_try(x) {enum Ice9Error ret_ = (x); if (ret_ != OK) {return set_error(hnd, ret_);}}
 
 // Helper functions for the ring buffer
 int bytes_in_read_buffer(struct ice9_handle* hnd) {
-    return ((hnd->read_buffer_head + RING_BUFFER_SIZE - hnd->read_buffer_tail) % RING_BUFFER_SIZE);
+    return ((hnd->read_buffer_head + hnd->read_buffer.size - hnd->read_buffer_tail) % hnd->read_buffer.size);
 }
 
 // The max fill is one byte less since we do not track 
 // if head==tail means the buffer is full or if it is empty.
 int free_space_in_read_buffer(struct ice9_handle* hnd) {
-    return RING_BUFFER_SIZE - 1 - bytes_in_read_buffer(hnd);
+    return hnd->read_buffer.size - 1 - bytes_in_read_buffer(hnd);
+}
+
+static void count_dropped(struct ice9_handle *hnd, int count) {
+    COUNT(hnd, bytes_dropped, count);
+    ICE9_PROBE1(bytes_dropped, count);
+}
+
+// Buffers are allocated on first use, so a handle that never streams does
+// not pay for them.
+static enum Ice9Error ensure_buffer(struct ice9_handle *hnd, struct ice9_buffer *buffer) {
+    return ice9_buffer_alloc(buffer, hnd->buffer_flags);
 }
 
 // Read bytes from the read buffer to the destination buffer up to the specified
@@ -52,82 +136,263 @@ int free_space_in_read_buffer(struct ice9_handle* hnd) {
 // transferred.  Callers responsibility to make sure dest buffer can hold count 
 // bytes.
 int drain_from_read_buffer(struct ice9_handle* hnd, uint8_t* dest, int count) {
+    // Nothing has ever been enqueued if the ring was never allocated.
+    if (hnd->read_buffer.data == NULL) {
+        return 0;
+    }
     // Because of the modulo operations, we cache this calculation.
     int in_buffer = bytes_in_read_buffer(hnd);
+    int requested = count;
     // This can always be done in at most 2 memcopy operations.  The first step 
     // is to update the count so it does not exceed the number of bytes we have
     // in the buffer.
     count = MIN(count, in_buffer);
+    uint64_t span = (count > 0) ? ice9_trace_begin() : 0;
     // The first transfer takes tail to min(tail + count, BUFSIZE), or
     // min(count, BUFSIZE-tail) bytes
-    int first_transfer = MIN(count, RING_BUFFER_SIZE - hnd->read_buffer_tail);
-    memcpy(dest, hnd->read_buffer + hnd->read_buffer_tail, first_transfer);
+    int first_transfer = MIN(count, hnd->read_buffer.size - hnd->read_buffer_tail);
+    memcpy(dest, hnd->read_buffer.data + hnd->read_buffer_tail, first_transfer);
     dest += first_transfer;
     // Update the tail pointer
-    hnd->read_buffer_tail = (hnd->read_buffer_tail + first_transfer) % RING_BUFFER_SIZE;
+    hnd->read_buffer_tail = (hnd->read_buffer_tail + first_transfer) % hnd->read_buffer.size;
     // The second transfer is now up to the remaining bytes
     int second_transfer = count - first_transfer;
-    memcpy(dest, hnd->read_buffer + hnd->read_buffer_tail, second_transfer);
+    memcpy(dest, hnd->read_buffer.data + hnd->read_buffer_tail, second_transfer);
     hnd->read_buffer_tail += second_transfer;
+    STORE(hnd, ring_occupancy, in_buffer - count);
+    ICE9_PROBE3(ring_drain, requested, count, in_buffer - count);
+    ice9_trace_end(span, "ring", "ring_drain", "bytes", count);
     return count;
 }
 
 // Write bytes to the read buffer up to the specified count.  Will not overflow the
-// buffer.  Returns the number of bytes actually written.  
+// buffer.  Returns the number of bytes actually written.  The ring is allocated
+// here on first use; if that fails nothing is written.
 int enqueue_to_read_buffer(struct ice9_handle* hnd, const uint8_t*src, int count) {
+    if (ensure_buffer(hnd, &hnd->read_buffer) != OK) {
+        return 0;
+    }
     // Calculate the amount of free space and adjust the count
     int buffer_space = free_space_in_read_buffer(hnd);
+    int requested = count;
     // adjust the bytes to enqueue to ensure the buffer does not overflow
     count = MIN(count, buffer_space);
     // This can always be done in at most 2 memcpy operations.  The first
     // transfer takes head to min(head + count, BUFSIZE) or 
     // min(count, BUFSIZE-head) bytes
-    int first_transfer = MIN(count, RING_BUFFER_SIZE - hnd->read_buffer_head);
-    memcpy(hnd->read_buffer + hnd->read_buffer_head, src, first_transfer);
+    int first_transfer = MIN(count, hnd->read_buffer.size - hnd->read_buffer_head);
+    memcpy(hnd->read_buffer.data + hnd->read_buffer_head, src, first_transfer);
     src += first_transfer;
     // Update the head pointer
-    hnd->read_buffer_head = (hnd->read_buffer_head + first_transfer) % RING_BUFFER_SIZE;
+    hnd->read_buffer_head = (hnd->read_buffer_head + first_transfer) % hnd->read_buffer.size;
     // The second transfer is now up to the remaining bytes
     int second_transfer = count - first_transfer;
-    memcpy(hnd->read_buffer + hnd->read_buffer_head, src, second_transfer);
+    memcpy(hnd->read_buffer.data + hnd->read_buffer_head, src, second_transfer);
     hnd->read_buffer_head += second_transfer;
+    // Only this thread moves the head, so a plain compare is enough here.
+    uint64_t fill = bytes_in_read_buffer(hnd);
+    STORE(hnd, ring_occupancy, fill);
+    if (fill > LOAD(hnd, ring_high_water)) {
+        STORE(hnd, ring_high_water, fill);
+    }
+    ICE9_PROBE3(ring_enqueue, requested, count, fill);
     return count;
 }
 
 
-struct ice9_handle* ice9_new(void) {
-    struct ice9_handle *p = (struct ice9_handle *)(malloc(sizeof(struct ice9_handle)));
-    if (libusb_init(&p->context) < 0) {
+struct ice9_handle* ice9_new_with_config(const struct ice9_config *config) {
+    struct ice9_handle *p = (struct ice9_handle *)(calloc(1, sizeof(struct ice9_handle)));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->transport = (config != NULL) ? config->transport : NULL;
+    if (p->transport == NULL) {
+        p->transport = ice9_libusb_transport_new();
+    }
+    if (p->transport == NULL) {
+        free(p);
         return NULL;
     }
-    p->read_buffer = (uint8_t*) malloc(RING_BUFFER_SIZE);
-    p->read_buffer_size = RING_BUFFER_SIZE;
-    p->read_buffer_head = 0;
-    p->read_buffer_tail = 0;
-    p->extra_data_buffer = (uint8_t*) malloc(BANK_SIZE);
-    p->extra_data_read_pointer = p->extra_data_buffer;
-    p->extra_data_bytes = 0;
-    p->bulk_sync_read_buffer = (uint8_t*) malloc(PACKET_SIZE);
+    p->read_buffer.size = RING_BUFFER_SIZE;
+    p->extra_data_buffer.size = BANK_SIZE;
+    p->transfer_buffer.size = TRANSFER_SIZE;
+    if (config != NULL) {
+        if (config->ring_buffer_size > 0) {
+            p->read_buffer.size = config->ring_buffer_size;
+        }
+        if (config->bank_size > 0) {
+            p->extra_data_buffer.size = config->bank_size;
+        }
+        p->buffer_flags = config->buffer_flags;
+        if (config->transfer_size > 0) {
+            // The status byte stripping works on whole packets, so round up.
+            p->transfer_buffer.size = ((config->transfer_size + USB_PACKET_SIZE - 1) / USB_PACKET_SIZE) * USB_PACKET_SIZE;
+        }
+    }
+    // The ring keeps one byte free to tell full from empty, so it needs at least 2.
+    if (p->read_buffer.size < 2) {
+        p->read_buffer.size = 2;
+    }
+    pthread_mutex_init(&p->locks[0], NULL);
+    pthread_mutex_init(&p->locks[1], NULL);
+    p->out_lock = &p->locks[0];
+    p->in_lock = ((config != NULL) && config->full_duplex) ? &p->locks[1] : &p->locks[0];
+    ice9_thread_settings_init(&p->thread_settings, NULL);
+    for (int i = 0; i < ICE9_OP_COUNT; i++) {
+        ice9_histogram_reset(&p->latency[i]);
+    }
+    // No buffers are allocated here - see ensure_buffer.
     return p;
 }
 
+struct ice9_handle* ice9_new(void) {
+    return ice9_new_with_config(NULL);
+}
+
 void ice9_free(struct ice9_handle *hnd) {
-    libusb_exit(hnd->context);
+    if (hnd == NULL) {
+        return;
+    }
+    hnd->transport->ops->close(hnd->transport->context);
+    ice9_transport_free(hnd->transport);
+    ice9_buffer_free(&hnd->read_buffer);
+    ice9_buffer_free(&hnd->extra_data_buffer);
+    ice9_buffer_free(&hnd->transfer_buffer);
+    pthread_mutex_destroy(&hnd->locks[0]);
+    pthread_mutex_destroy(&hnd->locks[1]);
+    free(hnd->shadow);
+    for (int i = 0; i < 256; i++) {
+        ice9_channel_free(hnd->channels[i]);
+    }
     free(hnd);
 }
 
-enum Ice9Error ice9_open(struct ice9_handle *hnd) {
-    hnd->device = libusb_open_device_with_vid_pid(hnd->context, ICE9_VENDOR_ID, ICE9_DATA_PRODUCT_ID);
-    if (hnd->device == NULL) {
-        return USBDeviceNotFound;
+enum Ice9Error ice9_last_error(struct ice9_handle *hnd) {
+    return atomic_load_explicit(&hnd->last_error, memory_order_relaxed);
+}
+
+enum Ice9Error ice9_reserve_buffers(struct ice9_handle *hnd) {
+    lib_try(ensure_buffer(hnd, &hnd->read_buffer));
+    lib_try(ensure_buffer(hnd, &hnd->extra_data_buffer));
+    if (hnd->extra_data_read_pointer == NULL) {
+        hnd->extra_data_read_pointer = hnd->extra_data_buffer.data;
     }
+    return set_error(hnd, ensure_buffer(hnd, &hnd->transfer_buffer));
+}
+
+enum Ice9Error ice9_set_thread_config(struct ice9_handle *hnd, const struct ice9_thread_config *config) {
+    struct ice9_thread_settings settings;
+    lib_try(ice9_thread_settings_init(&settings, config));
+    hnd->thread_settings = settings;
     return OK;
 }
 
-enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd) {
+const struct ice9_thread_settings *ice9_handle_thread_settings(struct ice9_handle *hnd) {
+    return &hnd->thread_settings;
+}
+
+int ice9_handle_buffer_flags(struct ice9_handle *hnd) {
+    return hnd->buffer_flags;
+}
+
+enum Ice9Error ice9_get_latency(struct ice9_handle *hnd, enum ice9_op op, struct ice9_latency_stats *stats) {
+    if ((op < 0) || (op >= ICE9_OP_COUNT)) {
+        return Error;
+    }
+    ice9_histogram_snapshot(&hnd->latency[op], stats);
+    return OK;
+}
+
+enum Ice9Error ice9_reset_latency(struct ice9_handle *hnd, enum ice9_op op) {
+    if ((op < 0) || (op >= ICE9_OP_COUNT)) {
+        return Error;
+    }
+    ice9_histogram_reset(&hnd->latency[op]);
+    return OK;
+}
+
+enum Ice9Error ice9_get_stats(struct ice9_handle *hnd, struct ice9_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes_out = LOAD(hnd, bytes_out);
+    stats->bytes_in = LOAD(hnd, bytes_in);
+    stats->transfers_out = LOAD(hnd, transfers_out);
+    stats->transfers_in = LOAD(hnd, transfers_in);
+    stats->short_packets = LOAD(hnd, short_packets);
+    stats->timeouts = LOAD(hnd, timeouts);
+    stats->retries = LOAD(hnd, retries);
+    stats->overruns = LOAD(hnd, overruns);
+    stats->ring_occupancy = LOAD(hnd, ring_occupancy);
+    stats->ring_high_water = LOAD(hnd, ring_high_water);
+    stats->bytes_banked = LOAD(hnd, bytes_banked);
+    stats->bytes_dropped = LOAD(hnd, bytes_dropped);
+    stats->register_writes_elided = LOAD(hnd, register_writes_elided);
+    stats->register_writes_combined = LOAD(hnd, register_writes_combined);
+    stats->register_reads_cached = LOAD(hnd, register_reads_cached);
+    stats->events = LOAD(hnd, events);
+    stats->frame_errors = LOAD(hnd, frame_errors);
+    stats->stream_total_bytes = LOAD(hnd, stream_total_bytes);
+    stats->stream_total_rate = LOAD(hnd, stream_total_rate);
+    stats->stream_current_rate = LOAD(hnd, stream_current_rate);
+    stats->ring_buffer_page_size = hnd->read_buffer.page_size;
+    stats->bank_page_size = hnd->extra_data_buffer.page_size;
+    stats->transfer_page_size = hnd->transfer_buffer.page_size;
+    return OK;
+}
+
+// Thin wrappers over the transport, using the library's usual 1s timeout.
+// The bulk wrappers also keep the transfer counters.
+static enum Ice9Error usb_control(struct ice9_handle *hnd, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index) {
+    ICE9_PROBE4(control_submit, request_type, request, value, index);
+    uint64_t span = ice9_trace_begin();
+    enum Ice9Error ret = hnd->transport->ops->control(hnd->transport->context, request_type, request, value, index, 1000);
+    ice9_trace_end(span, "usb", "control", "request", request);
+    ICE9_PROBE2(control_complete, request, ret);
+    if (ret == LibUSBTimeout) {
+        COUNT(hnd, timeouts, 1);
+    }
+    return ret;
+}
+
+static enum Ice9Error usb_submit_in(struct ice9_handle *hnd, uint8_t *data, int length, int *transferred) {
+    *transferred = 0;
+    ICE9_PROBE2(transfer_submit, 1, length);
+    uint64_t span = ice9_trace_begin();
+    enum Ice9Error ret = hnd->transport->ops->submit_in(hnd->transport->context, data, length, transferred, 1000);
+    ice9_trace_end(span, "usb", "bulk_in", "bytes", *transferred);
+    ICE9_PROBE4(transfer_complete, 1, length, *transferred, ret);
+    COUNT(hnd, transfers_in, 1);
+    COUNT(hnd, bytes_in, *transferred);
+    if (ret == LibUSBTimeout) {
+        COUNT(hnd, timeouts, 1);
+    } else if ((ret == OK) && (*transferred < length)) {
+        COUNT(hnd, short_packets, 1);
+    }
+    return ret;
+}
+
+static enum Ice9Error usb_submit_out(struct ice9_handle *hnd, const uint8_t *data, int length, int *transferred) {
+    *transferred = 0;
+    ICE9_PROBE2(transfer_submit, 0, length);
+    uint64_t span = ice9_trace_begin();
+    enum Ice9Error ret = hnd->transport->ops->submit_out(hnd->transport->context, data, length, transferred, 1000);
+    ice9_trace_end(span, "usb", "bulk_out", "bytes", *transferred);
+    ICE9_PROBE4(transfer_complete, 0, length, *transferred, ret);
+    COUNT(hnd, transfers_out, 1);
+    COUNT(hnd, bytes_out, *transferred);
+    if (ret == LibUSBTimeout) {
+        COUNT(hnd, timeouts, 1);
+    }
+    return ret;
+}
+
+enum Ice9Error ice9_open(struct ice9_handle *hnd) {
+    return set_error(hnd, hnd->transport->ops->open(hnd->transport->context));
+}
+
+static enum Ice9Error usb_reset(struct ice9_handle *hnd) {
     LOG_INFO("Reset USB w/FTDI packets\n");
     // First, send a 0x40, 0, 0, 0
-    if (libusb_control_transfer(hnd->device, 0x40, 0, 0, 0, NULL, 0, 1000) < 0)
+    if (usb_control(hnd, 0x40, 0, 0, 0) != OK)
     {
         LOG_ERROR("Unable to send reset to chip...\n");
         return ResetFailed;
@@ -136,7 +401,7 @@ enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd) {
     // Second, send a 0x40, 0, 1, 0 (2 of these)
     for (int i = 0; i < 2; i++)
     {
-        if (libusb_control_transfer(hnd->device, 0x40, 0, 1, 0, NULL, 0, 1000) < 0)
+        if (usb_control(hnd, 0x40, 0, 1, 0) != OK)
         {
             LOG_ERROR("Unable to send 0x40 x 1 reset\n");
             return ResetFailed;
@@ -146,17 +411,17 @@ enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd) {
     unsigned char dummy[4096];
     int transferred = 0;
     // Do a read from endpoint 1 for some reason.
-    int ret = libusb_bulk_transfer(hnd->device, 0x81, dummy, 4096, &transferred, 1000);
-    if (ret < 0)
+    enum Ice9Error ret = usb_submit_in(hnd, dummy, 4096, &transferred);
+    if (ret != OK)
     {
-        LOG_ERROR("Unable to issue bulk read to endpoint 1 - libusb error code %d\n", ret);
+        LOG_ERROR("Unable to issue bulk read to endpoint 1 - %s\n", ice9_error_string(ret));
         return ResetFailed;
     }
-    LOG_INFO("Reset bytes received: %d  %x %x %x %x\n", transferred, dummy[0], dummy[1], dummy[2], dummy[3]);
+    LOG_DEBUG("Reset bytes received: %d  %x %x %x %x\n", transferred, dummy[0], dummy[1], dummy[2], dummy[3]);
     // Second, send a 0x40, 0, 1, 0 (4 of these)
     for (int i = 0; i < 4; i++)
     {
-        if (libusb_control_transfer(hnd->device, 0x40, 0, 1, 0, NULL, 0, 1000) < 0)
+        if (usb_control(hnd, 0x40, 0, 1, 0) != OK)
         {
             LOG_ERROR("Unable to send 0x40 x 1 reset\n");
             return ResetFailed;
@@ -165,6 +430,10 @@ enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd) {
     return OK;
 }
 
+enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd) {
+    return set_error(hnd, usb_reset(hnd));
+}
+
 const char* ice9_error_string(enum Ice9Error code) {
     switch (code) {
         case OK: return "OK";
@@ -205,27 +474,44 @@ const char* ice9_error_string(enum Ice9Error code) {
         case PartialWrite: return "Partial write";
         case NoDataAvailable: return "No Data available for read";
         case PingMismatch: return "Ping mismatch";
+        case BufferAllocationFailed: return "Buffer allocation failed";
+        case BufferLockFailed: return "Unable to lock buffer in memory";
+        case InvalidThreadConfig: return "Invalid thread configuration";
+        case ThreadAffinityFailed: return "Unable to set thread cpu affinity";
+        case ThreadPermissionDenied: return "Not permitted to set thread scheduling policy";
+        case ThreadStartFailed: return "Unable to start thread";
+        case EndOfReplay: return "End of replayed recording";
+        case UnableToWriteTraceFile: return "Unable to write trace file";
+        case RegisterNotReadable: return "Register is write-only and has not been written";
+        case WaitTimedOut: return "Timed out waiting for register condition";
+        case ChannelNotEnabled: return "Channel has not been enabled for streaming";
+        case BadSampleFormat: return "Unsupported sample format";
+        case PipelineStageFailed: return "Pipeline stage failed";
+        case SharedMemoryFailed: return "Unable to set up shared memory";
+        case NoSubscriberSlot: return "All subscriber slots are in use";
+        case SubscriberLapped: return "Subscriber fell a whole ring behind the publisher";
+        case PublisherGone: return "Publishing process exited";
         default:
-            LOG_INFO("unknown ice9 error code %d\n");
+            LOG_WARN("unknown ice9 error code %d\n", code);
             return "Unknown";
     }
 }
 
-enum Ice9Error ice9_fifo_mode(struct ice9_handle *hnd) {
+static enum Ice9Error fifo_mode(struct ice9_handle *hnd) {
     // Next we send a 0x40, 0, 2
-    if (libusb_control_transfer(hnd->device, 0x40, 0, 2, 0, NULL, 0, 1000) < 0) {
+    if (usb_control(hnd, 0x40, 0, 2, 0) != OK) {
         LOG_ERROR("Unable to send 0x40 x 0 2\n");
         return CannotEnableBitBangMode;
     }
 
     // Then we send a 0x40, 11, 0x00ff
-    if (libusb_control_transfer(hnd->device, 0x40, 11, 0x000ff, 0, NULL, 0, 1000) < 0) {
+    if (usb_control(hnd, 0x40, 11, 0x000ff, 0) != OK) {
         LOG_ERROR("Unable to send 0x40,11 request\n");
         return CannotEnableBitBangMode;
     }
     
     // Finally, we send the mode change
-    if (libusb_control_transfer(hnd->device, 0x40, 11, 0x40FF, 0, NULL, 0, 1000) < 0) {
+    if (usb_control(hnd, 0x40, 11, 0x40FF, 0) != OK) {
         LOG_ERROR("Unable to send 0x40 11 0x40ff reset\n");
         return CannotEnableBitBangMode;
     }
@@ -233,26 +519,30 @@ enum Ice9Error ice9_fifo_mode(struct ice9_handle *hnd) {
     int transferred = 0;
     unsigned char dummy[4096];
     // Do a read from endpoint 1 for some reason.
-    int ret = libusb_bulk_transfer(hnd->device, 0x81, dummy, 4096, &transferred, 1000);
-    if (ret < 0)
+    enum Ice9Error ret = usb_submit_in(hnd, dummy, 4096, &transferred);
+    if (ret != OK)
     {
-        LOG_ERROR("Unable to issue bulk read to endpoint 1 - libusb error code %d\n", ret);
+        LOG_ERROR("Unable to issue bulk read to endpoint 1 - %s\n", ice9_error_string(ret));
         return ResetFailed;
     }
-    LOG_ERROR("Mode set reset bytes received: %d  %x %x %x %x\n", transferred, dummy[0], dummy[1], dummy[2], dummy[3]);
+    LOG_DEBUG("Mode set reset bytes received: %d  %x %x %x %x\n", transferred, dummy[0], dummy[1], dummy[2], dummy[3]);
 
     // Send a lot of zeros...
     unsigned char jnk[4096];
     memset(jnk, 0, 4096);
     int actual_length = 0;
-    ret = libusb_bulk_transfer(hnd->device, 0x02, jnk, 4096, &actual_length, 1000);
-    LOG_ERROR("Reset clear write packet %d %d\n", actual_length, ret);
+    ret = usb_submit_out(hnd, jnk, 4096, &actual_length);
+    LOG_DEBUG("Reset clear write packet %d %d\n", actual_length, ret);
     ice9_ping_bridge(hnd, 0x67);
     return OK;
 }
 
+enum Ice9Error ice9_fifo_mode(struct ice9_handle *hnd) {
+    return set_error(hnd, fifo_mode(hnd));
+}
+
 enum Ice9Error ice9_close(struct ice9_handle *hnd) {
-    libusb_close(hnd->device);
+    hnd->transport->ops->close(hnd->transport->context);
     return OK;
 }
 
@@ -270,29 +560,56 @@ int transfer_bytes(struct ice9_handle *hnd, const uint8_t *ptr, int available) {
 }
 
 int bank_bytes(struct ice9_handle *hnd, const uint8_t *ptr, int to_bank) {
+    // The bank is only needed by this path, so it is allocated on first use.
+    if (hnd->extra_data_buffer.data == NULL) {
+        if (ensure_buffer(hnd, &hnd->extra_data_buffer) != OK) {
+            count_dropped(hnd, to_bank);
+            return -1;
+        }
+        hnd->extra_data_read_pointer = hnd->extra_data_buffer.data;
+    }
     // We are going to append to_bank bytes worth of data to the extra data buffer.
     // We must be careful as we may overflow the extra data buffer.
-    int bank_used = hnd->extra_data_read_pointer - hnd->extra_data_buffer;
-    if ((to_bank + bank_used) >= BANK_SIZE) {
+    int bank_used = hnd->extra_data_read_pointer - hnd->extra_data_buffer.data;
+    if ((to_bank + bank_used) >= hnd->extra_data_buffer.size) {
+        count_dropped(hnd, to_bank);
         return -1;
     }
     memcpy(hnd->extra_data_read_pointer + hnd->extra_data_bytes, ptr, to_bank);
     hnd->extra_data_bytes += to_bank;
+    COUNT(hnd, bytes_banked, to_bank);
+    ICE9_PROBE2(bank_store, to_bank, hnd->extra_data_bytes);
     // In this case, we return 1 for OK, since that gets propagated to the callback.
     return 1;
 }
 
-int read_callback(uint8_t *buffer, int length, void *userdata) {
+void begin_callback_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
+    hnd->stream_data_ptr = data;
+    hnd->stream_bytes_to_read = num_bytes;
+    hnd->stream_bytes_read_so_far = 0;
+}
+
+int read_callback(uint8_t *buffer, int length, FTDIProgressInfo *progress, void *userdata) {
     struct ice9_handle *hnd = (struct ice9_handle *)(userdata);
+    // ftdi_readstream_ice9 reports progress with a callback that carries no data.
+    if (progress != NULL) {
+        STORE(hnd, stream_total_bytes, progress->current.totalBytes);
+        STORE(hnd, stream_total_rate, (uint64_t) progress->totalRate);
+        STORE(hnd, stream_current_rate, (uint64_t) progress->currentRate);
+        return 0;
+    }
     // First transfer bytes from the backing store (if available)
     int copy_from_store = transfer_bytes(hnd, hnd->extra_data_read_pointer, hnd->extra_data_bytes);
     int extra_data_bytes_was_nonzero = hnd->extra_data_bytes != 0;
     hnd->extra_data_read_pointer += copy_from_store;
     hnd->extra_data_bytes -= copy_from_store;
+    if (copy_from_store != 0) {
+        ICE9_PROBE2(bank_drain, copy_from_store, hnd->extra_data_bytes);
+    }
     if (extra_data_bytes_was_nonzero && (hnd->extra_data_bytes == 0)) {
         // Reset the extra bytes buffer
-        hnd->extra_data_read_pointer = hnd->extra_data_buffer;
-        memset(hnd->extra_data_buffer, 0, BANK_SIZE);
+        hnd->extra_data_read_pointer = hnd->extra_data_buffer.data;
+        memset(hnd->extra_data_buffer.data, 0, hnd->extra_data_buffer.size);
     }
     // Next, transfer bytes from the provided buffer (if possible)
     int copy_from_new_buffer = transfer_bytes(hnd, buffer, length);
@@ -325,40 +642,80 @@ int ftdi_readstream_ice9(struct ftdi_context *ftdi,
 
 
 
-enum Ice9Error ice9_stream_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
+// Strip the status bytes from the read buffer.  The stripped data never
+// runs ahead of the raw data, so this is done in place.  Packets with the
+// overrun bit set in their line status byte are counted in *overruns.
+int strip_status_bytes(uint8_t *buffer, int length, int *overruns) {
+    uint8_t *src = buffer;
+    uint8_t *dest = buffer;
+    int valid_read = 0;
+    while (length > 0) { // Note, we assume packets are well formed here
+        *overruns += (src[1] & FTDI_OVERRUN) != 0;
+        int to_copy = MIN(USB_PACKET_SIZE - 2, length - 2);
+        memmove(dest, src + 2, to_copy);
+        length -= to_copy + 2;
+        valid_read += to_copy;
+        dest += to_copy;
+        src += to_copy + 2;
+    }
+    return valid_read;
+}
+
+// Strip the status bytes from an IN transfer, splitting out device events
+// if they are on.  Called with the IN lock held.
+static int unpack_in(struct ice9_handle *hnd, uint8_t *buffer, int length, int *overruns) {
+    if (!ice9_deframer_active(&hnd->deframer)) {
+        return strip_status_bytes(buffer, length, overruns);
+    }
+    int events = 0;
+    int frame_errors = 0;
+    int valid_read = ice9_deframe(&hnd->deframer, buffer, length, overruns, &events, &frame_errors);
+    if (events != 0) {
+        COUNT(hnd, events, events);
+    }
+    if (frame_errors != 0) {
+        COUNT(hnd, frame_errors, frame_errors);
+        LOG_ERROR_RATELIMITED("ice9: channel frame received with channel streaming off, dropped\n");
+    }
+    return valid_read;
+}
+
+static enum Ice9Error stream_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
     // First, try and supply as many bytes from the cached buffer as possible
     int from_cache = drain_from_read_buffer(hnd, data, num_bytes);
     data += from_cache;
     num_bytes -= from_cache; // Safe, as drain never returns more than the requested number of bytes.
+    if (num_bytes > 0) {
+        lib_try(ensure_buffer(hnd, &hnd->transfer_buffer));
+    }
     // Do we need more data?  Try to siphon from the device
     while (num_bytes > 0) {
-        uint8_t buffer[16384];
+        uint8_t *buffer = hnd->transfer_buffer.data;
         int bytes_read = 0;
         // Yes... So request a buffer.  Because of the way USB works, we do not seem to request
         // the number of bytes we actually want.  Instead, we ask for data, and simply supply a 
         // buffer that is large enough to hold the maximum number of bytes that might come back.
         // For this case, we want libusb to issue a lot of requests, so indicate a large buffer.
-        // Making the buffer larger than 16K causes it to fail.
-        int ret = libusb_bulk_transfer(hnd->device, 0x81, buffer, 16384, &bytes_read, 1000);
-        if (ret < 0) {
-            LOG_ERROR("libusb transfer error: %s\n", libusb_error_name(ret));
-            return Error;
+        // With the default 16K transfer size this is known to work; larger sizes
+        // depend on the host controller.
+        enum Ice9Error ret = usb_submit_in(hnd, buffer, hnd->transfer_buffer.size, &bytes_read);
+        if (ret != OK) {
+            // The end of a replayed recording is not a failure.
+            if (ret != EndOfReplay) {
+                LOG_ERROR("usb transfer error: %s\n", ice9_error_string(ret));
+            }
+            return ret;
         }
-        // Strip the status bytes from the read buffer.
-        uint8_t *src = buffer;
-        uint8_t buffer_stripped[16384];
-        uint8_t *dest = buffer_stripped;
-        int valid_read = 0;
-        while (bytes_read > 0) { // Note, we assume packets are well formed here
-            int to_copy = MIN(510, bytes_read - 2);
-            memcpy(dest, src + 2, to_copy);
-            bytes_read -= to_copy + 2;
-            valid_read += to_copy;
-            dest += to_copy;
-            src += to_copy + 2;
+        int overruns = 0;
+        int valid_read = unpack_in(hnd, buffer, bytes_read, &overruns);
+        if (overruns) {
+            COUNT(hnd, overruns, overruns);
+        }
+        if (valid_read == 0) {
+            COUNT(hnd, retries, 1);
         }
         // Transfer bytes (as many as possible) to the caller's buffer
-        src = buffer_stripped;
+        uint8_t *src = buffer;
         if ((valid_read > 0) && (num_bytes > 0)) {
             int pass_through = MIN(num_bytes, valid_read);
             memcpy(data, src, pass_through);
@@ -369,14 +726,87 @@ enum Ice9Error ice9_stream_read(struct ice9_handle *hnd, uint8_t *data, int num_
         }
         // Stash any left over bytes
         if ((num_bytes == 0) && (valid_read != 0)) {
-            enqueue_to_read_buffer(hnd, src, valid_read);
+            int dropped = valid_read - enqueue_to_read_buffer(hnd, src, valid_read);
+            if (dropped != 0) {
+                count_dropped(hnd, dropped);
+                LOG_ERROR_RATELIMITED("ice9 read buffer overflow - %d bytes dropped\n", dropped);
+            }
             valid_read = 0;
         }
     }
     return OK;
 }
 
-enum Ice9Error ice9_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
+enum Ice9Error ice9_stream_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
+    uint64_t start = ice9_now_ns();
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = stream_read(hnd, data, num_bytes);
+    pthread_mutex_unlock(hnd->in_lock);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_STREAM_READ], ice9_now_ns() - start);
+    return set_error(hnd, ret);
+}
+
+// Bytes held over from earlier reads are converted through a stack buffer;
+// everything after comes straight from the transfer buffer.
+static enum Ice9Error stream_read_samples(struct ice9_handle *hnd, struct ice9_sample_dest *dest) {
+    uint8_t chunk[4096];
+    int drained;
+    while ((ice9_sample_dest_wanted(dest) > 0) &&
+           ((drained = drain_from_read_buffer(hnd, chunk, MIN(ice9_sample_dest_wanted(dest), (int) sizeof(chunk)))) > 0)) {
+        ice9_sample_dest_fill(dest, chunk, drained);
+    }
+    if (ice9_sample_dest_wanted(dest) > 0) {
+        lib_try(ensure_buffer(hnd, &hnd->transfer_buffer));
+    }
+    while (ice9_sample_dest_wanted(dest) > 0) {
+        uint8_t *buffer = hnd->transfer_buffer.data;
+        int bytes_read = 0;
+        enum Ice9Error ret = usb_submit_in(hnd, buffer, hnd->transfer_buffer.size, &bytes_read);
+        if (ret != OK) {
+            // The end of a replayed recording is not a failure.
+            if (ret != EndOfReplay) {
+                LOG_ERROR("usb transfer error: %s\n", ice9_error_string(ret));
+            }
+            return ret;
+        }
+        int overruns = 0;
+        int valid_read = unpack_in(hnd, buffer, bytes_read, &overruns);
+        if (overruns) {
+            COUNT(hnd, overruns, overruns);
+        }
+        if (valid_read == 0) {
+            COUNT(hnd, retries, 1);
+        }
+        int used = ice9_sample_dest_fill(dest, buffer, valid_read);
+        if (used < valid_read) {
+            int dropped = valid_read - used - enqueue_to_read_buffer(hnd, buffer + used, valid_read - used);
+            if (dropped != 0) {
+                count_dropped(hnd, dropped);
+                LOG_ERROR_RATELIMITED("ice9 read buffer overflow - %d bytes dropped\n", dropped);
+            }
+        }
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_stream_read_samples(struct ice9_handle *hnd, const struct ice9_sample_format *format,
+                                        float *samples, int num_samples) {
+    struct ice9_conversion conversion;
+    lib_try(ice9_conversion_init(&conversion, format));
+    if (num_samples < 0) {
+        return set_error(hnd, Error);
+    }
+    struct ice9_sample_dest dest;
+    ice9_sample_dest_init(&dest, &conversion, samples, num_samples);
+    uint64_t start = ice9_now_ns();
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = stream_read_samples(hnd, &dest);
+    pthread_mutex_unlock(hnd->in_lock);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_STREAM_READ], ice9_now_ns() - start);
+    return set_error(hnd, ret);
+}
+
+static enum Ice9Error read_bulk(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
     // First, try and supply as many bytes from the cached buffer as possible
     int from_cache = drain_from_read_buffer(hnd, data, num_bytes);
     data += from_cache;
@@ -389,32 +819,61 @@ enum Ice9Error ice9_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes)
         // the number of bytes we actually want.  Instead, we ask for data, and simply supply a 
         // buffer that is large enough to hold the maximum number of bytes that might come back.
         // For this read, we assume the reads are small, so we ask for the data 1 packet at a time
-        int ret = libusb_bulk_transfer(hnd->device, 0x81, buffer, 512, &bytes_read, 1000);
-        if (ret < 0) {
-            LOG_ERROR("libusb transfer error: %s\n", libusb_error_name(ret));
-            return Error;
+        enum Ice9Error ret = usb_submit_in(hnd, buffer, 512, &bytes_read);
+        if (ret != OK) {
+            // The end of a replayed recording is not a failure.
+            if (ret != EndOfReplay) {
+                LOG_ERROR("usb transfer error: %s\n", ice9_error_string(ret));
+            }
+            return ret;
         }
         // Transfer as many bytes to the output as we can.  Discard the first two as they are
-        // garbage.
-        if (bytes_read > 2) {
-            int pass_through = MIN(num_bytes, bytes_read - 2);
-            int read_bytes_leftover = bytes_read - 2 - pass_through;
-            memcpy(data, buffer + 2, pass_through);
+        // the FTDI status bytes.
+        uint8_t *payload = buffer + 2;
+        int payload_bytes = bytes_read - 2;
+        if (ice9_deframer_active(&hnd->deframer)) {
+            int overruns = 0;
+            payload = buffer;
+            payload_bytes = unpack_in(hnd, buffer, bytes_read, &overruns);
+            if (overruns) {
+                COUNT(hnd, overruns, overruns);
+            }
+        } else if ((bytes_read >= 2) && (buffer[1] & FTDI_OVERRUN)) {
+            COUNT(hnd, overruns, 1);
+        }
+        if (payload_bytes <= 0) {
+            COUNT(hnd, retries, 1);
+        }
+        if (payload_bytes > 0) {
+            int pass_through = MIN(num_bytes, payload_bytes);
+            int read_bytes_leftover = payload_bytes - pass_through;
+            memcpy(data, payload, pass_through);
             data += pass_through;
             num_bytes -= pass_through;
             // Check for the case that we have satisfied the read request, but there are leftover
             // bytes
             if ((num_bytes == 0) && (read_bytes_leftover > 0)) {
-                enqueue_to_read_buffer(hnd, buffer + pass_through, read_bytes_leftover);
+                int dropped = read_bytes_leftover -
+                    enqueue_to_read_buffer(hnd, payload + pass_through, read_bytes_leftover);
+                if (dropped != 0) {
+                    count_dropped(hnd, dropped);
+                }
             }
         }
     }
     return OK;
 }
 
-enum Ice9Error ice9_write(struct ice9_handle *hnd, const uint8_t *data, int num_bytes) {
+enum Ice9Error ice9_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes) {
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = read_bulk(hnd, data, num_bytes);
+    pthread_mutex_unlock(hnd->in_lock);
+    return set_error(hnd, ret);
+}
+
+static enum Ice9Error write_bulk(struct ice9_handle *hnd, const uint8_t *data, int num_bytes) {
     int actual_length = 0;
-    if (libusb_bulk_transfer(hnd->device, 0x02, (unsigned char *) data, num_bytes, &actual_length, 1000) < 0) {
+    if (usb_submit_out(hnd, data, num_bytes, &actual_length) != OK) {
         return LibUSBIOError;
     }
     if (actual_length != num_bytes) {
@@ -423,6 +882,39 @@ enum Ice9Error ice9_write(struct ice9_handle *hnd, const uint8_t *data, int num_
     return OK;
 }
 
+enum Ice9Error ice9_write(struct ice9_handle *hnd, const uint8_t *data, int num_bytes) {
+    uint64_t start = ice9_now_ns();
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = write_bulk(hnd, data, num_bytes);
+    pthread_mutex_unlock(hnd->out_lock);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_WRITE], ice9_now_ns() - start);
+    return set_error(hnd, ret);
+}
+
+// Send a request and read back its reply as one transaction.  The OUT lock
+// is held only for the send, and the IN lock is taken before it is dropped,
+// so replies are collected in the order the requests went out.  delay_us is
+// slept between the two, holding only the IN lock.  Called with the OUT lock
+// held; returns with neither held.
+static enum Ice9Error transact(struct ice9_handle *hnd, const uint16_t *request, int request_words,
+                               uint8_t *reply, int reply_bytes, int delay_us) {
+    enum Ice9Error ret = write_bulk(hnd, (const uint8_t *) request, request_words * 2);
+    if (ret != OK) {
+        pthread_mutex_unlock(hnd->out_lock);
+        return ret;
+    }
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_lock(hnd->in_lock);
+        pthread_mutex_unlock(hnd->out_lock);
+    }
+    if (delay_us > 0) {
+        usleep(delay_us);
+    }
+    ret = read_bulk(hnd, reply, reply_bytes);
+    pthread_mutex_unlock(hnd->in_lock);
+    return ret;
+}
+
 enum Ice9Error ice9_write_words(struct ice9_handle *hnd, uint16_t *data, uint16_t len) {
     return ice9_write(hnd, (uint8_t*)(data), len * 2);
 }
@@ -435,12 +927,87 @@ enum Ice9Error ice9_read_words(struct ice9_handle *hnd, uint16_t *data, uint16_t
     return ice9_read(hnd, (uint8_t*)(data), len * 2);
 }
 
-enum Ice9Error ice9_write_data_to_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
+// The header and data are sent under one hold of the OUT lock, so no other
+// write can land between them.
+static enum Ice9Error write_data_to_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
     uint16_t header[2];
     header[0] = 0x0300 | address;
     header[1] = len;
-    lib_try(ice9_write_words(hnd, header, 2));
-    return ice9_write_words(hnd, data, len);
+    enum Ice9Error ret = write_bulk(hnd, (uint8_t *) header, sizeof(header));
+    if (ret == OK) {
+        ret = write_bulk(hnd, (uint8_t *) data, len * 2);
+    }
+    return ret;
+}
+
+// Send the writes write combining has been holding back.  Called with the
+// OUT lock held.
+static enum Ice9Error flush_registers(struct ice9_handle *hnd) {
+    struct ice9_shadow *shadow = hnd->shadow;
+    if ((shadow == NULL) || (shadow->num_pending == 0)) {
+        return OK;
+    }
+    enum Ice9Error ret = OK;
+    int i;
+    for (i = 0; i < shadow->num_pending; i++) {
+        uint8_t address = shadow->pending[i];
+        if (!shadow->dirty[address]) {
+            continue;
+        }
+        ret = write_data_to_address(hnd, address, shadow->words[address], shadow->len[address]);
+        if (ret != OK) {
+            break;
+        }
+        shadow->dirty[address] = 0;
+    }
+    // On failure keep what was not sent, so the next flush retries it.
+    int kept = 0;
+    for (; i < shadow->num_pending; i++) {
+        if (shadow->dirty[shadow->pending[i]]) {
+            shadow->pending[kept++] = shadow->pending[i];
+        }
+    }
+    shadow->num_pending = kept;
+    return ret;
+}
+
+static enum Ice9Error shadowed_write(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
+    if (hnd->shadow == NULL) {
+        return write_data_to_address(hnd, address, data, len);
+    }
+    switch (ice9_shadow_write(hnd->shadow, address, data, len)) {
+        case SHADOW_ELIDED:
+            COUNT(hnd, register_writes_elided, 1);
+            return OK;
+        case SHADOW_COMBINED:
+            COUNT(hnd, register_writes_combined, 1);
+            return OK;
+        case SHADOW_DEFERRED:
+            return OK;
+        default:
+            break;
+    }
+    // Keep held writes ahead of this one.
+    enum Ice9Error ret = flush_registers(hnd);
+    if (ret == OK) {
+        ret = write_data_to_address(hnd, address, data, len);
+    }
+    if (ret != OK) {
+        // The shadow already holds the new value, which never arrived.
+        ice9_shadow_forget(hnd->shadow, address);
+    }
+    return ret;
+}
+
+enum Ice9Error ice9_write_data_to_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
+    uint64_t span = ice9_trace_begin();
+    uint64_t start = ice9_now_ns();
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = shadowed_write(hnd, address, data, len);
+    pthread_mutex_unlock(hnd->out_lock);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_WRITE_DATA_TO_ADDRESS], ice9_now_ns() - start);
+    ice9_trace_end(span, "register", "register_write", "address", address);
+    return set_error(hnd, ret);
 }
 
 enum Ice9Error ice9_write_word_to_address(struct ice9_handle *hnd, uint8_t address, uint16_t value) {
@@ -457,39 +1024,553 @@ enum Ice9Error ice9_write_int_to_address(struct ice9_handle *hnd, uint8_t addres
 enum Ice9Error ice9_read_int_from_address(struct ice9_handle *hnd, uint8_t address, uint32_t *data) {
     uint16_t reply[2];
     lib_try(ice9_read_data_from_address(hnd, address, reply, 2));
-    data[0] = (reply[0] << 16) | reply[1];
+    data[0] = words_to_int(reply);
     return OK;
 }
 
-enum Ice9Error ice9_read_data_from_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
+// Swapping the halves of a value is a rotate by 16; reversing its bytes as
+// well leaves each half in place with its two bytes swapped.
+static inline uint32_t swap_halves(uint32_t value, int flags) {
+    if (flags & ICE9_BYTESWAP) {
+        return ((value << 8) & 0xFF00FF00) | ((value >> 8) & 0x00FF00FF);
+    }
+    return (value << 16) | (value >> 16);
+}
+
+void swap_int_halves(uint32_t *dst, const uint32_t *src, int count, int flags) {
+    int i = 0;
+#if defined(__SSE2__)
+    if (flags & ICE9_BYTESWAP) {
+        for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+        }
+    } else {
+        for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16)));
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (flags & ICE9_BYTESWAP) {
+        for (; i + 4 <= count; i += 4) {
+            uint8x16_t v = vld1q_u8((const uint8_t *) (src + i));
+            vst1q_u8((uint8_t *) (dst + i), vrev16q_u8(v));
+        }
+    } else {
+        for (; i + 4 <= count; i += 4) {
+            uint16x8_t v = vld1q_u16((const uint16_t *) (src + i));
+            vst1q_u16((uint16_t *) (dst + i), vrev32q_u16(v));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = swap_halves(src[i], flags);
+    }
+}
+
+// The most values one transaction can carry, as the length is in words.
+#define MAX_INTS (UINT16_MAX / 2)
+
+enum Ice9Error ice9_read_ints(struct ice9_handle *hnd, uint8_t address, uint32_t *data, uint16_t count, int flags) {
+    if (count > MAX_INTS) {
+        return set_error(hnd, Error);
+    }
+    // The reply lands as words in place, and is then swapped in place.
+    lib_try(ice9_read_data_from_address(hnd, address, (uint16_t *) data, count * 2));
+    swap_int_halves(data, data, count, flags);
+    return OK;
+}
+
+// Sends the header, then the values a chunk at a time through a stack
+// buffer, all under one hold of the OUT lock.  Short writes go through the
+// shadow like any other register write.
+static enum Ice9Error write_ints(struct ice9_handle *hnd, uint8_t address, const uint32_t *data, uint16_t count, int flags) {
+    uint32_t chunk[256];
+    if ((hnd->shadow != NULL) && (count * 2 <= ICE9_SHADOW_WORDS)) {
+        swap_int_halves(chunk, data, count, flags);
+        return shadowed_write(hnd, address, (uint16_t *) chunk, count * 2);
+    }
+    if (hnd->shadow != NULL) {
+        // Too long to shadow, so this just invalidates the address.
+        ice9_shadow_write(hnd->shadow, address, NULL, count * 2);
+        lib_try(flush_registers(hnd));
+    }
+    uint16_t header[2];
+    header[0] = 0x0300 | address;
+    header[1] = count * 2;
+    enum Ice9Error ret = write_bulk(hnd, (uint8_t *) header, sizeof(header));
+    for (int i = 0; (ret == OK) && (i < count); i += 256) {
+        int n = MIN(count - i, 256);
+        swap_int_halves(chunk, data + i, n, flags);
+        ret = write_bulk(hnd, (uint8_t *) chunk, n * 4);
+    }
+    return ret;
+}
+
+enum Ice9Error ice9_write_ints(struct ice9_handle *hnd, uint8_t address, const uint32_t *data, uint16_t count, int flags) {
+    if (count > MAX_INTS) {
+        return set_error(hnd, Error);
+    }
+    uint64_t span = ice9_trace_begin();
+    uint64_t start = ice9_now_ns();
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = write_ints(hnd, address, data, count, flags);
+    pthread_mutex_unlock(hnd->out_lock);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_WRITE_DATA_TO_ADDRESS], ice9_now_ns() - start);
+    ice9_trace_end(span, "register", "register_write", "address", address);
+    return set_error(hnd, ret);
+}
+
+// Reads kept in flight by ice9_wait_register.
+#define WAIT_PIPELINE_DEPTH 4
+
+// Called holding both locks, so nothing else can get a request in between
+// ours or take one of our replies.  Every request sent is answered before
+// returning, leaving the IN side clean, unless the transfer itself fails.
+static enum Ice9Error wait_register(struct ice9_handle *hnd, uint8_t address, uint32_t mask, uint32_t value,
+                                   unsigned int timeout_ms) {
+    uint16_t requests[2 * WAIT_PIPELINE_DEPTH];
+    for (int i = 0; i < WAIT_PIPELINE_DEPTH; i++) {
+        requests[2 * i] = 0x0200 | address;
+        requests[2 * i + 1] = 2;
+    }
+    uint64_t deadline = ice9_now_ns() + (uint64_t) timeout_ms * 1000000;
+    lib_try(write_bulk(hnd, (uint8_t *) requests, sizeof(requests)));
+    int in_flight = WAIT_PIPELINE_DEPTH;
+    enum Ice9Error ret = WaitTimedOut;
+    while (in_flight > 0) {
+        uint16_t reply[2];
+        lib_try(read_bulk(hnd, (uint8_t *) reply, sizeof(reply)));
+        in_flight--;
+        if ((words_to_int(reply) & mask) == value) {
+            ret = OK;
+            break;
+        }
+        if (ice9_now_ns() >= deadline) {
+            break;
+        }
+        // Top the pipeline back up.
+        lib_try(write_bulk(hnd, (uint8_t *) requests, 4));
+        in_flight++;
+    }
+    // Collect the replies still on their way.
+    if (in_flight > 0) {
+        uint16_t replies[2 * WAIT_PIPELINE_DEPTH];
+        lib_try(read_bulk(hnd, (uint8_t *) replies, in_flight * 4));
+    }
+    return ret;
+}
+
+enum Ice9Error ice9_wait_register(struct ice9_handle *hnd, uint8_t address, uint32_t mask, uint32_t value,
+                                  unsigned int timeout_ms) {
+    uint64_t span = ice9_trace_begin();
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = flush_registers(hnd);
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_lock(hnd->in_lock);
+    }
+    if (ret == OK) {
+        ret = wait_register(hnd, address, mask, value, timeout_ms);
+    }
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_unlock(hnd->in_lock);
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    ice9_trace_end(span, "register", "register_wait", "address", address);
+    return set_error(hnd, ret);
+}
+
+static enum Ice9Error read_data_from_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
     uint16_t header[2];
     header[0] = 0x0200 | address;
     header[1] = len;
-    lib_try(ice9_write_words(hnd, header, 2));
-    return ice9_read_words(hnd, data, len);
+    pthread_mutex_lock(hnd->out_lock);
+    struct ice9_shadow *shadow = hnd->shadow;
+    if (shadow == NULL) {
+        return transact(hnd, header, 2, (uint8_t *) data, len * 2, 0);
+    }
+    enum Ice9Error ret = flush_registers(hnd);
+    if (ret == OK) {
+        ret = ice9_shadow_read(shadow, address, data, len);
+        if (ret == OK) {
+            COUNT(hnd, register_reads_cached, 1);
+        }
+    }
+    if (ret != NoDataAvailable) {
+        pthread_mutex_unlock(hnd->out_lock);
+        return ret;
+    }
+    uint32_t generation = shadow->generation[address];
+    lib_try(transact(hnd, header, 2, (uint8_t *) data, len * 2, 0));
+    pthread_mutex_lock(hnd->out_lock);
+    ice9_shadow_fill(shadow, address, data, len, generation);
+    pthread_mutex_unlock(hnd->out_lock);
+    return OK;
+}
+
+// Called with the OUT lock held.
+static enum Ice9Error ensure_shadow(struct ice9_handle *hnd) {
+    if (hnd->shadow == NULL) {
+        struct ice9_shadow *shadow = malloc(sizeof(*shadow));
+        if (shadow == NULL) {
+            return BufferAllocationFailed;
+        }
+        ice9_shadow_init(shadow);
+        hnd->shadow = shadow;
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_set_register_policy(struct ice9_handle *hnd, uint8_t address, int policy) {
+    if ((policy < ICE9_REGISTER_VOLATILE) || (policy > ICE9_REGISTER_WRITE_ONLY)) {
+        return set_error(hnd, Error);
+    }
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = ensure_shadow(hnd);
+    if (ret == OK) {
+        // Send anything held for the address under its old policy.
+        ret = flush_registers(hnd);
+    }
+    if (ret == OK) {
+        hnd->shadow->policy[address] = policy;
+        hnd->shadow->valid[address] = 0;
+        hnd->shadow->generation[address]++;
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+enum Ice9Error ice9_set_write_combining(struct ice9_handle *hnd, int enable) {
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = ensure_shadow(hnd);
+    if (ret == OK) {
+        hnd->shadow->write_combining = enable;
+        if (!enable) {
+            ret = flush_registers(hnd);
+        }
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+enum Ice9Error ice9_flush_registers(struct ice9_handle *hnd) {
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = flush_registers(hnd);
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+enum Ice9Error ice9_invalidate_registers(struct ice9_handle *hnd) {
+    pthread_mutex_lock(hnd->out_lock);
+    if (hnd->shadow != NULL) {
+        ice9_shadow_invalidate(hnd->shadow);
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return OK;
+}
+
+enum Ice9Error ice9_read_data_from_address(struct ice9_handle *hnd, uint8_t address, uint16_t *data, uint16_t len) {
+    uint64_t span = ice9_trace_begin();
+    uint64_t start = ice9_now_ns();
+    enum Ice9Error ret = read_data_from_address(hnd, address, data, len);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_READ_DATA_FROM_ADDRESS], ice9_now_ns() - start);
+    ice9_trace_end(span, "register", "register_read", "address", address);
+    return set_error(hnd, ret);
 }
 
 enum Ice9Error ice9_send_ping(struct ice9_handle *hnd, uint8_t pingid) {
     return ice9_write_word(hnd, 0x0100 | pingid);
 }
 
-enum Ice9Error ice9_ping_bridge(struct ice9_handle *hnd, uint8_t pingid) {
-    lib_try(ice9_send_ping(hnd, pingid));
+static enum Ice9Error ping_bridge(struct ice9_handle *hnd, uint8_t pingid) {
+    uint16_t ping = 0x0100 | pingid;
     uint16_t pingret = 0;
-    usleep(1000);
-    lib_try(ice9_read_words(hnd, &pingret, 1));
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = flush_registers(hnd);
+    if (ret != OK) {
+        pthread_mutex_unlock(hnd->out_lock);
+        return ret;
+    }
+    ret = transact(hnd, &ping, 1, (uint8_t *) &pingret, 2, 1000);
+    if (ret != OK) {
+        return ret;
+    }
     pingret = pingret & 0xFF;
     if (pingret != pingid) {
-        LOG_INFO("ice9 ping mismatch - sent %x, recv %x\n", pingid, pingret);
+        LOG_WARN("ice9 ping mismatch - sent %x, recv %x\n", pingid, pingret);
         return PingMismatch;
     }
     return OK;
 }
 
+enum Ice9Error ice9_ping_bridge(struct ice9_handle *hnd, uint8_t pingid) {
+    uint64_t start = ice9_now_ns();
+    enum Ice9Error ret = ping_bridge(hnd, pingid);
+    ice9_histogram_record(&hnd->latency[ICE9_OP_PING_BRIDGE], ice9_now_ns() - start);
+    return set_error(hnd, ret);
+}
+
+// Held register writes go out ahead of the command.
+static enum Ice9Error write_command(struct ice9_handle *hnd, uint16_t command) {
+    pthread_mutex_lock(hnd->out_lock);
+    enum Ice9Error ret = flush_registers(hnd);
+    if (ret == OK) {
+        ret = write_bulk(hnd, (const uint8_t *) &command, sizeof(command));
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+enum Ice9Error ice9_set_event_callback(struct ice9_handle *hnd, ice9_event_callback callback, void *userdata) {
+    pthread_mutex_lock(hnd->in_lock);
+    hnd->deframer.callback = callback;
+    hnd->deframer.userdata = userdata;
+    pthread_mutex_unlock(hnd->in_lock);
+    return OK;
+}
+
+// Both locks are held, so no read is part way through a transfer when the
+// framing changes.
+enum Ice9Error ice9_enable_events(struct ice9_handle *hnd, int enable) {
+    uint16_t command = enable ? 0x0601 : 0x0600;
+    pthread_mutex_lock(hnd->out_lock);
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_lock(hnd->in_lock);
+    }
+    enum Ice9Error ret = flush_registers(hnd);
+    if (ret == OK) {
+        ret = write_bulk(hnd, (const uint8_t *) &command, sizeof(command));
+    }
+    if (ret == OK) {
+        if (!ice9_deframer_active(&hnd->deframer)) {
+            ice9_deframer_reset(&hnd->deframer);
+        }
+        hnd->deframer.events = enable;
+    }
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_unlock(hnd->in_lock);
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+static enum Ice9Error poll_events(struct ice9_handle *hnd) {
+    uint8_t buffer[USB_PACKET_SIZE];
+    int bytes_read = 0;
+    lib_try(usb_submit_in(hnd, buffer, sizeof(buffer), &bytes_read));
+    int overruns = 0;
+    int valid_read = unpack_in(hnd, buffer, bytes_read, &overruns);
+    if (overruns) {
+        COUNT(hnd, overruns, overruns);
+    }
+    if (valid_read > 0) {
+        int dropped = valid_read - enqueue_to_read_buffer(hnd, buffer, valid_read);
+        if (dropped != 0) {
+            count_dropped(hnd, dropped);
+        }
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_poll_events(struct ice9_handle *hnd) {
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = poll_events(hnd);
+    pthread_mutex_unlock(hnd->in_lock);
+    return set_error(hnd, ret);
+}
+
+// Frame data for the channel being read goes straight to the caller, the
+// rest to the channels' rings.  The channel's ring is empty whenever the
+// caller is waiting on it, so order is kept.
+static void channel_sink(void *context, uint8_t address, const uint8_t *data, int length) {
+    struct ice9_handle *hnd = context;
+    struct ice9_channel *channel = hnd->channels[address];
+    if (channel == NULL) {
+        count_dropped(hnd, length);
+        return;
+    }
+    if ((address == hnd->channel_read_address) && (hnd->channel_read_samples != NULL)) {
+        int direct = ice9_sample_dest_fill(hnd->channel_read_samples, data, length);
+        ice9_channel_received(channel, direct);
+        data += direct;
+        length -= direct;
+    } else if ((address == hnd->channel_read_address) && (hnd->channel_read_bytes > 0)) {
+        int direct = MIN(length, hnd->channel_read_bytes);
+        memcpy(hnd->channel_read_data, data, direct);
+        hnd->channel_read_data += direct;
+        hnd->channel_read_bytes -= direct;
+        ice9_channel_received(channel, direct);
+        data += direct;
+        length -= direct;
+    }
+    if (length > 0) {
+        ice9_channel_put(channel, data, length);
+    }
+}
+
+enum Ice9Error ice9_enable_channels(struct ice9_handle *hnd, const uint8_t *addresses, int count) {
+    if ((count <= 0) || (count > 256)) {
+        return set_error(hnd, Error);
+    }
+    uint16_t commands[256];
+    pthread_mutex_lock(hnd->out_lock);
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_lock(hnd->in_lock);
+    }
+    enum Ice9Error ret = OK;
+    for (int i = 0; (ret == OK) && (i < count); i++) {
+        if (atomic_load_explicit(&hnd->channels[addresses[i]], memory_order_relaxed) == NULL) {
+            struct ice9_channel *channel = ice9_channel_new(hnd->read_buffer.size, hnd->buffer_flags);
+            if (channel == NULL) {
+                ret = BufferAllocationFailed;
+            }
+            atomic_store_explicit(&hnd->channels[addresses[i]], channel, memory_order_release);
+        }
+        commands[i] = 0x0700 | addresses[i];
+    }
+    if (ret == OK) {
+        ret = flush_registers(hnd);
+    }
+    if (ret == OK) {
+        ret = write_bulk(hnd, (const uint8_t *) commands, count * sizeof(uint16_t));
+    }
+    if (ret == OK) {
+        if (!ice9_deframer_active(&hnd->deframer)) {
+            ice9_deframer_reset(&hnd->deframer);
+        }
+        hnd->deframer.sink = channel_sink;
+        hnd->deframer.sink_context = hnd;
+        hnd->deframer.channels = 1;
+    }
+    if (hnd->in_lock != hnd->out_lock) {
+        pthread_mutex_unlock(hnd->in_lock);
+    }
+    pthread_mutex_unlock(hnd->out_lock);
+    return set_error(hnd, ret);
+}
+
+// What the ice9_channel_read or ice9_channel_read_samples in progress still
+// wants, in bytes.
+static int channel_read_wanted(struct ice9_handle *hnd) {
+    if (hnd->channel_read_samples != NULL) {
+        return ice9_sample_dest_wanted(hnd->channel_read_samples);
+    }
+    return hnd->channel_read_bytes;
+}
+
+// Read from the device until channel_sink has given the caller all it asked
+// for.
+static enum Ice9Error fill_channel_read(struct ice9_handle *hnd) {
+    lib_try(ensure_buffer(hnd, &hnd->transfer_buffer));
+    while (channel_read_wanted(hnd) > 0) {
+        // Once the frame ending the stream has gone by, nothing more will come.
+        if (!hnd->deframer.channels) {
+            return NoDataAvailable;
+        }
+        uint8_t *buffer = hnd->transfer_buffer.data;
+        int bytes_read = 0;
+        enum Ice9Error ret = usb_submit_in(hnd, buffer, hnd->transfer_buffer.size, &bytes_read);
+        if (ret != OK) {
+            // The end of a replayed recording is not a failure.
+            if (ret != EndOfReplay) {
+                LOG_ERROR("usb transfer error: %s\n", ice9_error_string(ret));
+            }
+            return ret;
+        }
+        int overruns = 0;
+        int valid_read = unpack_in(hnd, buffer, bytes_read, &overruns);
+        if (overruns) {
+            COUNT(hnd, overruns, overruns);
+        }
+        // Anything outside a frame is for ice9_read.
+        if (valid_read > 0) {
+            int dropped = valid_read - enqueue_to_read_buffer(hnd, buffer, valid_read);
+            if (dropped != 0) {
+                count_dropped(hnd, dropped);
+            }
+        }
+    }
+    return OK;
+}
+
+static enum Ice9Error channel_read(struct ice9_handle *hnd, uint8_t address, uint8_t *data, int num_bytes) {
+    struct ice9_channel *channel = hnd->channels[address];
+    if (channel == NULL) {
+        return ChannelNotEnabled;
+    }
+    int from_ring = ice9_channel_get(channel, data, num_bytes);
+    if (from_ring == num_bytes) {
+        return OK;
+    }
+    hnd->channel_read_address = address;
+    hnd->channel_read_data = data + from_ring;
+    hnd->channel_read_bytes = num_bytes - from_ring;
+    enum Ice9Error ret = fill_channel_read(hnd);
+    hnd->channel_read_data = NULL;
+    hnd->channel_read_bytes = 0;
+    return ret;
+}
+
+enum Ice9Error ice9_channel_read(struct ice9_handle *hnd, uint8_t address, uint8_t *data, int num_bytes) {
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = channel_read(hnd, address, data, num_bytes);
+    pthread_mutex_unlock(hnd->in_lock);
+    return set_error(hnd, ret);
+}
+
+static enum Ice9Error channel_read_samples(struct ice9_handle *hnd, uint8_t address, struct ice9_sample_dest *dest) {
+    struct ice9_channel *channel = hnd->channels[address];
+    if (channel == NULL) {
+        return ChannelNotEnabled;
+    }
+    uint8_t chunk[4096];
+    int taken;
+    while ((ice9_sample_dest_wanted(dest) > 0) &&
+           ((taken = ice9_channel_get(channel, chunk, MIN(ice9_sample_dest_wanted(dest), (int) sizeof(chunk)))) > 0)) {
+        ice9_sample_dest_fill(dest, chunk, taken);
+    }
+    if (ice9_sample_dest_wanted(dest) == 0) {
+        return OK;
+    }
+    hnd->channel_read_address = address;
+    hnd->channel_read_samples = dest;
+    enum Ice9Error ret = fill_channel_read(hnd);
+    hnd->channel_read_samples = NULL;
+    return ret;
+}
+
+enum Ice9Error ice9_channel_read_samples(struct ice9_handle *hnd, uint8_t address,
+                                         const struct ice9_sample_format *format,
+                                         float *samples, int num_samples) {
+    struct ice9_conversion conversion;
+    lib_try(ice9_conversion_init(&conversion, format));
+    if (num_samples < 0) {
+        return set_error(hnd, Error);
+    }
+    struct ice9_sample_dest dest;
+    ice9_sample_dest_init(&dest, &conversion, samples, num_samples);
+    pthread_mutex_lock(hnd->in_lock);
+    enum Ice9Error ret = channel_read_samples(hnd, address, &dest);
+    pthread_mutex_unlock(hnd->in_lock);
+    return set_error(hnd, ret);
+}
+
+enum Ice9Error ice9_get_channel_stats(struct ice9_handle *hnd, uint8_t address, struct ice9_channel_stats *stats) {
+    // Channels are made by ice9_enable_channels and only freed with the
+    // handle, so the stats can be read without the IN lock.
+    struct ice9_channel *channel = atomic_load_explicit(&hnd->channels[address], memory_order_acquire);
+    if (channel == NULL) {
+        return set_error(hnd, ChannelNotEnabled);
+    }
+    ice9_channel_get_stats(channel, stats);
+    return OK;
+}
+
 enum Ice9Error ice9_enable_streaming(struct ice9_handle *hnd, uint8_t address) {
-    return ice9_write_word(hnd, 0x0500 | address);
+    return write_command(hnd, 0x0500 | address);
 }
 
 enum Ice9Error ice9_disable_streaming(struct ice9_handle *hnd) {
-    return ice9_write_word(hnd, 0xFFFF);
+    return write_command(hnd, 0xFFFF);
 }
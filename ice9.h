@@ -49,6 +49,177 @@ enum Ice9Error {
     NoDataAvailable,
     StreamReadComplete,
     PingMismatch,
+    BufferAllocationFailed,
+    BufferLockFailed,
+    InvalidThreadConfig,
+    ThreadAffinityFailed,
+    ThreadPermissionDenied,
+    ThreadStartFailed,
+    EndOfReplay,
+    UnableToWriteTraceFile,
+    RegisterNotReadable,
+    WaitTimedOut,
+    ChannelNotEnabled,
+    BadSampleFormat,
+    PipelineStageFailed,
+    SharedMemoryFailed,
+    NoSubscriberSlot,
+    SubscriberLapped,
+    PublisherGone,
+};
+
+/*
+ * Flags for ice9_config.buffer_flags.
+ *
+ *   ICE9_BUFFER_HUGE_PAGES - back the buffers with 1GB or 2MB huge pages from
+ *                            the hugetlbfs pool, falling back to transparent
+ *                            huge pages when the pool is empty
+ *   ICE9_BUFFER_LOCKED     - mlock the buffers so they can never be swapped out
+ *
+ * Either flag also pre-faults the buffers when they are allocated.
+ */
+#define ICE9_BUFFER_HUGE_PAGES 0x1
+#define ICE9_BUFFER_LOCKED     0x2
+
+struct ice9_transport;
+
+/*
+ * Threading model.
+ *
+ * A handle may be used from several threads at once.  Each I/O call
+ * (ice9_read, ice9_stream_read, ice9_write and everything built on them) is
+ * atomic with respect to the others: the IN and OUT sides of the bridge each
+ * have a lock, and a register read or ping holds the OUT lock only while
+ * sending its request, handing over to the IN lock before releasing it, so
+ * replies always come back to the thread that asked.  Locks are never held
+ * across calls.
+ *
+ * By default (half duplex) the two locks are one, so a handle runs a single
+ * transaction at a time and any mix of calls from any threads is safe.  With
+ * full_duplex set in ice9_config the sides are independent: one thread can
+ * stream writes while another reads, and register writes never wait for a
+ * read.  The caller then owns the IN side's protocol - a thread streaming
+ * with ice9_stream_read must not share the handle with register reads or
+ * pings, whose replies it would consume.
+ *
+ * Setup and teardown (ice9_open, ice9_close, ice9_usb_reset, ice9_fifo_mode,
+ * ice9_reserve_buffers, ice9_set_thread_config, ice9_free) must not overlap
+ * any other call on the same handle.  Statistics, latency and ice9_last_error
+ * may be read from any thread at any time.
+ */
+
+/*
+ * Buffer sizes (in bytes) for a handle.  Any field left at zero takes the
+ * library default.  Buffers are allocated on first use, so a handle that only
+ * does register transactions never pays for the streaming buffers.
+ *
+ *   ring_buffer_size - bytes held over between ice9_read/ice9_stream_read calls
+ *   bank_size        - bytes banked by the asynchronous read callback
+ *   transfer_size    - bytes per bulk IN transfer in ice9_stream_read, rounded
+ *                      up to a whole number of 512 byte packets
+ *   buffer_flags     - ICE9_BUFFER_* flags controlling how buffers are backed
+ *   transport        - USB backend (see ice9_transport.h); the handle takes
+ *                      ownership.  NULL gives the default libusb transport
+ *   full_duplex      - nonzero to let reads and writes run concurrently
+ *                      (see the threading model above)
+ */
+struct ice9_config {
+    int ring_buffer_size;
+    int bank_size;
+    int transfer_size;
+    int buffer_flags;
+    struct ice9_transport *transport;
+    int full_duplex;
+};
+
+/*
+ * Placement of the threads the library starts for a handle.
+ *
+ *   cpus, num_cpus - cpus the threads may run on; none means inherit
+ *   policy         - ICE9_SCHED_OTHER (default), ICE9_SCHED_FIFO or ICE9_SCHED_RR
+ *   priority       - real time priority, only used with FIFO and RR
+ *   name_prefix    - threads are named "<prefix>-<role>"; NULL gives "ice9"
+ */
+#define ICE9_SCHED_OTHER 0
+#define ICE9_SCHED_FIFO  1
+#define ICE9_SCHED_RR    2
+
+struct ice9_thread_config {
+    const int *cpus;
+    int num_cpus;
+    int policy;
+    int priority;
+    const char *name_prefix;
+};
+
+/*
+ * Operations with a latency histogram on every handle.
+ */
+enum ice9_op {
+    ICE9_OP_READ_DATA_FROM_ADDRESS,
+    ICE9_OP_WRITE,
+    ICE9_OP_STREAM_READ,
+    ICE9_OP_PING_BRIDGE,
+    ICE9_OP_WRITE_DATA_TO_ADDRESS,
+    ICE9_OP_COUNT,
+};
+
+/*
+ * Latency summary for one operation, in nanoseconds.  Percentiles are
+ * resolved to within 1/16 of their value and never exceed max_ns.
+ */
+struct ice9_latency_stats {
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+/*
+ * Runtime statistics for a handle.  The counters are kept all the time (each
+ * is a relaxed atomic add) and count from ice9_new.  Byte counts are what
+ * crossed the bus, so bulk IN counts include the 2 status bytes per packet.
+ * Page sizes are in bytes and are zero for buffers that have not been
+ * allocated yet.
+ */
+struct ice9_stats {
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t transfers_out;
+    uint64_t transfers_in;
+    // IN transfers ended early by a short packet (less data than was asked for).
+    uint64_t short_packets;
+    uint64_t timeouts;
+    // IN transfers that carried no payload, so the read had to go round again.
+    uint64_t retries;
+    // Packets with the FTDI overrun flag set - the device dropped data.
+    uint64_t overruns;
+    // Read ring fill, now and at its highest.
+    uint64_t ring_occupancy;
+    uint64_t ring_high_water;
+    // Surplus stream data kept for the next read, and data that had no room.
+    uint64_t bytes_banked;
+    uint64_t bytes_dropped;
+    // Register shadow: writes skipped as unchanged, writes folded into a
+    // later one before reaching the device, and reads answered locally.
+    uint64_t register_writes_elided;
+    uint64_t register_writes_combined;
+    uint64_t register_reads_cached;
+    // Device events split out of the IN stream.
+    uint64_t events;
+    // Channel frames that arrived while channel streaming was off, and were
+    // dropped.
+    uint64_t frame_errors;
+    // Progress from ftdi_readstream_ice9, in bytes and bytes per second.
+    uint64_t stream_total_bytes;
+    uint64_t stream_total_rate;
+    uint64_t stream_current_rate;
+    uint64_t ring_buffer_page_size;
+    uint64_t bank_page_size;
+    uint64_t transfer_page_size;
 };
 
 /*
@@ -61,12 +232,107 @@ EXTERN_C enum Ice9Error ice9_flash_fpga_mem(void *buf, int bufsize);
 
 EXTERN_C struct ice9_handle * ice9_new();
 
+/*
+ * As ice9_new, but with the buffer sizes taken from config.  A NULL config
+ * gives the same handle as ice9_new.
+ */
+EXTERN_C struct ice9_handle * ice9_new_with_config(const struct ice9_config *config);
+
+/*
+ * Close the device, if open, and release the handle and its transport.
+ */
 EXTERN_C void ice9_free(struct ice9_handle *hnd);
 
+/*
+ * The most recent error returned by a call on this handle, from any thread.
+ * OK if nothing has failed yet.  Return values remain the authoritative
+ * result of each call.
+ */
+EXTERN_C enum Ice9Error ice9_last_error(struct ice9_handle *hnd);
+
+/*
+ * Allocate all of the handle's buffers now rather than on first use.  Useful
+ * with ICE9_BUFFER_LOCKED, so that allocation (and any failure) happens before
+ * a capture starts.
+ */
+EXTERN_C enum Ice9Error ice9_reserve_buffers(struct ice9_handle *hnd);
+
+/*
+ * Set the affinity, scheduling and naming applied to every thread the library
+ * starts for this handle.  Only affects threads started after the call.  The
+ * settings are tried out immediately, so missing permissions for a real time
+ * policy are reported here (ThreadPermissionDenied).
+ */
+EXTERN_C enum Ice9Error ice9_set_thread_config(struct ice9_handle *hnd, const struct ice9_thread_config *config);
+
+/*
+ * Snapshot the handle's statistics.  Safe to call while other threads are
+ * using the handle; the counters are read individually, so they may be a
+ * transfer apart from each other.
+ */
+EXTERN_C enum Ice9Error ice9_get_stats(struct ice9_handle *hnd, struct ice9_stats *stats);
+
+/*
+ * Snapshot and reset the latency histogram for one operation.  Every call is
+ * recorded, including ones that fail.  Safe to call while other threads are
+ * using the handle.
+ */
+EXTERN_C enum Ice9Error ice9_get_latency(struct ice9_handle *hnd, enum ice9_op op, struct ice9_latency_stats *stats);
+
+EXTERN_C enum Ice9Error ice9_reset_latency(struct ice9_handle *hnd, enum ice9_op op);
+
+/*
+ * Timeline tracing.  Between ice9_trace_start and ice9_trace_stop, spans for
+ * every USB transfer, register transaction, ring drain and FPGA flash phase
+ * are recorded from all handles and threads into an in-memory ring of
+ * max_events entries.  When it fills the oldest spans are overwritten.
+ * ice9_trace_dump writes the ring as Chrome trace-event JSON, which loads in
+ * chrome://tracing or ui.perfetto.dev.  Start, stop and dump must not race
+ * with each other; dump after stopping.
+ */
+EXTERN_C enum Ice9Error ice9_trace_start(int max_events);
+
+EXTERN_C void ice9_trace_stop(void);
+
+EXTERN_C enum Ice9Error ice9_trace_dump(const char *filename);
+
+/*
+ * The default loggers write from a background thread, so messages reach
+ * stdout/stderr a few milliseconds after they are logged (and are flushed at
+ * exit).  A logger installed here is called directly on the logging thread.
+ */
 EXTERN_C void ice9_set_info_logger(void (*log_info)(const char *format, ...));
 
 EXTERN_C void ice9_set_error_logger(void (*log_error)(const char *file, int line, const char *format, ...));
 
+/*
+ * Write out any messages the default loggers are still holding.
+ */
+EXTERN_C void ice9_log_flush(void);
+
+/*
+ * Placement of the background thread the default loggers write from.  It
+ * serves the whole process, so it is configured here rather than by any
+ * handle's ice9_set_thread_config.  A running thread is restarted with the
+ * new settings; if they cannot be applied it keeps the old ones and the
+ * error is returned.
+ */
+EXTERN_C enum Ice9Error ice9_set_log_thread_config(const struct ice9_thread_config *config);
+
+/*
+ * Log levels.  Messages above the level set here are skipped before any
+ * formatting is done; the default is ICE9_LOG_INFO.  Messages above the
+ * library's build time level (the ICE9_LOG_LEVEL CMake option) are compiled
+ * out and cannot be turned back on.
+ */
+#define ICE9_LOG_NONE 0
+#define ICE9_LOG_ERROR 1
+#define ICE9_LOG_WARN 2
+#define ICE9_LOG_INFO 3
+#define ICE9_LOG_DEBUG 4
+
+EXTERN_C void ice9_set_log_level(int level);
+
 EXTERN_C enum Ice9Error ice9_open(struct ice9_handle *hnd);
 
 EXTERN_C enum Ice9Error ice9_usb_reset(struct ice9_handle *hnd);
@@ -99,6 +365,65 @@ EXTERN_C enum Ice9Error ice9_read_data_from_address(struct ice9_handle *hnd, uin
 
 EXTERN_C enum Ice9Error ice9_read_int_from_address(struct ice9_handle *hnd, uint8_t address, uint32_t *data);
 
+/*
+ * Arrays of 32-bit registers, moved in one transaction of 2 * count words
+ * (so count is at most 32767).  Each value travels as two 16-bit words,
+ * most significant first, as with ice9_read_int_from_address.  With
+ * ICE9_BYTESWAP the bytes of each value are also reversed, for memories
+ * that hold big-endian data.
+ */
+#define ICE9_BYTESWAP 0x1
+
+EXTERN_C enum Ice9Error ice9_read_ints(struct ice9_handle *hnd, uint8_t address, uint32_t *data, uint16_t count, int flags);
+
+EXTERN_C enum Ice9Error ice9_write_ints(struct ice9_handle *hnd, uint8_t address, const uint32_t *data, uint16_t count, int flags);
+
+/*
+ * Wait until the 32-bit register at address satisfies (reg & mask) == value,
+ * or timeout_ms passes (WaitTimedOut).  A few reads are kept in flight, each
+ * new one sent as a reply comes back, so a change is seen within about one
+ * USB poll rather than a full round trip.  Reads always go to the device,
+ * whatever the register's shadow policy.  The handle is busy, in both
+ * directions, for the duration of the wait.
+ */
+EXTERN_C enum Ice9Error ice9_wait_register(struct ice9_handle *hnd, uint8_t address, uint32_t mask, uint32_t value,
+                                           unsigned int timeout_ms);
+
+/*
+ * Register shadow.  The handle can keep a copy of what it last wrote to (or
+ * read from) each register address, and use it to save USB round trips:
+ *
+ *   ICE9_REGISTER_VOLATILE   - every access goes to the device (the default)
+ *   ICE9_REGISTER_CACHEABLE  - writes of the value already held are skipped,
+ *                              and reads are answered from the shadow once
+ *                              the value is known
+ *   ICE9_REGISTER_WRITE_ONLY - as cacheable, but never read from the device;
+ *                              reading before the first write gives
+ *                              RegisterNotReadable
+ *
+ * Only transfers of up to 8 words are shadowed; longer ones always go to the
+ * device.  With write combining on, writes to cacheable and write-only
+ * registers are held back, and repeated writes to one address collapse to
+ * the last value.  Held writes go out, in the order their addresses were
+ * first written, on ice9_flush_registers or before any other register
+ * access, ping or streaming command.  Raw ice9_write calls do not flush.
+ * Turning write combining off flushes.
+ *
+ * ice9_invalidate_registers forgets the cached values, e.g. after the FPGA
+ * has been reset or reprogrammed.
+ */
+#define ICE9_REGISTER_VOLATILE 0
+#define ICE9_REGISTER_CACHEABLE 1
+#define ICE9_REGISTER_WRITE_ONLY 2
+
+EXTERN_C enum Ice9Error ice9_set_register_policy(struct ice9_handle *hnd, uint8_t address, int policy);
+
+EXTERN_C enum Ice9Error ice9_set_write_combining(struct ice9_handle *hnd, int enable);
+
+EXTERN_C enum Ice9Error ice9_flush_registers(struct ice9_handle *hnd);
+
+EXTERN_C enum Ice9Error ice9_invalidate_registers(struct ice9_handle *hnd);
+
 EXTERN_C enum Ice9Error ice9_send_ping(struct ice9_handle *hnd, uint8_t pingid);
 
 EXTERN_C enum Ice9Error ice9_ping_bridge(struct ice9_handle *hnd, uint8_t pingid);
@@ -107,4 +432,245 @@ EXTERN_C enum Ice9Error ice9_enable_streaming(struct ice9_handle *hnd, uint8_t a
 
 EXTERN_C enum Ice9Error ice9_disable_streaming(struct ice9_handle *hnd);
 
+/*
+ * Device events.  Once enabled, the FPGA can raise an event - an id from 0
+ * to 253 and a 16-bit payload - at any time, e.g. on a capture trigger,
+ * instead of the host polling a status register.  Events travel on the IN
+ * side alongside replies and stream data, and are split out by whichever
+ * read receives them and passed to the callback.  The callback runs on that
+ * thread with the handle's IN lock held, so it must not call back into the
+ * handle.  ice9_poll_events makes one IN transfer just to collect events;
+ * any data that comes with them is kept for the next read.
+ *
+ * On the wire, 0x0601 turns events on and 0x0600 off.  While on, the device
+ * sends an event as the word 0x0Eii (ii the id) followed by the payload, and
+ * a data word with 0x0E as its high byte as 0x0EFF followed by the word.
+ * Turn events on and off while the device is not streaming.
+ */
+typedef void (*ice9_event_callback)(void *userdata, uint8_t event, uint16_t payload);
+
+EXTERN_C enum Ice9Error ice9_set_event_callback(struct ice9_handle *hnd, ice9_event_callback callback, void *userdata);
+
+EXTERN_C enum Ice9Error ice9_enable_events(struct ice9_handle *hnd, int enable);
+
+EXTERN_C enum Ice9Error ice9_poll_events(struct ice9_handle *hnd);
+
+/*
+ * Multi-channel streaming.  ice9_enable_channels starts streaming from
+ * several addresses at once; the device interleaves their data as tagged
+ * frames, and the library files each frame into the ring of its channel as
+ * the data is read.  ice9_channel_read reads one channel, pulling more from
+ * the device as needed and queueing what arrives for the others, each of
+ * which has a ring the size of the handle's read ring.  Data that is not in
+ * a frame (register replies) still goes to ice9_read.  Stop with
+ * ice9_disable_streaming; the channels' rings keep what they hold.
+ *
+ * On the wire, 0x07xx adds address xx to the streamed set.  Frames are the
+ * word 0x0EFE, then the channel address in the low byte and the number of
+ * words that follow (1-255) in the high byte, then the words.  0xFFFF ends
+ * streaming with a frame of zero words.  Other words are escaped as for
+ * events (see above).  Start channels while the device is not streaming.
+ */
+struct ice9_channel_stats {
+    // Bytes received for the channel, and those dropped as its ring was full.
+    uint64_t bytes;
+    uint64_t bytes_dropped;
+    // Ring fill, now and at its highest.
+    uint64_t ring_occupancy;
+    uint64_t ring_high_water;
+};
+
+EXTERN_C enum Ice9Error ice9_enable_channels(struct ice9_handle *hnd, const uint8_t *addresses, int count);
+
+EXTERN_C enum Ice9Error ice9_channel_read(struct ice9_handle *hnd, uint8_t address, uint8_t *data, int num_bytes);
+
+EXTERN_C enum Ice9Error ice9_get_channel_stats(struct ice9_handle *hnd, uint8_t address, struct ice9_channel_stats *stats);
+
+/*
+ * Sample conversion.  These read like ice9_stream_read and
+ * ice9_channel_read, but take packed integer samples and write floats: each
+ * sample is converted as it is copied out of the USB transfer, so there is
+ * no second pass over the data.  A sample is
+ *
+ *   sample_bits - 16 (one word) or 32 (two words, laid out as for
+ *                 ice9_read_ints)
+ *   sign_bits   - significant bits, sign extended from the top one; 0 for
+ *                 all of them
+ *   flags       - ICE9_BYTESWAP for big-endian samples
+ *
+ * and comes out as value * scale + offset.  32-bit values past 2^24 lose
+ * precision in the float.  Bytes are held over between calls as for the
+ * byte reads, so the two may be mixed, and a format may change from one
+ * call to the next.
+ */
+struct ice9_sample_format {
+    int sample_bits;
+    int sign_bits;
+    int flags;
+    float scale;
+    float offset;
+};
+
+EXTERN_C enum Ice9Error ice9_stream_read_samples(struct ice9_handle *hnd, const struct ice9_sample_format *format,
+                                                 float *samples, int num_samples);
+
+EXTERN_C enum Ice9Error ice9_channel_read_samples(struct ice9_handle *hnd, uint8_t address,
+                                                  const struct ice9_sample_format *format,
+                                                  float *samples, int num_samples);
+
+/*
+ * Processing pipelines.  A pipeline takes over a handle's stream: a reader
+ * thread fills fixed size chunks with ice9_stream_read, and a pool of worker
+ * threads carries each chunk through the stages in turn (convert, filter,
+ * decimate, ...) and on to the sink, so the USB drain and the processing
+ * run on different cores.  Idle workers steal chunks from busy ones.
+ *
+ * Chunks are processed in parallel, but always reach the sink in the order
+ * they were read.  A stage that keeps state from one chunk to the next (a
+ * filter's history, a decimator's phase, a recorder) is added with
+ * ICE9_STAGE_ORDERED, and then sees the chunks one at a time in order too.
+ *
+ * A stage reads in_bytes from in and writes at most out_capacity bytes to
+ * out, returning the number written (0 drops the chunk's data), or a
+ * negative number on failure, which stops the pipeline with
+ * PipelineStageFailed.  out_capacity is the stage's max_out_bytes, or the
+ * previous stage's (the chunk size for the first) when that is 0.
+ *
+ *   chunk_size - bytes read per chunk, a multiple of 4; 0 gives 64KB
+ *   workers    - worker threads; 0 gives one per CPU, less one for the
+ *                reader
+ *   chunks     - chunks in flight; 0 gives 4 per worker
+ *
+ * Threads take the handle's thread config (ice9_set_thread_config).  Stages
+ * and the sink are set up before ice9_pipeline_start.  Turn streaming on
+ * before starting and off after ice9_pipeline_stop, which finishes the chunk
+ * being read and delivers everything in flight before returning.  While the
+ * pipeline runs, nothing else may read the stream.
+ */
+struct ice9_pipeline;
+
+struct ice9_pipeline_config {
+    int chunk_size;
+    int workers;
+    int chunks;
+};
+
+#define ICE9_STAGE_ORDERED 0x1
+
+typedef int (*ice9_stage_fn)(void *context, const void *in, int in_bytes, void *out, int out_capacity);
+typedef void (*ice9_sink_fn)(void *context, const void *data, int bytes);
+
+struct ice9_pipeline_stats {
+    uint64_t chunks;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    // Chunks a worker took from another's queue.
+    uint64_t steals;
+    // Times the reader waited for a chunk to come back from the sink.
+    uint64_t reader_stalls;
+};
+
+EXTERN_C struct ice9_pipeline *ice9_pipeline_new(struct ice9_handle *hnd, const struct ice9_pipeline_config *config);
+
+EXTERN_C enum Ice9Error ice9_pipeline_add_stage(struct ice9_pipeline *pipeline, ice9_stage_fn fn, void *context,
+                                                int max_out_bytes, int flags);
+
+/*
+ * A stage converting the samples in each chunk to float, as
+ * ice9_stream_read_samples does.  Bytes past the last whole sample are
+ * dropped.
+ */
+EXTERN_C enum Ice9Error ice9_pipeline_add_convert(struct ice9_pipeline *pipeline, const struct ice9_sample_format *format);
+
+EXTERN_C enum Ice9Error ice9_pipeline_set_sink(struct ice9_pipeline *pipeline, ice9_sink_fn fn, void *context);
+
+EXTERN_C enum Ice9Error ice9_pipeline_start(struct ice9_pipeline *pipeline);
+
+/*
+ * Returns the first error the reader or a stage hit, if any.
+ */
+EXTERN_C enum Ice9Error ice9_pipeline_stop(struct ice9_pipeline *pipeline);
+
+EXTERN_C enum Ice9Error ice9_pipeline_get_stats(struct ice9_pipeline *pipeline, struct ice9_pipeline_stats *stats);
+
+/*
+ * Stops the pipeline first if it is running.
+ */
+EXTERN_C void ice9_pipeline_free(struct ice9_pipeline *pipeline);
+
+/*
+ * Sharing a stream between processes.  The process that owns the device
+ * publishes stream data into a POSIX shared memory ring, and any number of
+ * local processes subscribe to it by name, each with its own read position.
+ * The ring is mapped twice back to back, so every run of data is contiguous
+ * and subscribers can read it in place.
+ *
+ * The publisher never waits for a subscriber.  One that falls a whole ring
+ * behind is lapped: it skips to the newest data, and the read that finds
+ * out returns SubscriberLapped.  Data read in place is only known to be
+ * intact when it is released - a release that returns SubscriberLapped
+ * means the publisher wrote over the data while it was in use.
+ *
+ * ring_size is rounded up to whole pages.  max_subscribers is the number of
+ * read positions kept; the slot of a subscriber that exited without
+ * unsubscribing is reused.  ice9_publish_stream reads from the handle
+ * straight into the ring.  Timeouts are in milliseconds; 0 returns at once
+ * and a negative timeout waits indefinitely.  A subscriber whose publisher
+ * has gone reads what is left and then gets NoDataAvailable, or
+ * PublisherGone if the publishing process exited without calling
+ * ice9_publisher_free.
+ */
+struct ice9_publisher;
+struct ice9_subscriber;
+
+struct ice9_publisher_stats {
+    uint64_t bytes;
+    uint64_t subscribers;
+    // Bytes the furthest behind subscriber has still to read.
+    uint64_t max_lag;
+};
+
+struct ice9_subscriber_stats {
+    uint64_t bytes;
+    uint64_t laps;
+    uint64_t bytes_lapped;
+};
+
+EXTERN_C struct ice9_publisher *ice9_publisher_new(const char *name, int ring_size, int max_subscribers);
+
+EXTERN_C enum Ice9Error ice9_publish(struct ice9_publisher *publisher, const uint8_t *data, int num_bytes);
+
+EXTERN_C enum Ice9Error ice9_publish_stream(struct ice9_handle *hnd, struct ice9_publisher *publisher, int num_bytes);
+
+EXTERN_C enum Ice9Error ice9_publisher_get_stats(struct ice9_publisher *publisher, struct ice9_publisher_stats *stats);
+
+/*
+ * Wakes any waiting subscribers and removes the name.  Subscribers keep
+ * their mappings until they unsubscribe.
+ */
+EXTERN_C void ice9_publisher_free(struct ice9_publisher *publisher);
+
+EXTERN_C struct ice9_subscriber *ice9_subscribe(const char *name);
+
+/*
+ * Point data at the unread data in the ring and set num_bytes to its
+ * length, waiting up to timeout_ms for there to be any.  The data stays
+ * unread until released.
+ */
+EXTERN_C enum Ice9Error ice9_subscriber_peek(struct ice9_subscriber *subscriber, const uint8_t **data, int *num_bytes,
+                                             int timeout_ms);
+
+EXTERN_C enum Ice9Error ice9_subscriber_release(struct ice9_subscriber *subscriber, int num_bytes);
+
+/*
+ * Copy out exactly num_bytes, waiting up to timeout_ms for each part of it.
+ */
+EXTERN_C enum Ice9Error ice9_subscriber_read(struct ice9_subscriber *subscriber, uint8_t *data, int num_bytes,
+                                             int timeout_ms);
+
+EXTERN_C enum Ice9Error ice9_subscriber_get_stats(struct ice9_subscriber *subscriber,
+                                                  struct ice9_subscriber_stats *stats);
+
+EXTERN_C void ice9_unsubscribe(struct ice9_subscriber *subscriber);
+
 #endif
@@ -0,0 +1,408 @@
+#ifndef _ICE9_HPP_
+#define _ICE9_HPP_
+
+// Header-only C++ wrapper over ice9.h.  Needs C++17; uses std::span and
+// std::expected when the standard library has them.
+//
+//   auto device = ice9::Device::open();
+//   if (!device) {
+//       fprintf(stderr, "%s\n", ice9::message(device.error()));
+//   }
+//   auto value = device->read_int(0x10);
+//   auto stream = device->stream(0x20);
+//   stream->read(buffer);
+//
+// Device and Stream are move-only.  A Device frees (and so closes) its handle
+// when destroyed, and a Stream turns streaming off.  Every call is an inline
+// forward to the C API: results carry either the value or the Ice9Error, and
+// reads and writes go straight between the caller's memory and the library.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<version>)
+#include <version>
+#endif
+#if defined(__cpp_lib_span)
+#include <span>
+#endif
+#if defined(__cpp_lib_expected)
+#include <expected>
+#endif
+
+#include "ice9.h"
+#include "ice9_transport.h"
+
+static_assert(__cplusplus >= 201703L, "ice9.hpp needs C++17");
+
+namespace ice9 {
+
+inline const char *message(enum Ice9Error error) {
+    return ice9_error_string(error);
+}
+
+#if defined(__cpp_lib_expected)
+
+template <typename T>
+using result = std::expected<T, enum Ice9Error>;
+
+inline std::unexpected<enum Ice9Error> failure(enum Ice9Error error) {
+    return std::unexpected<enum Ice9Error>(error);
+}
+
+#else
+
+struct unexpected_error {
+    enum Ice9Error error;
+};
+
+inline unexpected_error failure(enum Ice9Error error) {
+    return unexpected_error{error};
+}
+
+// The parts of std::expected<T, Ice9Error> the wrapper uses.
+template <typename T>
+class result {
+public:
+    result(const T &value) : value_(value), error_(OK) {}
+    result(T &&value) : value_(std::move(value)), error_(OK) {}
+    result(unexpected_error failed) : error_(failed.error) {}
+    result(const result &other) : error_(other.error_) {
+        if (has_value()) {
+            new (&value_) T(other.value_);
+        }
+    }
+    result(result &&other) : error_(other.error_) {
+        if (has_value()) {
+            new (&value_) T(std::move(other.value_));
+        }
+    }
+    result &operator=(const result &) = delete;
+    ~result() {
+        if (has_value()) {
+            value_.~T();
+        }
+    }
+
+    bool has_value() const { return error_ == OK; }
+    explicit operator bool() const { return has_value(); }
+    enum Ice9Error error() const { return error_; }
+
+    T &value() & { return value_; }
+    const T &value() const & { return value_; }
+    T &&value() && { return std::move(value_); }
+    T &operator*() & { return value_; }
+    const T &operator*() const & { return value_; }
+    T &&operator*() && { return std::move(value_); }
+    T *operator->() { return &value_; }
+    const T *operator->() const { return &value_; }
+
+    template <typename U>
+    T value_or(U &&fallback) const & {
+        return has_value() ? value_ : static_cast<T>(std::forward<U>(fallback));
+    }
+
+private:
+    union {
+        T value_;
+    };
+    enum Ice9Error error_;
+};
+
+template <>
+class result<void> {
+public:
+    result() : error_(OK) {}
+    result(unexpected_error failed) : error_(failed.error) {}
+
+    bool has_value() const { return error_ == OK; }
+    explicit operator bool() const { return has_value(); }
+    enum Ice9Error error() const { return error_; }
+    void value() const {}
+    void operator*() const {}
+
+private:
+    enum Ice9Error error_;
+};
+
+#endif
+
+#if defined(__cpp_lib_span)
+
+template <typename T>
+using span = std::span<T>;
+
+#else
+
+// The parts of std::span<T> the wrapper uses.
+template <typename T>
+class span {
+public:
+    constexpr span() : data_(nullptr), size_(0) {}
+    constexpr span(T *data, size_t size) : data_(data), size_(size) {}
+    template <size_t N>
+    constexpr span(T (&array)[N]) : data_(array), size_(N) {}
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U (*)[], T (*)[]>::value>>
+    constexpr span(const span<U> &other) : data_(other.data()), size_(other.size()) {}
+    template <typename Container,
+              typename = std::enable_if_t<
+                  !std::is_same<std::remove_cv_t<Container>, span>::value &&
+                  std::is_convertible<std::remove_pointer_t<decltype(std::declval<Container &>().data())> (*)[],
+                                      T (*)[]>::value>>
+    constexpr span(Container &container) : data_(container.data()), size_(container.size()) {}
+
+    constexpr T *data() const { return data_; }
+    constexpr size_t size() const { return size_; }
+    constexpr size_t size_bytes() const { return size_ * sizeof(T); }
+    constexpr bool empty() const { return size_ == 0; }
+    constexpr T *begin() const { return data_; }
+    constexpr T *end() const { return data_ + size_; }
+    constexpr T &operator[](size_t i) const { return data_[i]; }
+
+private:
+    T *data_;
+    size_t size_;
+};
+
+#endif
+
+namespace detail {
+
+inline result<void> check(enum Ice9Error ret) {
+    if (ret != OK) {
+        return failure(ret);
+    }
+    return {};
+}
+
+// The C API counts bytes in an int and words in a uint16_t.
+inline bool fits_int(size_t n) {
+    return n <= static_cast<size_t>(std::numeric_limits<int>::max());
+}
+
+inline bool fits_words(size_t n) {
+    return n <= std::numeric_limits<uint16_t>::max();
+}
+
+}  // namespace detail
+
+class Device;
+
+// Streaming from one address, on for the lifetime of the object.  Made with
+// Device::stream; must not outlive its Device.
+class Stream {
+public:
+    Stream(Stream &&other) noexcept : hnd_(std::exchange(other.hnd_, nullptr)) {}
+    Stream &operator=(Stream &&other) noexcept {
+        if (this != &other) {
+            stop();
+            hnd_ = std::exchange(other.hnd_, nullptr);
+        }
+        return *this;
+    }
+    Stream(const Stream &) = delete;
+    Stream &operator=(const Stream &) = delete;
+    ~Stream() { stop(); }
+
+    // Fill data from the stream.
+    result<void> read(span<uint8_t> data) {
+        if (!detail::fits_int(data.size())) {
+            return failure(Error);
+        }
+        return detail::check(ice9_stream_read(hnd_, data.data(), static_cast<int>(data.size())));
+    }
+
+    template <size_t N>
+    result<std::array<uint8_t, N>> read() {
+        static_assert(N <= static_cast<size_t>(std::numeric_limits<int>::max()), "read too large");
+        std::array<uint8_t, N> data;
+        enum Ice9Error ret = ice9_stream_read(hnd_, data.data(), static_cast<int>(N));
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return data;
+    }
+
+    // Fill samples with stream data converted to float (see
+    // ice9_stream_read_samples).
+    result<void> read_samples(span<float> samples, const struct ice9_sample_format &format) {
+        if (!detail::fits_int(samples.size())) {
+            return failure(Error);
+        }
+        return detail::check(ice9_stream_read_samples(hnd_, &format, samples.data(), static_cast<int>(samples.size())));
+    }
+
+    // Turn streaming off now, rather than when the stream is destroyed.
+    result<void> stop() {
+        if (hnd_ == nullptr) {
+            return {};
+        }
+        return detail::check(ice9_disable_streaming(std::exchange(hnd_, nullptr)));
+    }
+
+private:
+    friend class Device;
+    explicit Stream(struct ice9_handle *hnd) : hnd_(hnd) {}
+
+    struct ice9_handle *hnd_;
+};
+
+class Device {
+public:
+    // A new handle, opened.  A NULL config gives the defaults of ice9_new.
+    static result<Device> open(const struct ice9_config *config = nullptr) {
+        // Make the default transport here rather than in ice9_new_with_config,
+        // so a libusb that will not initialise is not reported as out of memory.
+        struct ice9_config resolved = (config != nullptr) ? *config : ice9_config{};
+        bool own_transport = false;
+        if (resolved.transport == nullptr) {
+            resolved.transport = ice9_libusb_transport_new();
+            if (resolved.transport == nullptr) {
+                return failure(LibUSBOtherError);
+            }
+            own_transport = true;
+        }
+        struct ice9_handle *hnd = ice9_new_with_config(&resolved);
+        if (hnd == nullptr) {
+            if (own_transport) {
+                ice9_transport_free(resolved.transport);
+            }
+            return failure(BufferAllocationFailed);
+        }
+        Device device(hnd);
+        enum Ice9Error ret = ice9_open(hnd);
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return device;
+    }
+
+    // Take ownership of a handle from the C API.
+    explicit Device(struct ice9_handle *hnd) : hnd_(hnd) {}
+
+    Device(Device &&other) noexcept : hnd_(std::exchange(other.hnd_, nullptr)) {}
+    Device &operator=(Device &&other) noexcept {
+        if (this != &other) {
+            ice9_free(hnd_);
+            hnd_ = std::exchange(other.hnd_, nullptr);
+        }
+        return *this;
+    }
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+    ~Device() { ice9_free(hnd_); }
+
+    struct ice9_handle *native_handle() const { return hnd_; }
+
+    // Give the handle back to the caller, who must ice9_free it.
+    struct ice9_handle *release() { return std::exchange(hnd_, nullptr); }
+
+    result<void> write(span<const uint8_t> data) {
+        if (!detail::fits_int(data.size())) {
+            return failure(Error);
+        }
+        return detail::check(ice9_write(hnd_, data.data(), static_cast<int>(data.size())));
+    }
+
+    result<void> read(span<uint8_t> data) {
+        if (!detail::fits_int(data.size())) {
+            return failure(Error);
+        }
+        return detail::check(ice9_read(hnd_, data.data(), static_cast<int>(data.size())));
+    }
+
+    // A fixed size read into stack storage.  Data goes straight from the USB
+    // packet into the array; the ring buffer is only touched if it holds
+    // data left over from an earlier read.
+    template <size_t N>
+    result<std::array<uint8_t, N>> read() {
+        static_assert(N <= static_cast<size_t>(std::numeric_limits<int>::max()), "read too large");
+        std::array<uint8_t, N> data;
+        enum Ice9Error ret = ice9_read(hnd_, data.data(), static_cast<int>(N));
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return data;
+    }
+
+    result<void> write_register(uint8_t address, span<const uint16_t> data) {
+        if (!detail::fits_words(data.size())) {
+            return failure(Error);
+        }
+        // The C API does not modify the data, it just predates const.
+        return detail::check(ice9_write_data_to_address(hnd_, address, const_cast<uint16_t *>(data.data()),
+                                                        static_cast<uint16_t>(data.size())));
+    }
+
+    result<void> read_register(uint8_t address, span<uint16_t> data) {
+        if (!detail::fits_words(data.size())) {
+            return failure(Error);
+        }
+        return detail::check(ice9_read_data_from_address(hnd_, address, data.data(),
+                                                         static_cast<uint16_t>(data.size())));
+    }
+
+    template <size_t N>
+    result<std::array<uint16_t, N>> read_register(uint8_t address) {
+        static_assert(N <= std::numeric_limits<uint16_t>::max(), "read too large");
+        std::array<uint16_t, N> data;
+        enum Ice9Error ret = ice9_read_data_from_address(hnd_, address, data.data(), static_cast<uint16_t>(N));
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return data;
+    }
+
+    result<void> write_word(uint8_t address, uint16_t value) {
+        return detail::check(ice9_write_word_to_address(hnd_, address, value));
+    }
+
+    result<void> write_int(uint8_t address, uint32_t value) {
+        return detail::check(ice9_write_int_to_address(hnd_, address, value));
+    }
+
+    result<uint32_t> read_int(uint8_t address) {
+        uint32_t value;
+        enum Ice9Error ret = ice9_read_int_from_address(hnd_, address, &value);
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return value;
+    }
+
+    result<void> ping(uint8_t id) {
+        return detail::check(ice9_ping_bridge(hnd_, id));
+    }
+
+    result<Stream> stream(uint8_t address) {
+        enum Ice9Error ret = ice9_enable_streaming(hnd_, address);
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return Stream(hnd_);
+    }
+
+    result<struct ice9_stats> stats() {
+        struct ice9_stats stats;
+        enum Ice9Error ret = ice9_get_stats(hnd_, &stats);
+        if (ret != OK) {
+            return failure(ret);
+        }
+        return stats;
+    }
+
+    enum Ice9Error last_error() const { return ice9_last_error(hnd_); }
+
+private:
+    struct ice9_handle *hnd_;
+};
+
+}  // namespace ice9
+
+#endif  // _ICE9_HPP_
@@ -0,0 +1,51 @@
+#ifndef _ICE9_INTERNAL_H_
+#define _ICE9_INTERNAL_H_
+
+#include <stdint.h>
+#include <ftdi.h>
+
+#include "ice9.h"
+
+// Bulk IN transfers are made of 512 byte packets, each led by 2 status bytes.
+// The second is the line status, where bit 1 flags a receive overrun.
+#define USB_PACKET_SIZE 512
+#define FTDI_OVERRUN 0x02
+
+// Hot path helpers from ice9.c.  They are not part of the public API; they
+// are declared here so the microbenchmarks can measure them in isolation.
+
+int bytes_in_read_buffer(struct ice9_handle* hnd);
+int free_space_in_read_buffer(struct ice9_handle* hnd);
+int drain_from_read_buffer(struct ice9_handle* hnd, uint8_t* dest, int count);
+int enqueue_to_read_buffer(struct ice9_handle* hnd, const uint8_t*src, int count);
+
+// Compact a bulk IN transfer of 512 byte packets in place, dropping the two
+// status bytes that lead each packet.  Returns the number of payload bytes,
+// and adds the number of packets flagging an overrun to *overruns.
+int strip_status_bytes(uint8_t *buffer, int length, int *overruns);
+
+// The read_callback path: set the destination for the next callback driven
+// read, then feed it packets.  Surplus data is banked for the next read.
+void begin_callback_read(struct ice9_handle *hnd, uint8_t *data, int num_bytes);
+int bank_bytes(struct ice9_handle *hnd, const uint8_t *ptr, int to_bank);
+// An FTDIStreamCallback for ftdi_readstream_ice9.  Progress reports update
+// the handle's stream statistics.
+int read_callback(uint8_t *buffer, int length, FTDIProgressInfo *progress, void *userdata);
+
+// 32-bit registers travel as two 16-bit words, most significant first.
+static inline uint32_t words_to_int(const uint16_t *words) {
+    return ((uint32_t) words[0] << 16) | words[1];
+}
+
+// The array form: swap the 16-bit halves of count values, from src to dst
+// (which may be the same), also reversing the bytes of each value if flags
+// has ICE9_BYTESWAP.  Converts in either direction.
+void swap_int_halves(uint32_t *dst, const uint32_t *src, int count, int flags);
+
+// For the parts of the library built on a handle (pipeline.c): the settings
+// and buffer flags that apply to the threads and buffers it makes.
+struct ice9_thread_settings;
+const struct ice9_thread_settings *ice9_handle_thread_settings(struct ice9_handle *hnd);
+int ice9_handle_buffer_flags(struct ice9_handle *hnd);
+
+#endif  // _ICE9_INTERNAL_H_
@@ -0,0 +1,162 @@
+#ifndef _ICE9_REGMAP_HPP_
+#define _ICE9_REGMAP_HPP_
+
+// Typed register access for headers generated by ice9_regmap.py.  Needs
+// C++17.
+//
+// A generated header describes each register as a struct holding a reg<>
+// type and one field<> type per bit field:
+//
+//   struct control {
+//       using reg = ice9::regmap::reg<0x04, 32, ice9::regmap::read_write, 0x0>;
+//       using enable = ice9::regmap::field<reg, 0, 1>;
+//       using gain = ice9::regmap::field<reg, 1, 4>;
+//   };
+//
+// A field value is made with field{value}, and any number of fields of one
+// register are combined, at compile time where the values are constant,
+// into a single register transfer:
+//
+//   ice9::regmap::write(hnd, control::enable{1}, control::gain{3});
+//   ice9::regmap::modify(hnd, control::gain{5});
+//   ice9::regmap::get<control::gain>(hnd, &gain);
+//
+// write() starts from the register's reset value; modify() reads the
+// register first, which costs nothing for a register the shadow already
+// holds (see ice9_set_register_policy).
+
+#include <stdint.h>
+
+#include <type_traits>
+
+#include "ice9.h"
+
+namespace ice9 {
+namespace regmap {
+
+enum access { read_write, read_only, write_only };
+
+template <uint8_t Address, unsigned Width, access Access, uint32_t Reset>
+struct reg {
+    static_assert(Width == 16 || Width == 32, "registers are 16 or 32 bits wide");
+    using value_type = typename std::conditional<Width == 16, uint16_t, uint32_t>::type;
+    static constexpr uint8_t address = Address;
+    static constexpr unsigned width = Width;
+    static constexpr value_type reset = static_cast<value_type>(Reset);
+    static constexpr bool readable = Access != write_only;
+    static constexpr bool writable = Access != read_only;
+};
+
+template <typename Reg, unsigned Lsb, unsigned Width>
+struct field {
+    static_assert(Width > 0 && Lsb + Width <= Reg::width, "field does not fit its register");
+    using reg = Reg;
+    using value_type = typename Reg::value_type;
+    static constexpr unsigned lsb = Lsb;
+    static constexpr unsigned width = Width;
+    static constexpr value_type mask =
+        static_cast<value_type>(((Width == Reg::width) ? ~0ULL : ((1ULL << Width) - 1)) << Lsb);
+
+    // Bits beyond the field's width are dropped.
+    constexpr explicit field(value_type value) : bits(static_cast<value_type>((value << Lsb) & mask)) {}
+
+    static constexpr value_type decode(value_type raw) {
+        return static_cast<value_type>((raw & mask) >> Lsb);
+    }
+
+    value_type bits;
+};
+
+namespace detail {
+
+template <typename Field, typename... Fields>
+struct same_register {
+    using reg = typename Field::reg;
+    static constexpr bool value = (std::is_same<reg, typename Fields::reg>::value && ...);
+};
+
+template <typename... Fields>
+constexpr auto combined_mask() {
+    using reg = typename same_register<Fields...>::reg;
+    return static_cast<typename reg::value_type>((Fields::mask | ...));
+}
+
+template <typename Reg>
+enum Ice9Error write_raw(struct ice9_handle *hnd, typename Reg::value_type value) {
+    if constexpr (Reg::width == 16) {
+        return ice9_write_word_to_address(hnd, Reg::address, value);
+    } else {
+        return ice9_write_int_to_address(hnd, Reg::address, value);
+    }
+}
+
+template <typename Reg>
+enum Ice9Error read_raw(struct ice9_handle *hnd, typename Reg::value_type *value) {
+    if constexpr (Reg::width == 16) {
+        return ice9_read_data_from_address(hnd, Reg::address, value, 1);
+    } else {
+        return ice9_read_int_from_address(hnd, Reg::address, value);
+    }
+}
+
+}  // namespace detail
+
+// Whole register access.  The register type is the reg<> of a generated
+// register struct, e.g. read<control::reg>(hnd, &raw).
+template <typename Reg>
+enum Ice9Error write(struct ice9_handle *hnd, typename Reg::value_type value) {
+    static_assert(Reg::writable, "register is read-only");
+    return detail::write_raw<Reg>(hnd, value);
+}
+
+template <typename Reg>
+enum Ice9Error read(struct ice9_handle *hnd, typename Reg::value_type *value) {
+    static_assert(Reg::readable, "register is write-only");
+    return detail::read_raw<Reg>(hnd, value);
+}
+
+// Write the given fields, with every other field at its reset value.
+template <typename Field, typename... Fields>
+enum Ice9Error write(struct ice9_handle *hnd, Field first, Fields... rest) {
+    using reg = typename Field::reg;
+    static_assert(detail::same_register<Field, Fields...>::value, "fields belong to different registers");
+    static_assert(reg::writable, "register is read-only");
+    constexpr auto mask = detail::combined_mask<Field, Fields...>();
+    auto value = static_cast<typename reg::value_type>((reg::reset & ~mask) | first.bits | (rest.bits | ... | 0));
+    return detail::write_raw<reg>(hnd, value);
+}
+
+// Read-modify-write of the given fields, leaving the others as they are.  A
+// write-only register must be shadowed (ICE9_REGISTER_WRITE_ONLY) and
+// written once before it can be modified.
+template <typename Field, typename... Fields>
+enum Ice9Error modify(struct ice9_handle *hnd, Field first, Fields... rest) {
+    using reg = typename Field::reg;
+    static_assert(detail::same_register<Field, Fields...>::value, "fields belong to different registers");
+    static_assert(reg::writable, "register is read-only");
+    constexpr auto mask = detail::combined_mask<Field, Fields...>();
+    typename reg::value_type value;
+    enum Ice9Error ret = detail::read_raw<reg>(hnd, &value);
+    if (ret != OK) {
+        return ret;
+    }
+    value = static_cast<typename reg::value_type>((value & ~mask) | first.bits | (rest.bits | ... | 0));
+    return detail::write_raw<reg>(hnd, value);
+}
+
+template <typename Field>
+enum Ice9Error get(struct ice9_handle *hnd, typename Field::value_type *value) {
+    using reg = typename Field::reg;
+    static_assert(reg::readable, "register is write-only");
+    typename reg::value_type raw;
+    enum Ice9Error ret = detail::read_raw<reg>(hnd, &raw);
+    if (ret == OK) {
+        *value = Field::decode(raw);
+    }
+    return ret;
+}
+
+}  // namespace regmap
+}  // namespace ice9
+
+#endif  // _ICE9_REGMAP_HPP_
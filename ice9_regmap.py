@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""Generate a typed C++ register map header from a register description.
+
+The description is JSON, or YAML when PyYAML is installed:
+
+    {
+      "name": "adc",                  # C++ namespace of the generated API
+      "registers": [
+        {
+          "name": "control",
+          "address": 4,               # 0-255
+          "width": 32,                # 16 or 32, default 32
+          "access": "rw",             # rw, ro or wo, default rw
+          "reset": 0,                 # default 0
+          "cacheable": true,          # shadow reads and writes, default false
+          "fields": [
+            {"name": "enable", "bits": "0"},
+            {"name": "gain", "bits": "4:1"},     # msb:lsb
+            {"name": "mode", "lsb": 8, "width": 2}
+          ]
+        }
+      ]
+    }
+
+Each register becomes a struct holding a reg<> type and one field<> type per
+field (see ice9_regmap.hpp).  The header also defines
+<name>::apply_policies(hnd), which sets the register shadow policy of every
+write-only or cacheable register.
+"""
+
+import argparse
+import json
+import keyword
+import os
+import re
+import sys
+
+IDENTIFIER = re.compile(r"^[A-Za-z_][A-Za-z0-9_]*$")
+ACCESS = {"rw": "read_write", "ro": "read_only", "wo": "write_only"}
+CPP_KEYWORDS = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case",
+    "catch", "char", "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const",
+    "consteval", "constexpr", "constinit", "const_cast", "continue", "co_await", "co_return",
+    "co_yield", "decltype", "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int",
+    "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return",
+    "short", "signed", "sizeof", "static", "static_assert", "static_cast", "struct", "switch",
+    "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid", "typename",
+    "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq",
+    "reg",
+}
+# Names the generated apply_policies refers to, which a register of the same
+# name would hide.
+GENERATED_NAMES = {
+    "OK", "hnd", "ret", "Ice9Error", "ice9_handle", "ice9_set_register_policy", "apply_policies",
+    "ICE9_REGISTER_CACHEABLE", "ICE9_REGISTER_WRITE_ONLY",
+}
+
+
+class RegmapError(Exception):
+    pass
+
+
+def load(path):
+    with open(path) as f:
+        text = f.read()
+    if path.endswith((".yaml", ".yml")):
+        try:
+            import yaml
+        except ImportError:
+            raise RegmapError("%s: PyYAML is needed to read YAML descriptions" % path)
+        return yaml.safe_load(text)
+    return json.loads(text)
+
+
+def check_name(name, what):
+    if not isinstance(name, str) or not IDENTIFIER.match(name) or name in CPP_KEYWORDS \
+            or keyword.iskeyword(name):
+        raise RegmapError("%s: %r is not a usable C++ name" % (what, name))
+    return name
+
+
+def parse_field(reg_name, width, field):
+    name = check_name(field.get("name"), "field in %s" % reg_name)
+    where = "%s.%s" % (reg_name, name)
+    if name == reg_name:
+        raise RegmapError("%s: a field cannot have the name of its register" % where)
+    if "bits" in field:
+        bits = str(field["bits"]).split(":")
+        try:
+            msb, lsb = (int(bits[0]), int(bits[-1]))
+        except ValueError:
+            raise RegmapError("%s: bad bit range %r" % (where, field["bits"]))
+        if len(bits) > 2 or msb < lsb:
+            raise RegmapError("%s: bad bit range %r, expected msb:lsb" % (where, field["bits"]))
+        lsb, bit_width = lsb, msb - lsb + 1
+    else:
+        lsb, bit_width = int(field.get("lsb", -1)), int(field.get("width", 1))
+    if lsb < 0 or bit_width < 1 or lsb + bit_width > width:
+        raise RegmapError("%s: does not fit a %d bit register" % (where, width))
+    return {"name": name, "lsb": lsb, "width": bit_width}
+
+
+def parse(description):
+    if not isinstance(description, dict):
+        raise RegmapError("description must be an object")
+    name = check_name(description.get("name"), "register map name")
+    registers = []
+    addresses = {}
+    names = set()
+    for entry in description.get("registers", []):
+        reg_name = check_name(entry.get("name"), "register")
+        if reg_name in GENERATED_NAMES:
+            raise RegmapError("%s: clashes with a name used by the generated code" % reg_name)
+        if reg_name in names:
+            raise RegmapError("%s: defined twice" % reg_name)
+        names.add(reg_name)
+        address = int(entry.get("address", -1))
+        if not 0 <= address <= 255:
+            raise RegmapError("%s: address must be 0-255" % reg_name)
+        if address in addresses:
+            raise RegmapError("%s: address 0x%02x already used by %s" % (reg_name, address, addresses[address]))
+        addresses[address] = reg_name
+        width = int(entry.get("width", 32))
+        if width not in (16, 32):
+            raise RegmapError("%s: width must be 16 or 32" % reg_name)
+        access = entry.get("access", "rw")
+        if access not in ACCESS:
+            raise RegmapError("%s: access must be one of %s" % (reg_name, ", ".join(ACCESS)))
+        reset = int(entry.get("reset", 0))
+        if not 0 <= reset < (1 << width):
+            raise RegmapError("%s: reset value does not fit %d bits" % (reg_name, width))
+        fields = [parse_field(reg_name, width, f) for f in entry.get("fields", [])]
+        used = 0
+        field_names = set()
+        for f in fields:
+            mask = ((1 << f["width"]) - 1) << f["lsb"]
+            if used & mask:
+                raise RegmapError("%s.%s: overlaps another field" % (reg_name, f["name"]))
+            if f["name"] in field_names:
+                raise RegmapError("%s.%s: defined twice" % (reg_name, f["name"]))
+            used |= mask
+            field_names.add(f["name"])
+        registers.append({
+            "name": reg_name, "address": address, "width": width, "access": access,
+            "reset": reset, "cacheable": bool(entry.get("cacheable", False)), "fields": fields,
+            "description": entry.get("description"),
+        })
+    return name, registers
+
+
+def policy(reg):
+    if reg["access"] == "wo":
+        return "ICE9_REGISTER_WRITE_ONLY"
+    if reg["cacheable"] and reg["access"] == "rw":
+        return "ICE9_REGISTER_CACHEABLE"
+    return None
+
+
+def generate(source, name, registers):
+    guard = "_ICE9_REGMAP_%s_HPP_" % name.upper()
+    out = [
+        "// Generated by ice9_regmap.py from %s.  Do not edit." % os.path.basename(source),
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        '#include "ice9_regmap.hpp"',
+        "",
+        "namespace %s {" % name,
+        "",
+    ]
+    for reg in registers:
+        if reg["description"]:
+            out.append("// %s" % " ".join(str(reg["description"]).split()))
+        out.append("struct %s {" % reg["name"])
+        out.append("    using reg = ice9::regmap::reg<0x%02x, %d, ice9::regmap::%s, 0x%x>;" % (
+            reg["address"], reg["width"], ACCESS[reg["access"]], reg["reset"]))
+        for f in reg["fields"]:
+            out.append("    using %s = ice9::regmap::field<reg, %d, %d>;" % (f["name"], f["lsb"], f["width"]))
+        out.append("};")
+        out.append("")
+    out.append("inline enum Ice9Error apply_policies(struct ice9_handle *hnd) {")
+    for reg in registers:
+        if policy(reg):
+            out.append("    {")
+            out.append("        enum Ice9Error ret = ice9_set_register_policy(hnd, %s::reg::address, %s);" % (
+                reg["name"], policy(reg)))
+            out.append("        if (ret != OK) {")
+            out.append("            return ret;")
+            out.append("        }")
+            out.append("    }")
+    out.append("    (void) hnd;")
+    out.append("    return OK;")
+    out.append("}")
+    out.append("")
+    out.append("}  // namespace %s" % name)
+    out.append("")
+    out.append("#endif  // %s" % guard)
+    return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("description", help="register description (.json, .yaml or .yml)")
+    parser.add_argument("-o", "--output", help="header to write (default stdout)")
+    args = parser.parse_args()
+    try:
+        name, registers = parse(load(args.description))
+    except (RegmapError, ValueError, TypeError) as e:
+        sys.stderr.write("ice9_regmap: %s\n" % e)
+        return 1
+    header = generate(args.description, name, registers)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(header)
+    else:
+        sys.stdout.write(header)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,105 @@
+#include <stdint.h>
+
+#include "ice9.h"
+
+#ifndef __ICE9_SIM_H__
+#define __ICE9_SIM_H__
+
+/*
+ * In-process simulation of an ice9 board as seen from the USB side: an FTDI
+ * FT232H style bulk interface in synchronous FIFO mode with the bridge
+ * protocol behind it.
+ *
+ * Host to device words (little endian, as written by ice9_write_words):
+ *   0x01xx              ping, answered with the word 0x01xx
+ *   0x02xx len          read len words from address xx
+ *   0x03xx len data...  write len words to address xx
+ *   0x05xx              start streaming from address xx
+ *   0x0601 / 0x0600     turn event framing on / off
+ *   0x07xx              add address xx to multi-channel streaming
+ *   0xFFFF              stop streaming
+ * Anything else is ignored, which covers the zero padding ice9_fifo_mode sends.
+ *
+ * Device to host data is delivered in 512 byte packets, each led by the two
+ * FTDI modem status bytes.  A transfer ends at the first short packet.  When
+ * the FIFO is empty a status-only packet is returned after the latency timer.
+ *
+ * With event framing on, ice9_sim_raise_event queues the words 0x0Eii
+ * (ii the event) and payload, and any reply or stream word with 0x0E as its
+ * high byte is sent as 0x0EFF followed by the word.  Multi-channel
+ * streaming uses the same escaping, and sends each channel's counter in
+ * turn as frames: 0x0EFE, then the address and word count (up to 255) in
+ * the low and high bytes, then the words.  Stopping sends a frame of zero
+ * words.
+ *
+ * Each address holds ICE9_SIM_REGISTER_WORDS words; a write of len words
+ * stores them from the start of the address and reads wrap around it.  While
+ * streaming, the device produces an incrementing 16-bit counter.
+ */
+
+#define ICE9_SIM_REGISTER_WORDS 1024
+
+/*
+ * Timing model.  Zero for any field gives the default.
+ *
+ *   link_bandwidth   - bytes/s the USB link carries, including the status
+ *                      bytes; IN and OUT transfers take turns on it
+ *                      (default 0 = unlimited)
+ *   stream_rate      - bytes/s the FPGA produces while streaming
+ *                      (default 0 = as fast as the FIFO drains)
+ *   latency_us       - delay between a command arriving and its reply being
+ *                      available to read (default 0)
+ *   fifo_depth       - bytes of stream data the device can buffer before it
+ *                      overruns (default 4096)
+ *   latency_timer_ms - how long an IN request waits on an empty FIFO before a
+ *                      status-only packet is returned (default 1)
+ */
+struct ice9_sim_config {
+    double link_bandwidth;
+    double stream_rate;
+    int latency_us;
+    int fifo_depth;
+    int latency_timer_ms;
+};
+
+struct ice9_sim_stats {
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t commands;
+    uint64_t stream_bytes;
+    uint64_t overrun_bytes;
+    uint64_t events;
+};
+
+EXTERN_C struct ice9_sim * ice9_sim_new(const struct ice9_sim_config *config);
+
+EXTERN_C void ice9_sim_free(struct ice9_sim *sim);
+
+/*
+ * USB level entry points.  These mirror libusb_bulk_transfer and
+ * libusb_control_transfer on the data interface and are safe to call from
+ * one reading and one writing thread at the same time.
+ */
+EXTERN_C enum Ice9Error ice9_sim_bulk_out(struct ice9_sim *sim, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms);
+
+EXTERN_C enum Ice9Error ice9_sim_bulk_in(struct ice9_sim *sim, uint8_t *data, int length, int *transferred, unsigned int timeout_ms);
+
+EXTERN_C enum Ice9Error ice9_sim_control(struct ice9_sim *sim, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index);
+
+/*
+ * Direct access to the simulated register space, bypassing the USB side.
+ */
+EXTERN_C void ice9_sim_set_register(struct ice9_sim *sim, uint8_t address, const uint16_t *data, int len);
+
+EXTERN_C void ice9_sim_get_register(struct ice9_sim *sim, uint8_t address, uint16_t *data, int len);
+
+/*
+ * Raise a device event (0-253), as the FPGA would.  It is queued like a
+ * command reply, so it is never lost to an overrun, and is ignored unless
+ * the host has turned event framing on.
+ */
+EXTERN_C void ice9_sim_raise_event(struct ice9_sim *sim, uint8_t event, uint16_t payload);
+
+EXTERN_C void ice9_sim_get_stats(struct ice9_sim *sim, struct ice9_sim_stats *stats);
+
+#endif
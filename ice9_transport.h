@@ -0,0 +1,84 @@
+#include <stdint.h>
+
+#include "ice9.h"
+
+#ifndef __ICE9_TRANSPORT_H__
+#define __ICE9_TRANSPORT_H__
+
+struct ice9_sim;
+
+/*
+ * The USB level operations an ice9 handle is built on.  Everything above
+ * this (packet framing, status byte stripping, buffering and the bridge
+ * protocol) is shared by all transports.
+ *
+ *   open          - find and open the device
+ *   close         - close the device; the transport may be opened again
+ *   submit_out    - submit a bulk OUT transfer on the data endpoint and wait
+ *                   for it to complete
+ *   submit_in     - submit a bulk IN transfer on the data endpoint and wait
+ *                   for it to complete.  The data is raw FTDI packets, status
+ *                   bytes included
+ *   control       - vendor control request with no data stage
+ *   handle_events - run any asynchronous completion processing for up to
+ *                   timeout_ms; may be NULL if the transport has none
+ *   destroy       - release the transport's context
+ *
+ * Errors are reported with the LibUSB* codes where one applies.
+ */
+struct ice9_transport_ops {
+    enum Ice9Error (*open)(void *context);
+    void (*close)(void *context);
+    enum Ice9Error (*submit_out)(void *context, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms);
+    enum Ice9Error (*submit_in)(void *context, uint8_t *data, int length, int *transferred, unsigned int timeout_ms);
+    enum Ice9Error (*control)(void *context, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned int timeout_ms);
+    enum Ice9Error (*handle_events)(void *context, unsigned int timeout_ms);
+    void (*destroy)(void *context);
+};
+
+struct ice9_transport {
+    const struct ice9_transport_ops *ops;
+    void *context;
+};
+
+/*
+ * The default transport: libusb, talking to the ice9 data interface.
+ * Returns NULL if libusb cannot be initialised.
+ */
+EXTERN_C struct ice9_transport * ice9_libusb_transport_new(void);
+
+/*
+ * A transport backed by a simulated device (see ice9_sim.h).  The transport
+ * does not own the simulator, which must outlive any handle using it.
+ */
+EXTERN_C struct ice9_transport * ice9_sim_transport_new(struct ice9_sim *sim);
+
+/*
+ * Record every call made on inner (timing, packet boundaries and data) to
+ * the file at path, passing the calls through unchanged.  The recording
+ * transport owns inner.  Returns NULL if the file cannot be created.
+ */
+EXTERN_C struct ice9_transport * ice9_recording_transport_new(struct ice9_transport *inner, const char *path);
+
+/*
+ * Play back the IN side of a recording.  Each submit_in returns the next
+ * recorded IN transfer, with its original packet boundaries and status.
+ * Writes and control requests are accepted and ignored.  Once the recording
+ * is exhausted submit_in returns EndOfReplay.
+ *
+ *   ICE9_REPLAY_PACED - complete each transfer at its original time relative
+ *                       to ice9_open, rather than as fast as possible
+ *   ICE9_REPLAY_LOOP  - start again from the first IN transfer at the end
+ */
+#define ICE9_REPLAY_PACED 0x1
+#define ICE9_REPLAY_LOOP  0x2
+
+EXTERN_C struct ice9_transport * ice9_replay_transport_new(const char *path, int flags);
+
+/*
+ * Release a transport that was never handed to a handle.  Handles destroy
+ * their transport in ice9_free.
+ */
+EXTERN_C void ice9_transport_free(struct ice9_transport *transport);
+
+#endif
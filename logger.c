@@ -1,39 +1,638 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "logger.h"
+#include "histogram.h"
+#include "threads.h"
+
+// The default loggers defer formatting.  A call parses the format string
+// just far enough to pull its arguments off the va_list, and copies the
+// format pointer, the raw arguments and a timestamp into a buffer owned by
+// the calling thread.  A background thread formats and writes the records,
+// merging the per-thread buffers in timestamp order.  Logging never takes a
+// lock, so it is cheap enough to leave in the streaming and flash loops.
+// The flusher sleeps until a buffer goes non-empty, then gives the writer
+// FLUSH_INTERVAL_NS to log more so records are written in batches.  In a
+// child of fork() logging is synchronous.
+//
+// Format strings must be literals (or otherwise live forever), as only the
+// pointer is kept; %s arguments are copied.  Loggers installed with
+// ice9_set_info_logger/ice9_set_error_logger are called directly as before.
+
+#define LOG_BUFFER_SIZE (64*1024)
+#define MAX_RECORD_SIZE 1024
+#define MAX_MESSAGE_SIZE 1024
+// Longest %s argument kept; longer strings are truncated.
+#define MAX_STRING_ARG 256
+#define FLUSH_INTERVAL_NS 2000000
+
+enum log_kind {
+    LOG_KIND_INFO,
+    LOG_KIND_ERROR,
+};
+
+struct record_header {
+    uint64_t timestamp_ns;
+    const char *format;
+    const char *file;
+    int line;
+    uint16_t size;      // Whole record, header included
+    uint8_t kind;
+};
+
+// Single producer (the owning thread), single consumer (whoever holds
+// s_flush_lock).  head and tail count bytes and never wrap.
+struct log_buffer {
+    uint8_t data[LOG_BUFFER_SIZE];
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic int owned;
+    struct log_buffer *next;
+};
 
 static pthread_mutex_t s_log_lock = PTHREAD_MUTEX_INITIALIZER;
+// Serialises consumers: the flusher thread and ice9_log_flush.
+static pthread_mutex_t s_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+// Guards starting and stopping the flusher, and the fields below it.
+static pthread_mutex_t s_flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t s_flusher;
+static int s_flusher_running;
+static struct ice9_thread_settings s_flusher_settings;
+static pthread_once_t s_deferred_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_buffer_key;
+static int s_wake_fd = -1;
+// Set by the flusher before it sleeps, and cleared by whichever producer
+// wakes it.
+static _Atomic int s_flusher_idle;
+static _Atomic(struct log_buffer *) s_buffers;
+static _Atomic int s_deferred;
+static _Atomic int s_stopping;
+static _Atomic uint64_t s_dropped;
+static _Thread_local struct log_buffer *t_buffer;
+
+// ---------------------------------------------------------
+// Format string parsing, shared by capture and formatting
+// ---------------------------------------------------------
+
+enum arg_kind {
+    ARG_LITERAL,    // Not a conversion (%% or something we do not understand)
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_COUNT,      // %n - consumes a pointer, prints nothing
+};
+
+struct conversion {
+    int length;         // Characters in the spec, from the '%'
+    int star_width;
+    int star_precision;
+    int precision;      // -1 if absent or given by '*'
+    enum arg_kind kind;
+};
+
+static const char *parse_conversion(const char *p, struct conversion *c) {
+    const char *start = p++;
+    memset(c, 0, sizeof(*c));
+    c->precision = -1;
+    while (strchr("-+ #0'", *p) && *p) {
+        p++;
+    }
+    if (*p == '*') {
+        c->star_width = 1;
+        p++;
+    }
+    while ((*p >= '0') && (*p <= '9')) {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            c->star_precision = 1;
+            p++;
+        } else {
+            c->precision = 0;
+            while ((*p >= '0') && (*p <= '9')) {
+                c->precision = c->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+    enum arg_kind integer = ARG_INT;
+    int long_double = 0;
+    switch (*p) {
+        case 'h': p++; if (*p == 'h') { p++; } break;
+        case 'l': p++; integer = ARG_LONG; if (*p == 'l') { p++; integer = ARG_LLONG; } break;
+        case 'q': p++; integer = ARG_LLONG; break;
+        case 'L': p++; long_double = 1; break;
+        case 'z': p++; integer = ARG_SIZE; break;
+        case 'j': p++; integer = ARG_INTMAX; break;
+        case 't': p++; integer = ARG_PTRDIFF; break;
+    }
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            c->kind = integer;
+            break;
+        case 'c':
+            c->kind = ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            c->kind = long_double ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+        case 's':
+            // Wide strings are not copied, so they cannot be deferred.
+            c->kind = (integer == ARG_LONG) ? ARG_POINTER : ARG_STRING;
+            break;
+        case 'p':
+            c->kind = ARG_POINTER;
+            break;
+        case 'n':
+            c->kind = ARG_COUNT;
+            break;
+        default:
+            c->kind = ARG_LITERAL;
+            c->star_width = c->star_precision = 0;
+            break;
+    }
+    if (*p != '\0') {
+        p++;
+    }
+    c->length = p - start;
+    return p;
+}
+
+// ---------------------------------------------------------
+// Capture
+// ---------------------------------------------------------
+
+#define PUT(type, value)                                          \
+    do {                                                          \
+        type v_ = (value);                                        \
+        if (out + sizeof(type) > end) { return -1; }              \
+        memcpy(out, &v_, sizeof(type));                           \
+        out += sizeof(type);                                      \
+    } while (0)
+
+// Copy the arguments for format out of args into record.  Returns the
+// record size, or -1 if it does not fit.
+static int capture(uint8_t *record, enum log_kind kind, const char *file, int line,
+                   const char *format, va_list args) {
+    uint8_t *out = record + sizeof(struct record_header);
+    uint8_t *end = record + MAX_RECORD_SIZE;
+    for (const char *p = format; *p != '\0';) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        struct conversion c;
+        p = parse_conversion(p, &c);
+        int precision = c.precision;
+        if (c.star_width) {
+            PUT(int, va_arg(args, int));
+        }
+        if (c.star_precision) {
+            precision = va_arg(args, int);
+            PUT(int, precision);
+        }
+        switch (c.kind) {
+            case ARG_LITERAL: break;
+            case ARG_INT: PUT(int, va_arg(args, int)); break;
+            case ARG_LONG: PUT(long, va_arg(args, long)); break;
+            case ARG_LLONG: PUT(long long, va_arg(args, long long)); break;
+            case ARG_SIZE: PUT(size_t, va_arg(args, size_t)); break;
+            case ARG_INTMAX: PUT(intmax_t, va_arg(args, intmax_t)); break;
+            case ARG_PTRDIFF: PUT(ptrdiff_t, va_arg(args, ptrdiff_t)); break;
+            case ARG_DOUBLE: PUT(double, va_arg(args, double)); break;
+            case ARG_LDOUBLE: PUT(long double, va_arg(args, long double)); break;
+            case ARG_POINTER: PUT(void *, va_arg(args, void *)); break;
+            case ARG_COUNT: (void) va_arg(args, void *); break;
+            case ARG_STRING: {
+                const char *s = va_arg(args, const char *);
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                // A precision bounds the read, so the string need not be terminated.
+                size_t limit = MAX_STRING_ARG;
+                if ((precision >= 0) && (precision < limit)) {
+                    limit = precision;
+                }
+                uint16_t n = strnlen(s, limit);
+                PUT(uint16_t, n);
+                if (out + n + 1 > end) {
+                    return -1;
+                }
+                memcpy(out, s, n);
+                out[n] = '\0';
+                out += n + 1;
+                break;
+            }
+        }
+    }
+    struct record_header header = {
+        .timestamp_ns = ice9_now_ns(),
+        .format = format,
+        .file = file,
+        .line = line,
+        .size = out - record,
+        .kind = kind,
+    };
+    memcpy(record, &header, sizeof(header));
+    return header.size;
+}
+
+// ---------------------------------------------------------
+// Formatting
+// ---------------------------------------------------------
+
+#define GET(type) ({ type v_; memcpy(&v_, in, sizeof(type)); in += sizeof(type); v_; })
+
+#define EMIT(value)                                                                 \
+    (nstars == 0 ? snprintf(out, room, spec, value) :                               \
+     nstars == 1 ? snprintf(out, room, spec, stars[0], value) :                     \
+                   snprintf(out, room, spec, stars[0], stars[1], value))
+
+// Format a captured record into message.  Returns the message length.
+static int format_record(const uint8_t *record, char *message, size_t size) {
+    struct record_header header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *in = record + sizeof(header);
+    char *out = message;
+    size_t room = size;
+    if (header.kind == LOG_KIND_ERROR) {
+        int n = snprintf(out, room, "%s:%d ", header.file, header.line);
+        n = (n < room) ? n : room - 1;
+        out += n;
+        room -= n;
+    }
+    for (const char *p = header.format; (*p != '\0') && (room > 1);) {
+        if (*p != '%') {
+            *out++ = *p++;
+            room--;
+            continue;
+        }
+        struct conversion c;
+        const char *spec_start = p;
+        p = parse_conversion(p, &c);
+        char spec[32];
+        if (c.length >= sizeof(spec)) {
+            continue;
+        }
+        memcpy(spec, spec_start, c.length);
+        spec[c.length] = '\0';
+        int stars[2];
+        int nstars = 0;
+        if (c.star_width) {
+            stars[nstars++] = GET(int);
+        }
+        if (c.star_precision) {
+            stars[nstars++] = GET(int);
+        }
+        int n = 0;
+        switch (c.kind) {
+            case ARG_LITERAL: n = snprintf(out, room, "%s", (strcmp(spec, "%%") == 0) ? "%" : spec); break;
+            case ARG_INT: n = EMIT(GET(int)); break;
+            case ARG_LONG: n = EMIT(GET(long)); break;
+            case ARG_LLONG: n = EMIT(GET(long long)); break;
+            case ARG_SIZE: n = EMIT(GET(size_t)); break;
+            case ARG_INTMAX: n = EMIT(GET(intmax_t)); break;
+            case ARG_PTRDIFF: n = EMIT(GET(ptrdiff_t)); break;
+            case ARG_DOUBLE: n = EMIT(GET(double)); break;
+            case ARG_LDOUBLE: n = EMIT(GET(long double)); break;
+            case ARG_POINTER:
+                // Also covers %ls, whose string may be gone by now.
+                spec[c.length - 1] = 'p';
+                n = EMIT(GET(void *));
+                break;
+            case ARG_COUNT: break;
+            case ARG_STRING: {
+                uint16_t len = GET(uint16_t);
+                n = EMIT((const char *) in);
+                in += len + 1;
+                break;
+            }
+        }
+        n = (n < 0) ? 0 : n;
+        n = (n < room) ? n : room - 1;
+        out += n;
+        room -= n;
+    }
+    *out = '\0';
+    return out - message;
+}
+
+static void write_record(const uint8_t *record) {
+    char message[MAX_MESSAGE_SIZE];
+    format_record(record, message, sizeof(message));
+    struct record_header header;
+    memcpy(&header, record, sizeof(header));
+    fputs(message, (header.kind == LOG_KIND_ERROR) ? stderr : stdout);
+}
+
+// ---------------------------------------------------------
+// Per-thread buffers and the flusher
+// ---------------------------------------------------------
+
+static void ring_copy_out(const struct log_buffer *buffer, uint64_t position, void *dest, size_t count) {
+    size_t offset = position % LOG_BUFFER_SIZE;
+    size_t first = (count < LOG_BUFFER_SIZE - offset) ? count : LOG_BUFFER_SIZE - offset;
+    memcpy(dest, buffer->data + offset, first);
+    memcpy((uint8_t *) dest + first, buffer->data, count - first);
+}
+
+static void ring_copy_in(struct log_buffer *buffer, uint64_t position, const void *src, size_t count) {
+    size_t offset = position % LOG_BUFFER_SIZE;
+    size_t first = (count < LOG_BUFFER_SIZE - offset) ? count : LOG_BUFFER_SIZE - offset;
+    memcpy(buffer->data + offset, src, first);
+    memcpy(buffer->data, (const uint8_t *) src + first, count - first);
+}
+
+static void release_buffer(void *buffer) {
+    // The buffer stays on the list (the flusher still drains it) and is
+    // handed to the next thread that needs one.
+    atomic_store(&((struct log_buffer *) buffer)->owned, 0);
+}
+
+static struct log_buffer *thread_buffer(void) {
+    if (t_buffer != NULL) {
+        return t_buffer;
+    }
+    struct log_buffer *buffer;
+    for (buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&buffer->owned, &expected, 1)) {
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        buffer = calloc(1, sizeof(struct log_buffer));
+        if (buffer == NULL) {
+            return NULL;
+        }
+        buffer->owned = 1;
+        buffer->next = atomic_load(&s_buffers);
+        while (!atomic_compare_exchange_weak(&s_buffers, &buffer->next, buffer)) {
+        }
+    }
+    pthread_setspecific(s_buffer_key, buffer);
+    t_buffer = buffer;
+    return buffer;
+}
+
+// Write out everything buffered so far, oldest first across all threads.
+static void drain(void) {
+    pthread_mutex_lock(&s_flush_lock);
+    uint8_t record[MAX_RECORD_SIZE];
+    int wrote_info = 0;
+    int wrote_error = 0;
+    while (1) {
+        struct log_buffer *oldest = NULL;
+        struct record_header oldest_header;
+        for (struct log_buffer *buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+            uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+            if (atomic_load_explicit(&buffer->head, memory_order_acquire) == tail) {
+                continue;
+            }
+            struct record_header header;
+            ring_copy_out(buffer, tail, &header, sizeof(header));
+            if ((oldest == NULL) || (header.timestamp_ns < oldest_header.timestamp_ns)) {
+                oldest = buffer;
+                oldest_header = header;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        uint64_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        ring_copy_out(oldest, tail, record, oldest_header.size);
+        atomic_store_explicit(&oldest->tail, tail + oldest_header.size, memory_order_release);
+        write_record(record);
+        wrote_info |= oldest_header.kind == LOG_KIND_INFO;
+        wrote_error |= oldest_header.kind == LOG_KIND_ERROR;
+    }
+    uint64_t dropped = atomic_exchange(&s_dropped, 0);
+    if (dropped != 0) {
+        fprintf(stderr, "ice9: %llu log messages dropped (log buffer full)\n", (unsigned long long) dropped);
+    }
+    if (wrote_info) {
+        fflush(stdout);
+    }
+    if (wrote_error) {
+        fflush(stderr);
+    }
+    pthread_mutex_unlock(&s_flush_lock);
+}
+
+static int pending(void) {
+    for (struct log_buffer *buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+        if (atomic_load_explicit(&buffer->head, memory_order_acquire) !=
+            atomic_load_explicit(&buffer->tail, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The flusher marks itself idle before its last look at the buffers, and a
+// producer checks the mark after publishing a record, so between them one
+// always sees the other and no record is left waiting for a wakeup.
+static void *flusher(void *arg) {
+    const struct timespec batch = { 0, FLUSH_INTERVAL_NS };
+    while (!atomic_load(&s_stopping)) {
+        drain();
+        atomic_store(&s_flusher_idle, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (pending() || atomic_load(&s_stopping)) {
+            atomic_store(&s_flusher_idle, 0);
+            continue;
+        }
+        eventfd_t count;
+        eventfd_read(s_wake_fd, &count);
+        nanosleep(&batch, NULL);
+    }
+    return NULL;
+}
+
+static void wake_flusher(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s_flusher_idle, memory_order_relaxed) && atomic_exchange(&s_flusher_idle, 0)) {
+        eventfd_write(s_wake_fd, 1);
+    }
+}
+
+// Called with s_flusher_lock held.
+static enum Ice9Error start_flusher(const struct ice9_thread_settings *settings) {
+    atomic_store(&s_stopping, 0);
+    enum Ice9Error ret = ice9_thread_start(settings, "log", flusher, NULL, &s_flusher);
+    s_flusher_running = (ret == OK);
+    return ret;
+}
+
+// Called with s_flusher_lock held.
+static void stop_flusher(void) {
+    if (!s_flusher_running) {
+        return;
+    }
+    atomic_store(&s_stopping, 1);
+    eventfd_write(s_wake_fd, 1);
+    pthread_join(s_flusher, NULL);
+    s_flusher_running = 0;
+}
+
+// At exit the flusher is stopped and the buffers drained; anything logged
+// after that is written synchronously.
+static void stop_deferred(void) {
+    pthread_mutex_lock(&s_flusher_lock);
+    atomic_store(&s_deferred, 0);
+    stop_flusher();
+    pthread_mutex_unlock(&s_flusher_lock);
+    drain();
+}
+
+// Hold every logger lock across fork() so the child does not inherit one
+// taken by a thread it does not have.
+static void before_fork(void) {
+    pthread_mutex_lock(&s_flusher_lock);
+    pthread_mutex_lock(&s_log_lock);
+    pthread_mutex_lock(&s_flush_lock);
+}
+
+static void after_fork_parent(void) {
+    pthread_mutex_unlock(&s_flush_lock);
+    pthread_mutex_unlock(&s_log_lock);
+    pthread_mutex_unlock(&s_flusher_lock);
+}
+
+// The child has no flusher, so it logs synchronously.  Records still in the
+// buffers are the parent's to write.
+static void after_fork_child(void) {
+    atomic_store(&s_deferred, 0);
+    s_flusher_running = 0;
+    for (struct log_buffer *buffer = atomic_load(&s_buffers); buffer != NULL; buffer = buffer->next) {
+        atomic_store(&buffer->tail, atomic_load(&buffer->head));
+    }
+    pthread_mutex_unlock(&s_flush_lock);
+    pthread_mutex_unlock(&s_log_lock);
+    pthread_mutex_unlock(&s_flusher_lock);
+}
+
+static void start_deferred(void) {
+    if (pthread_key_create(&s_buffer_key, release_buffer) != 0) {
+        return;
+    }
+    s_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (s_wake_fd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&s_flusher_lock);
+    ice9_thread_settings_init(&s_flusher_settings, NULL);
+    enum Ice9Error ret = start_flusher(&s_flusher_settings);
+    pthread_mutex_unlock(&s_flusher_lock);
+    if (ret != OK) {
+        return;
+    }
+    atexit(stop_deferred);
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+    atomic_store(&s_deferred, 1);
+}
+
+enum Ice9Error ice9_set_log_thread_config(const struct ice9_thread_config *config) {
+    struct ice9_thread_settings settings;
+    enum Ice9Error ret = ice9_thread_settings_init(&settings, config);
+    if (ret != OK) {
+        return ret;
+    }
+    pthread_once(&s_deferred_once, start_deferred);
+    pthread_mutex_lock(&s_flusher_lock);
+    if (s_flusher_running) {
+        stop_flusher();
+        ret = start_flusher(&settings);
+        if (ret == OK) {
+            s_flusher_settings = settings;
+        } else if (start_flusher(&s_flusher_settings) != OK) {
+            atomic_store(&s_deferred, 0);
+        }
+    }
+    pthread_mutex_unlock(&s_flusher_lock);
+    drain();
+    return ret;
+}
+
+static void log_record(enum log_kind kind, const char *file, int line, const char *format, va_list args) {
+    uint8_t record[MAX_RECORD_SIZE];
+    int size = capture(record, kind, file, line, format, args);
+    if (size < 0) {
+        atomic_fetch_add(&s_dropped, 1);
+        return;
+    }
+    pthread_once(&s_deferred_once, start_deferred);
+    struct log_buffer *buffer = atomic_load(&s_deferred) ? thread_buffer() : NULL;
+    if (buffer == NULL) {
+        pthread_mutex_lock(&s_log_lock);
+        write_record(record);
+        fflush((kind == LOG_KIND_ERROR) ? stderr : stdout);
+        pthread_mutex_unlock(&s_log_lock);
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    if (head - tail + size > LOG_BUFFER_SIZE) {
+        atomic_fetch_add(&s_dropped, 1);
+        return;
+    }
+    ring_copy_in(buffer, head, record, size);
+    atomic_store_explicit(&buffer->head, head + size, memory_order_release);
+    wake_flusher();
+}
 
 static void ice9_log_info(const char *format, ...) {
-    char buf[256];
     va_list args;
     va_start(args, format);
-    vsnprintf(buf, sizeof(buf), format, args);
+    log_record(LOG_KIND_INFO, NULL, 0, format, args);
     va_end(args);
-    buf[sizeof(buf)-1] = '\0';
-
-    pthread_mutex_lock(&s_log_lock);
-    printf("%s", buf);
-    pthread_mutex_unlock(&s_log_lock);
 }
 
 static void ice9_log_error(const char *file, int line, const char *format, ...) {
-    char buf[256];
-    const int nwritten = snprintf(buf, sizeof(buf), "%s:%d ", file, line);
-    if (nwritten < sizeof(buf)-1) {
-        va_list args;
-        va_start(args, format);
-        vfprintf(stderr, format, args);
-        vsnprintf(buf, sizeof(buf)-nwritten, format, args);
-        va_end(args);
-    }
-    buf[sizeof(buf)-1] = '\0';
+    va_list args;
+    va_start(args, format);
+    log_record(LOG_KIND_ERROR, file, line, format, args);
+    va_end(args);
+}
 
-    pthread_mutex_lock(&s_log_lock);
-    fprintf(stderr, "%s", buf);
-    pthread_mutex_unlock(&s_log_lock);
+_Atomic int ice9_log_level = ICE9_LOG_INFO;
+
+void ice9_set_log_level(int level) {
+    atomic_store_explicit(&ice9_log_level, level, memory_order_relaxed);
+}
+
+int ice9_ratelimit_allow(struct ice9_ratelimit *limit, uint64_t *suppressed) {
+    uint64_t now = ice9_now_ns();
+    uint64_t start = atomic_load_explicit(&limit->window_start_ns, memory_order_relaxed);
+    // Whoever wins the exchange opens the new window; losers count against it.
+    if ((now - start >= ICE9_LOG_INTERVAL_NS) &&
+        atomic_compare_exchange_strong_explicit(&limit->window_start_ns, &start, now,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&limit->count, 0, memory_order_relaxed);
+    }
+    if (atomic_fetch_add_explicit(&limit->count, 1, memory_order_relaxed) >= ICE9_LOG_BURST) {
+        atomic_fetch_add_explicit(&limit->suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+    *suppressed = atomic_exchange_explicit(&limit->suppressed, 0, memory_order_relaxed);
+    return 1;
 }
 
 void (*ice9_info_logger)(const char *format, ...) = ice9_log_info;
@@ -50,3 +649,7 @@ void ice9_set_error_logger(void (*log_error)(const char *file, int line, const c
     ice9_error_logger = log_error;
     pthread_mutex_unlock(&s_log_lock);
 }
+
+void ice9_log_flush(void) {
+    drain();
+}
@@ -7,19 +7,74 @@
 #define EXTERN_C
 #endif  // __cplusplus
 
+#include <stdatomic.h>
+#include <stdint.h>
 #include <unistd.h>
 
+#include "ice9.h"
+
 extern void (*ice9_info_logger)(const char *format, ...);
 extern void (*ice9_error_logger)(const char *file, int line, const char *format, ...);
 
-#define LOG_INFO(fmt, ...)                                        \
-    do {                                                          \
-        ice9_info_logger(fmt, ##__VA_ARGS__); \
-    } while (0);
+// Messages above ICE9_LOG_LEVEL are compiled out (set with the ICE9_LOG_LEVEL
+// CMake option); the rest are filtered at runtime by ice9_set_log_level,
+// which costs a relaxed load and a branch.  ERROR and WARN go to the error
+// logger, INFO and DEBUG to the info logger.
+#ifndef ICE9_LOG_LEVEL
+#define ICE9_LOG_LEVEL ICE9_LOG_DEBUG
+#endif
+
+extern _Atomic int ice9_log_level;
+
+#define LOG_ENABLED(level) \
+    ((level) <= ICE9_LOG_LEVEL && (level) <= atomic_load_explicit(&ice9_log_level, memory_order_relaxed))
+
+#define LOG_TO_INFO(level, fmt, ...)                   \
+    do {                                               \
+        if (LOG_ENABLED(level)) {                      \
+            ice9_info_logger(fmt, ##__VA_ARGS__);      \
+        }                                              \
+    } while (0)
+
+#define LOG_TO_ERROR(level, fmt, ...)                                  \
+    do {                                                               \
+        if (LOG_ENABLED(level)) {                                      \
+            ice9_error_logger(__FILE__, __LINE__, fmt, ##__VA_ARGS__); \
+        }                                                              \
+    } while (0)
+
+#define LOG_ERROR(fmt, ...) LOG_TO_ERROR(ICE9_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_TO_ERROR(ICE9_LOG_WARN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_TO_INFO(ICE9_LOG_INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_TO_INFO(ICE9_LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+// Per call site rate limiting: at most ICE9_LOG_BURST messages from one call
+// site per ICE9_LOG_INTERVAL_NS.  The number suppressed is reported ahead of
+// the next message the site is allowed to log.
+#define ICE9_LOG_BURST 10
+#define ICE9_LOG_INTERVAL_NS 1000000000ULL
+
+struct ice9_ratelimit {
+    _Atomic uint64_t window_start_ns;
+    _Atomic uint32_t count;
+    _Atomic uint64_t suppressed;
+};
+
+// Returns nonzero if the message may be logged, setting *suppressed to the
+// number dropped since the last one that was.
+int ice9_ratelimit_allow(struct ice9_ratelimit *limit, uint64_t *suppressed);
 
-#define LOG_ERROR(fmt, ...)                                        \
-    do {                                                           \
-        ice9_error_logger(__FILE__, __LINE__, fmt, ##__VA_ARGS__); \
-    } while (0);
+#define LOG_ERROR_RATELIMITED(fmt, ...)                                                   \
+    do {                                                                                  \
+        static struct ice9_ratelimit limit_;                                              \
+        uint64_t suppressed_;                                                             \
+        if (LOG_ENABLED(ICE9_LOG_ERROR) && ice9_ratelimit_allow(&limit_, &suppressed_)) { \
+            if (suppressed_ != 0) {                                                       \
+                ice9_error_logger(__FILE__, __LINE__, "%llu similar messages suppressed\n", \
+                                  (unsigned long long) suppressed_);                      \
+            }                                                                             \
+            ice9_error_logger(__FILE__, __LINE__, fmt, ##__VA_ARGS__);                    \
+        }                                                                                 \
+    } while (0)
 
 #endif  // _ICE9_LOGGER_H_
@@ -32,6 +32,8 @@
 
 #include "logger.h"
 #include "mpsse.h"
+#include "probes.h"
+#include "trace.h"
 
 // ---------------------------------------------------------
 // MPSSE / FTDI definitions
@@ -140,7 +142,7 @@ void mpsse_check_rx()
 		int rc = ftdi_read_data(&mpsse_ftdic, &data, 1);
 		if (rc <= 0)
 			break;
-		LOG_ERROR("mpsse unexpected rx byte: %02X\n", data);
+		LOG_ERROR_RATELIMITED("mpsse unexpected rx byte: %02X\n", data);
 	}
 }
 
@@ -162,6 +164,7 @@ uint8_t mpsse_recv_byte()
 	uint8_t data;
 	while (1) {
 		int rc = ftdi_read_data(&mpsse_ftdic, &data, 1);
+		ICE9_PROBE1(mpsse_read, rc);
 		if (rc < 0) {
 			LOG_ERROR("mpsse read error.\n");
 			mpsse_error(2);
@@ -176,6 +179,7 @@ uint8_t mpsse_recv_byte()
 void mpsse_send_byte(uint8_t data)
 {
 	int rc = ftdi_write_data(&mpsse_ftdic, &data, 1);
+	ICE9_PROBE2(mpsse_write, 1, rc);
 	if (rc != 1) {
 		LOG_ERROR("mpsse write error (single byte, rc=%d, expected %d).\n", rc, 1);
 		mpsse_error(2);
@@ -192,7 +196,10 @@ void mpsse_send_spi(uint8_t *data, int n)
 	mpsse_send_byte(n - 1);
 	mpsse_send_byte((n - 1) >> 8);
 
+	uint64_t span = ice9_trace_begin();
 	int rc = ftdi_write_data(&mpsse_ftdic, data, n);
+	ice9_trace_end(span, "usb", "mpsse_write", "bytes", rc);
+	ICE9_PROBE2(mpsse_write, n, rc);
 	if (rc != n) {
 		LOG_ERROR("mpsse write error (chunk, rc=%d, expected %d).\n", rc, n);
 		mpsse_error(2);
@@ -210,6 +217,7 @@ void mpsse_xfer_spi(uint8_t *data, int n)
 	mpsse_send_byte((n - 1) >> 8);
 
 	int rc = ftdi_write_data(&mpsse_ftdic, data, n);
+	ICE9_PROBE2(mpsse_write, n, rc);
 	if (rc != n) {
 		LOG_ERROR("mpsse write error (chunk, rc=%d, expected %d).\n", rc, n);
 		mpsse_error(2);
@@ -0,0 +1,552 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffers.h"
+#include "convert.h"
+#include "ice9.h"
+#include "ice9_internal.h"
+#include "logger.h"
+#include "threads.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define MAX_STAGES 16
+#define DEFAULT_CHUNK_SIZE (64*1024)
+#define DEFAULT_CHUNKS_PER_WORKER 4
+
+#define COUNT(pipeline, counter, n) atomic_fetch_add_explicit(&(pipeline)->counters.counter, (n), memory_order_relaxed)
+#define LOAD(pipeline, counter) atomic_load_explicit(&(pipeline)->counters.counter, memory_order_relaxed)
+
+// One chunk of the stream on its way from the reader to the sink.  Each
+// stage reads one buffer and writes the other.
+struct chunk {
+    struct ice9_buffer buffers[2];
+    int current;
+    int bytes;
+    // The next stage to run; num_stages is the sink.
+    int stage;
+    uint64_t sequence;
+};
+
+struct stage {
+    ice9_stage_fn fn;
+    ice9_sink_fn sink;
+    void *context;
+    int capacity;
+    int flags;
+    // For ordered stages, the sequence number of the chunk whose turn it is,
+    // and chunks that arrived early, by sequence modulo the number of chunks.
+    // As no more than that many chunks are in flight, slots never clash.
+    pthread_mutex_t lock;
+    uint64_t next;
+    struct chunk **parked;
+};
+
+// A worker's queue of chunks.  The owner takes the oldest, which keeps
+// ordered stages from parking much; thieves take the newest.
+struct worker {
+    struct ice9_pipeline *pipeline;
+    int index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct chunk **queue;
+    int head;
+    int count;
+};
+
+struct pipeline_counters {
+    _Atomic uint64_t chunks;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t steals;
+    _Atomic uint64_t reader_stalls;
+};
+
+struct ice9_pipeline {
+    struct ice9_handle *hnd;
+    int chunk_size;
+    int num_workers;
+    int num_chunks;
+    // The sink is stages[num_stages].
+    struct stage stages[MAX_STAGES + 1];
+    int num_stages;
+    struct ice9_conversion conversions[MAX_STAGES];
+    struct chunk *chunks;
+    struct worker *workers;
+    pthread_t reader;
+    int running;
+    uint64_t next_sequence;
+    // The free chunks and the bookkeeping the threads sleep on.  pending
+    // counts chunks sitting in worker queues that no worker has claimed;
+    // in_flight, chunks between the reader and the sink.
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t chunk_free;
+    struct chunk **free_chunks;
+    int num_free;
+    int pending;
+    int in_flight;
+    int stopping;
+    int reader_done;
+    _Atomic int error;
+    struct pipeline_counters counters;
+};
+
+struct ice9_pipeline *ice9_pipeline_new(struct ice9_handle *hnd, const struct ice9_pipeline_config *config) {
+    int chunk_size = ((config != NULL) && (config->chunk_size > 0)) ? config->chunk_size : DEFAULT_CHUNK_SIZE;
+    int workers = ((config != NULL) && (config->workers > 0)) ? config->workers : (int) sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (workers < 1) {
+        workers = 1;
+    }
+    int chunks = ((config != NULL) && (config->chunks > 0)) ? config->chunks : DEFAULT_CHUNKS_PER_WORKER * workers;
+    // Samples never straddle chunks read from the stream.
+    if ((hnd == NULL) || (chunk_size % 4 != 0)) {
+        return NULL;
+    }
+    struct ice9_pipeline *pipeline = calloc(1, sizeof(struct ice9_pipeline));
+    if (pipeline == NULL) {
+        return NULL;
+    }
+    pipeline->hnd = hnd;
+    pipeline->chunk_size = chunk_size;
+    pipeline->num_workers = workers;
+    pipeline->num_chunks = chunks;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->work_ready, NULL);
+    pthread_cond_init(&pipeline->chunk_free, NULL);
+    for (int i = 0; i <= MAX_STAGES; i++) {
+        pthread_mutex_init(&pipeline->stages[i].lock, NULL);
+    }
+    pipeline->stages[0].flags = ICE9_STAGE_ORDERED;
+    pipeline->stages[0].capacity = chunk_size;
+    return pipeline;
+}
+
+// The sink always sits after the last stage, and takes its capacity.
+static enum Ice9Error add_stage(struct ice9_pipeline *pipeline, ice9_stage_fn fn, void *context,
+                                int max_out_bytes, int flags) {
+    if (pipeline->running || (pipeline->num_stages == MAX_STAGES) || (max_out_bytes < 0) ||
+        (flags & ~ICE9_STAGE_ORDERED)) {
+        return Error;
+    }
+    struct stage *sink = &pipeline->stages[pipeline->num_stages];
+    struct stage *next = &pipeline->stages[pipeline->num_stages + 1];
+    int capacity = max_out_bytes ? max_out_bytes : sink->capacity;
+    next->sink = sink->sink;
+    next->context = sink->context;
+    next->flags = ICE9_STAGE_ORDERED;
+    next->capacity = capacity;
+    sink->fn = fn;
+    sink->sink = NULL;
+    sink->context = context;
+    sink->flags = flags;
+    sink->capacity = capacity;
+    pipeline->num_stages++;
+    return OK;
+}
+
+enum Ice9Error ice9_pipeline_add_stage(struct ice9_pipeline *pipeline, ice9_stage_fn fn, void *context,
+                                       int max_out_bytes, int flags) {
+    if (fn == NULL) {
+        return Error;
+    }
+    return add_stage(pipeline, fn, context, max_out_bytes, flags);
+}
+
+static int convert_stage(void *context, const void *in, int in_bytes, void *out, int out_capacity) {
+    const struct ice9_conversion *conversion = context;
+    int count = MIN(in_bytes / conversion->sample_bytes, out_capacity / (int) sizeof(float));
+    ice9_convert_samples(conversion, in, out, count);
+    return count * sizeof(float);
+}
+
+enum Ice9Error ice9_pipeline_add_convert(struct ice9_pipeline *pipeline, const struct ice9_sample_format *format) {
+    if (pipeline->num_stages == MAX_STAGES) {
+        return Error;
+    }
+    struct ice9_conversion *conversion = &pipeline->conversions[pipeline->num_stages];
+    enum Ice9Error ret = ice9_conversion_init(conversion, format);
+    if (ret != OK) {
+        return ret;
+    }
+    int in_capacity = pipeline->stages[pipeline->num_stages].capacity;
+    int out_capacity = in_capacity / conversion->sample_bytes * sizeof(float);
+    return add_stage(pipeline, convert_stage, conversion, out_capacity, 0);
+}
+
+enum Ice9Error ice9_pipeline_set_sink(struct ice9_pipeline *pipeline, ice9_sink_fn fn, void *context) {
+    if (pipeline->running) {
+        return Error;
+    }
+    pipeline->stages[pipeline->num_stages].sink = fn;
+    pipeline->stages[pipeline->num_stages].context = context;
+    return OK;
+}
+
+// Keep the first error only.
+static void fail(struct ice9_pipeline *pipeline, enum Ice9Error error) {
+    int expected = OK;
+    atomic_compare_exchange_strong(&pipeline->error, &expected, error);
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = 1;
+    pthread_cond_broadcast(&pipeline->chunk_free);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void push_chunk(struct worker *worker, struct chunk *chunk) {
+    struct ice9_pipeline *pipeline = worker->pipeline;
+    pthread_mutex_lock(&worker->lock);
+    worker->queue[(worker->head + worker->count) % pipeline->num_chunks] = chunk;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->pending++;
+    pthread_cond_signal(&pipeline->work_ready);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static struct chunk *take_oldest(struct worker *worker) {
+    struct chunk *chunk = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        chunk = worker->queue[worker->head];
+        worker->head = (worker->head + 1) % worker->pipeline->num_chunks;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return chunk;
+}
+
+static struct chunk *take_newest(struct worker *worker) {
+    struct chunk *chunk = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        worker->count--;
+        chunk = worker->queue[(worker->head + worker->count) % worker->pipeline->num_chunks];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return chunk;
+}
+
+// Wait for work and claim a chunk, from the worker's own queue if it has
+// one and otherwise from another's.  A claim is made on pending first, and
+// every pending chunk is already in a queue, so the search always ends.
+// NULL once the reader has finished and every chunk has reached the sink.
+static struct chunk *next_chunk(struct worker *worker) {
+    struct ice9_pipeline *pipeline = worker->pipeline;
+    pthread_mutex_lock(&pipeline->lock);
+    while ((pipeline->pending == 0) && !(pipeline->reader_done && (pipeline->in_flight == 0))) {
+        pthread_cond_wait(&pipeline->work_ready, &pipeline->lock);
+    }
+    if (pipeline->pending == 0) {
+        pthread_mutex_unlock(&pipeline->lock);
+        return NULL;
+    }
+    pipeline->pending--;
+    pthread_mutex_unlock(&pipeline->lock);
+    for (;;) {
+        struct chunk *chunk = take_oldest(worker);
+        if (chunk != NULL) {
+            return chunk;
+        }
+        for (int i = 1; i < pipeline->num_workers; i++) {
+            chunk = take_newest(&pipeline->workers[(worker->index + i) % pipeline->num_workers]);
+            if (chunk != NULL) {
+                COUNT(pipeline, steals, 1);
+                return chunk;
+            }
+        }
+    }
+}
+
+// Returns 0 if the chunk is early and has been parked.
+static int ordered_enter(struct ice9_pipeline *pipeline, struct stage *stage, struct chunk *chunk) {
+    pthread_mutex_lock(&stage->lock);
+    int ready = (stage->next == chunk->sequence);
+    if (!ready) {
+        stage->parked[chunk->sequence % pipeline->num_chunks] = chunk;
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return ready;
+}
+
+// Pass the turn on, returning the next chunk if it is already waiting.
+static struct chunk *ordered_leave(struct ice9_pipeline *pipeline, struct stage *stage) {
+    pthread_mutex_lock(&stage->lock);
+    stage->next++;
+    struct chunk **slot = &stage->parked[stage->next % pipeline->num_chunks];
+    struct chunk *chunk = *slot;
+    if ((chunk != NULL) && (chunk->sequence == stage->next)) {
+        *slot = NULL;
+    } else {
+        chunk = NULL;
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return chunk;
+}
+
+// Stages are not called for a chunk with no data, but it still takes its
+// turn at the ordered ones.
+static void run_stage(struct ice9_pipeline *pipeline, struct stage *stage, struct chunk *chunk) {
+    if (chunk->bytes == 0) {
+        return;
+    }
+    const uint8_t *in = chunk->buffers[chunk->current].data;
+    if (stage->fn == NULL) {
+        stage->sink(stage->context, in, chunk->bytes);
+        COUNT(pipeline, bytes_out, chunk->bytes);
+        return;
+    }
+    uint8_t *out = chunk->buffers[chunk->current ^ 1].data;
+    int bytes = stage->fn(stage->context, in, chunk->bytes, out, stage->capacity);
+    if ((bytes < 0) || (bytes > stage->capacity)) {
+        LOG_ERROR("ice9 pipeline stage %d failed (%d)\n", chunk->stage, bytes);
+        fail(pipeline, PipelineStageFailed);
+        bytes = 0;
+    }
+    chunk->current ^= 1;
+    chunk->bytes = bytes;
+}
+
+static void recycle(struct ice9_pipeline *pipeline, struct chunk *chunk) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->free_chunks[pipeline->num_free++] = chunk;
+    pipeline->in_flight--;
+    pthread_cond_signal(&pipeline->chunk_free);
+    if (pipeline->reader_done && (pipeline->in_flight == 0)) {
+        pthread_cond_broadcast(&pipeline->work_ready);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+// Carry a chunk through its remaining stages, as far as it can go before an
+// ordered stage makes it wait.  Chunks this frees up go on the worker's
+// own queue.
+static void run_chunk(struct worker *worker, struct chunk *chunk) {
+    struct ice9_pipeline *pipeline = worker->pipeline;
+    while (chunk->stage <= pipeline->num_stages) {
+        struct stage *stage = &pipeline->stages[chunk->stage];
+        int ordered = stage->flags & ICE9_STAGE_ORDERED;
+        if (ordered && !ordered_enter(pipeline, stage, chunk)) {
+            return;
+        }
+        run_stage(pipeline, stage, chunk);
+        chunk->stage++;
+        if (ordered) {
+            struct chunk *successor = ordered_leave(pipeline, stage);
+            if (successor != NULL) {
+                push_chunk(worker, successor);
+            }
+        }
+    }
+    recycle(pipeline, chunk);
+}
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct chunk *chunk;
+    while ((chunk = next_chunk(worker)) != NULL) {
+        run_chunk(worker, chunk);
+    }
+    return NULL;
+}
+
+// Chunks are dealt to the workers in turn; stealing evens out the rest.
+static void *reader_main(void *arg) {
+    struct ice9_pipeline *pipeline = arg;
+    for (;;) {
+        pthread_mutex_lock(&pipeline->lock);
+        if ((pipeline->num_free == 0) && !pipeline->stopping) {
+            COUNT(pipeline, reader_stalls, 1);
+            while ((pipeline->num_free == 0) && !pipeline->stopping) {
+                pthread_cond_wait(&pipeline->chunk_free, &pipeline->lock);
+            }
+        }
+        if (pipeline->stopping) {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        struct chunk *chunk = pipeline->free_chunks[--pipeline->num_free];
+        pipeline->in_flight++;
+        pthread_mutex_unlock(&pipeline->lock);
+        enum Ice9Error ret = ice9_stream_read(pipeline->hnd, chunk->buffers[0].data, pipeline->chunk_size);
+        if (ret != OK) {
+            recycle(pipeline, chunk);
+            fail(pipeline, ret);
+            break;
+        }
+        chunk->current = 0;
+        chunk->bytes = pipeline->chunk_size;
+        chunk->stage = 0;
+        chunk->sequence = pipeline->next_sequence++;
+        COUNT(pipeline, chunks, 1);
+        COUNT(pipeline, bytes_in, pipeline->chunk_size);
+        push_chunk(&pipeline->workers[chunk->sequence % pipeline->num_workers], chunk);
+    }
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->reader_done = 1;
+    pthread_cond_broadcast(&pipeline->work_ready);
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+static void free_run_state(struct ice9_pipeline *pipeline) {
+    if (pipeline->chunks != NULL) {
+        for (int i = 0; i < pipeline->num_chunks; i++) {
+            ice9_buffer_free(&pipeline->chunks[i].buffers[0]);
+            ice9_buffer_free(&pipeline->chunks[i].buffers[1]);
+        }
+    }
+    if (pipeline->workers != NULL) {
+        for (int i = 0; i < pipeline->num_workers; i++) {
+            pthread_mutex_destroy(&pipeline->workers[i].lock);
+            free(pipeline->workers[i].queue);
+        }
+    }
+    for (int i = 0; i <= pipeline->num_stages; i++) {
+        free(pipeline->stages[i].parked);
+        pipeline->stages[i].parked = NULL;
+    }
+    free(pipeline->chunks);
+    free(pipeline->workers);
+    free(pipeline->free_chunks);
+    pipeline->chunks = NULL;
+    pipeline->workers = NULL;
+    pipeline->free_chunks = NULL;
+}
+
+// Chunks and queues are made fresh for each run, as the stages decide how
+// big the buffers need to be.
+static enum Ice9Error alloc_run_state(struct ice9_pipeline *pipeline) {
+    int capacity = pipeline->chunk_size;
+    for (int i = 0; i <= pipeline->num_stages; i++) {
+        capacity = MAX(capacity, pipeline->stages[i].capacity);
+        pipeline->stages[i].next = 0;
+        pipeline->stages[i].parked = calloc(pipeline->num_chunks, sizeof(struct chunk *));
+        if (pipeline->stages[i].parked == NULL) {
+            return BufferAllocationFailed;
+        }
+    }
+    pipeline->chunks = calloc(pipeline->num_chunks, sizeof(struct chunk));
+    pipeline->free_chunks = calloc(pipeline->num_chunks, sizeof(struct chunk *));
+    pipeline->workers = calloc(pipeline->num_workers, sizeof(struct worker));
+    if ((pipeline->chunks == NULL) || (pipeline->free_chunks == NULL) || (pipeline->workers == NULL)) {
+        return BufferAllocationFailed;
+    }
+    int buffer_flags = ice9_handle_buffer_flags(pipeline->hnd);
+    for (int i = 0; i < pipeline->num_chunks; i++) {
+        struct chunk *chunk = &pipeline->chunks[i];
+        for (int j = 0; j < 2; j++) {
+            chunk->buffers[j].size = capacity;
+            enum Ice9Error ret = ice9_buffer_alloc(&chunk->buffers[j], buffer_flags);
+            if (ret != OK) {
+                return ret;
+            }
+        }
+        pipeline->free_chunks[i] = chunk;
+    }
+    pipeline->num_free = pipeline->num_chunks;
+    for (int i = 0; i < pipeline->num_workers; i++) {
+        struct worker *worker = &pipeline->workers[i];
+        worker->pipeline = pipeline;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->queue = calloc(pipeline->num_chunks, sizeof(struct chunk *));
+        if (worker->queue == NULL) {
+            return BufferAllocationFailed;
+        }
+    }
+    return OK;
+}
+
+// Wait for the threads started so far.  The reader stops first; the
+// workers then finish what is in flight.
+static void join_threads(struct ice9_pipeline *pipeline, int reader_started, int workers_started) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = 1;
+    if (!reader_started) {
+        pipeline->reader_done = 1;
+    }
+    pthread_cond_broadcast(&pipeline->chunk_free);
+    pthread_cond_broadcast(&pipeline->work_ready);
+    pthread_mutex_unlock(&pipeline->lock);
+    if (reader_started) {
+        pthread_join(pipeline->reader, NULL);
+    }
+    for (int i = 0; i < workers_started; i++) {
+        pthread_join(pipeline->workers[i].thread, NULL);
+    }
+}
+
+enum Ice9Error ice9_pipeline_start(struct ice9_pipeline *pipeline) {
+    if (pipeline->running || (pipeline->stages[pipeline->num_stages].sink == NULL)) {
+        return Error;
+    }
+    pipeline->stopping = 0;
+    pipeline->reader_done = 0;
+    pipeline->pending = 0;
+    pipeline->in_flight = 0;
+    pipeline->next_sequence = 0;
+    atomic_store(&pipeline->error, OK);
+    enum Ice9Error ret = alloc_run_state(pipeline);
+    if (ret != OK) {
+        free_run_state(pipeline);
+        return ret;
+    }
+    const struct ice9_thread_settings *settings = ice9_handle_thread_settings(pipeline->hnd);
+    for (int i = 0; i < pipeline->num_workers; i++) {
+        char role[16];
+        snprintf(role, sizeof(role), "work%d", i);
+        ret = ice9_thread_start(settings, role, worker_main, &pipeline->workers[i], &pipeline->workers[i].thread);
+        if (ret != OK) {
+            join_threads(pipeline, 0, i);
+            free_run_state(pipeline);
+            return ret;
+        }
+    }
+    ret = ice9_thread_start(settings, "reader", reader_main, pipeline, &pipeline->reader);
+    if (ret != OK) {
+        join_threads(pipeline, 0, pipeline->num_workers);
+        free_run_state(pipeline);
+        return ret;
+    }
+    pipeline->running = 1;
+    return OK;
+}
+
+enum Ice9Error ice9_pipeline_stop(struct ice9_pipeline *pipeline) {
+    if (!pipeline->running) {
+        return OK;
+    }
+    join_threads(pipeline, 1, pipeline->num_workers);
+    free_run_state(pipeline);
+    pipeline->running = 0;
+    return atomic_load(&pipeline->error);
+}
+
+enum Ice9Error ice9_pipeline_get_stats(struct ice9_pipeline *pipeline, struct ice9_pipeline_stats *stats) {
+    stats->chunks = LOAD(pipeline, chunks);
+    stats->bytes_in = LOAD(pipeline, bytes_in);
+    stats->bytes_out = LOAD(pipeline, bytes_out);
+    stats->steals = LOAD(pipeline, steals);
+    stats->reader_stalls = LOAD(pipeline, reader_stalls);
+    return OK;
+}
+
+void ice9_pipeline_free(struct ice9_pipeline *pipeline) {
+    if (pipeline == NULL) {
+        return;
+    }
+    ice9_pipeline_stop(pipeline);
+    for (int i = 0; i <= MAX_STAGES; i++) {
+        pthread_mutex_destroy(&pipeline->stages[i].lock);
+    }
+    pthread_cond_destroy(&pipeline->work_ready);
+    pthread_cond_destroy(&pipeline->chunk_free);
+    pthread_mutex_destroy(&pipeline->lock);
+    free(pipeline);
+}
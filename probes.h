@@ -0,0 +1,44 @@
+#ifndef _ICE9_PROBES_H_
+#define _ICE9_PROBES_H_
+
+// USDT static tracepoints under the "ice9" provider, for attaching bpftrace
+// or perf to a running process, e.g.
+//
+//   bpftrace -e 'usdt:./libice9.so:ice9:transfer_complete { @[arg0] = hist(arg2); }'
+//
+// A probe is a single nop in the code until a tracer attaches, so they are
+// always compiled in when <sys/sdt.h> is available.  Without it the macros
+// compile away and their arguments are not evaluated, so arguments
+// must not have side effects.
+//
+// Probes and their arguments:
+//   transfer_submit(dir, length)                 bulk transfer, dir 0 = out, 1 = in
+//   transfer_complete(dir, length, transferred, status)
+//   control_submit(request_type, request, value, index)
+//   control_complete(request, status)
+//   ring_enqueue(requested, enqueued, fill)      read ring, fill after the call
+//   ring_drain(requested, drained, fill)
+//   bank_store(bytes, banked)                    callback bank, banked after the call
+//   bank_drain(bytes, banked)
+//   bytes_dropped(count)
+//   event(event, payload)                        device event split from the IN stream
+//   mpsse_write(length, rc)                      rc as returned by libftdi
+//   mpsse_read(rc)
+//   stream_submit(transfer, length)              ftdi_readstream_ice9 transfers
+//   stream_complete(transfer, status, actual_length)
+//   stream_progress(total_bytes)
+#ifdef ICE9_HAVE_SDT
+#include <sys/sdt.h>
+#define ICE9_PROBE1(name, a) DTRACE_PROBE1(ice9, name, a)
+#define ICE9_PROBE2(name, a, b) DTRACE_PROBE2(ice9, name, a, b)
+#define ICE9_PROBE3(name, a, b, c) DTRACE_PROBE3(ice9, name, a, b, c)
+#define ICE9_PROBE4(name, a, b, c, d) DTRACE_PROBE4(ice9, name, a, b, c, d)
+#else
+// sizeof keeps the arguments "used" without evaluating them.
+#define ICE9_PROBE1(name, a) do { (void) sizeof(a); } while (0)
+#define ICE9_PROBE2(name, a, b) do { (void) sizeof(a); (void) sizeof(b); } while (0)
+#define ICE9_PROBE3(name, a, b, c) do { ICE9_PROBE2(name, a, b); (void) sizeof(c); } while (0)
+#define ICE9_PROBE4(name, a, b, c, d) do { ICE9_PROBE3(name, a, b, c); (void) sizeof(d); } while (0)
+#endif
+
+#endif  // _ICE9_PROBES_H_
@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ice9.h"
+#include "logger.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+#define PUBLISH_MAGIC 0x39656369
+#define PUBLISH_VERSION 1
+// The longest a subscriber sleeps before checking the publisher is alive.
+#define PUBLISHER_CHECK_NS 100000000LL
+
+// One subscriber's read position.  pid is 0 while the slot is free.
+struct slot {
+    _Atomic uint32_t pid;
+    uint32_t reserved;
+    _Atomic uint64_t position;
+};
+
+// The start of the shared memory object; the ring follows at data_offset.
+// magic is set last, once the rest is filled in.
+struct shared_header {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    uint64_t data_offset;
+    uint32_t max_subscribers;
+    _Atomic uint32_t publisher_pid;
+    _Atomic uint32_t closed;
+    // Bumped after every write, and waited on with a futex by subscribers
+    // that have caught up.
+    _Atomic uint32_t sequence;
+    _Atomic uint32_t waiters;
+    uint32_t reserved;
+    // Bytes published so far, and the end of the write under way.  Anything
+    // before claimed - ring_size may already have been written over.
+    _Atomic uint64_t written;
+    _Atomic uint64_t claimed;
+    struct slot slots[];
+};
+
+struct ice9_publisher {
+    char name[NAME_MAX];
+    struct shared_header *header;
+    size_t header_size;
+    uint8_t *ring;
+    size_t ring_size;
+};
+
+struct ice9_subscriber {
+    struct shared_header *header;
+    size_t header_size;
+    const uint8_t *ring;
+    size_t ring_size;
+    struct slot *slot;
+    uint64_t position;
+    uint64_t bytes;
+    uint64_t laps;
+    uint64_t bytes_lapped;
+};
+
+static size_t round_up(size_t size, size_t page) {
+    return ((size + page - 1) / page) * page;
+}
+
+// shm_open wants a name with one leading slash.
+static int shm_path(char *path, size_t size, const char *name) {
+    int n = snprintf(path, size, "%s%s", (name[0] == '/') ? "" : "/", name);
+    return (n > 1) && ((size_t) n < size);
+}
+
+// The ring is mapped twice, back to back, so that a run of data that wraps
+// round the end of the ring is still contiguous in memory.
+static uint8_t *map_ring(int fd, size_t offset, size_t size, int prot) {
+    uint8_t *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if ((mmap(base, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED) ||
+        (mmap(base + size, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED)) {
+        munmap(base, 2 * size);
+        return NULL;
+    }
+    return base;
+}
+
+static int process_gone(uint32_t pid) {
+    return (kill((pid_t) pid, 0) != 0) && (errno == ESRCH);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void futex_wait(_Atomic uint32_t *word, uint32_t value, const struct timespec *timeout) {
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+// A name left behind by a publisher that died can be taken over.
+static int stale(const char *path) {
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    int gone = 0;
+    if ((fstat(fd, &st) == 0) && ((size_t) st.st_size >= sizeof(struct shared_header))) {
+        struct shared_header *header = mmap(NULL, sizeof(struct shared_header), PROT_READ, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            gone = (atomic_load(&header->magic) != PUBLISH_MAGIC) || process_gone(atomic_load(&header->publisher_pid));
+            munmap(header, sizeof(struct shared_header));
+        }
+    } else {
+        gone = 1;
+    }
+    close(fd);
+    return gone;
+}
+
+struct ice9_publisher *ice9_publisher_new(const char *name, int ring_size, int max_subscribers) {
+    char path[NAME_MAX];
+    if ((name == NULL) || (ring_size <= 0) || (max_subscribers <= 0) || !shm_path(path, sizeof(path), name)) {
+        return NULL;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t ring = round_up(ring_size, page);
+    size_t header_size = round_up(sizeof(struct shared_header) + max_subscribers * sizeof(struct slot), page);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (errno == EEXIST) && stale(path)) {
+        shm_unlink(path);
+        fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0) {
+        LOG_ERROR("ice9 publisher %s: shm_open failed: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct ice9_publisher *publisher = calloc(1, sizeof(struct ice9_publisher));
+    if ((publisher == NULL) || (ftruncate(fd, header_size + ring) != 0)) {
+        LOG_ERROR("ice9 publisher %s: unable to size shared memory\n", path);
+        goto fail;
+    }
+    snprintf(publisher->name, sizeof(publisher->name), "%s", path);
+    publisher->header_size = header_size;
+    publisher->ring_size = ring;
+    publisher->header = mmap(NULL, header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (publisher->header == MAP_FAILED) {
+        publisher->header = NULL;
+        LOG_ERROR("ice9 publisher %s: mmap failed: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    publisher->ring = map_ring(fd, header_size, ring, PROT_READ | PROT_WRITE);
+    if (publisher->ring == NULL) {
+        LOG_ERROR("ice9 publisher %s: mmap failed: %s\n", path, strerror(errno));
+        goto fail;
+    }
+    close(fd);
+    struct shared_header *header = publisher->header;
+    header->version = PUBLISH_VERSION;
+    header->ring_size = ring;
+    header->data_offset = header_size;
+    header->max_subscribers = max_subscribers;
+    atomic_store(&header->publisher_pid, (uint32_t) getpid());
+    atomic_store_explicit(&header->magic, PUBLISH_MAGIC, memory_order_release);
+    return publisher;
+fail:
+    if (publisher != NULL) {
+        if (publisher->header != NULL) {
+            munmap(publisher->header, header_size);
+        }
+        free(publisher);
+    }
+    close(fd);
+    shm_unlink(path);
+    return NULL;
+}
+
+// Writes go in two steps: claim the space, which tells subscribers the data
+// past claimed - ring_size is going, fill it, then publish it.
+// claimed never goes back: a write that failed part way may already have
+// overwritten some of its span, so that span stays claimed.
+static uint8_t *begin_write(struct ice9_publisher *publisher, int num_bytes) {
+    struct shared_header *header = publisher->header;
+    uint64_t written = atomic_load_explicit(&header->written, memory_order_relaxed);
+    uint64_t claimed = atomic_load_explicit(&header->claimed, memory_order_relaxed);
+    if (written + num_bytes > claimed) {
+        atomic_store_explicit(&header->claimed, written + num_bytes, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    return publisher->ring + written % publisher->ring_size;
+}
+
+static void end_write(struct ice9_publisher *publisher, int num_bytes) {
+    struct shared_header *header = publisher->header;
+    uint64_t written = atomic_load_explicit(&header->written, memory_order_relaxed) + num_bytes;
+    atomic_store(&header->written, written);
+    atomic_fetch_add(&header->sequence, 1);
+    if (atomic_load(&header->waiters) > 0) {
+        futex_wake(&header->sequence);
+    }
+}
+
+enum Ice9Error ice9_publish(struct ice9_publisher *publisher, const uint8_t *data, int num_bytes) {
+    while (num_bytes > 0) {
+        int part = (int) MIN((size_t) num_bytes, publisher->ring_size);
+        memcpy(begin_write(publisher, part), data, part);
+        end_write(publisher, part);
+        data += part;
+        num_bytes -= part;
+    }
+    return OK;
+}
+
+// Half a ring at a time, so subscribers that are keeping up can read the
+// last part while the next one is being filled.
+enum Ice9Error ice9_publish_stream(struct ice9_handle *hnd, struct ice9_publisher *publisher, int num_bytes) {
+    while (num_bytes > 0) {
+        int part = (int) MIN((size_t) num_bytes, publisher->ring_size / 2);
+        enum Ice9Error ret = ice9_stream_read(hnd, begin_write(publisher, part), part);
+        if (ret != OK) {
+            end_write(publisher, 0);
+            return ret;
+        }
+        end_write(publisher, part);
+        num_bytes -= part;
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_publisher_get_stats(struct ice9_publisher *publisher, struct ice9_publisher_stats *stats) {
+    struct shared_header *header = publisher->header;
+    uint64_t written = atomic_load(&header->written);
+    stats->bytes = written;
+    stats->subscribers = 0;
+    stats->max_lag = 0;
+    for (uint32_t i = 0; i < header->max_subscribers; i++) {
+        if (atomic_load(&header->slots[i].pid) == 0) {
+            continue;
+        }
+        uint64_t position = atomic_load_explicit(&header->slots[i].position, memory_order_relaxed);
+        uint64_t lag = (written > position) ? written - position : 0;
+        stats->subscribers++;
+        stats->max_lag = (lag > stats->max_lag) ? lag : stats->max_lag;
+    }
+    return OK;
+}
+
+void ice9_publisher_free(struct ice9_publisher *publisher) {
+    if (publisher == NULL) {
+        return;
+    }
+    struct shared_header *header = publisher->header;
+    atomic_store(&header->closed, 1);
+    atomic_fetch_add(&header->sequence, 1);
+    futex_wake(&header->sequence);
+    shm_unlink(publisher->name);
+    munmap(publisher->ring, 2 * publisher->ring_size);
+    munmap(publisher->header, publisher->header_size);
+    free(publisher);
+}
+
+// Take a free slot, or failing that one whose subscriber has exited.
+static struct slot *claim_slot(struct shared_header *header) {
+    uint32_t pid = (uint32_t) getpid();
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < header->max_subscribers; i++) {
+            struct slot *slot = &header->slots[i];
+            uint32_t owner = atomic_load(&slot->pid);
+            if (((pass == 0) && (owner != 0)) || ((pass == 1) && ((owner == 0) || !process_gone(owner)))) {
+                continue;
+            }
+            if (atomic_compare_exchange_strong(&slot->pid, &owner, pid)) {
+                return slot;
+            }
+        }
+    }
+    return NULL;
+}
+
+struct ice9_subscriber *ice9_subscribe(const char *name) {
+    char path[NAME_MAX];
+    if ((name == NULL) || !shm_path(path, sizeof(path), name)) {
+        return NULL;
+    }
+    int fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) {
+        LOG_ERROR("ice9 subscriber %s: shm_open failed: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct ice9_subscriber *subscriber = calloc(1, sizeof(struct ice9_subscriber));
+    struct stat st;
+    if ((subscriber == NULL) || (fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(struct shared_header))) {
+        goto fail;
+    }
+    // Map just the fixed part first to find out how big the rest is.
+    struct shared_header *header = mmap(NULL, sizeof(struct shared_header), PROT_READ, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        goto fail;
+    }
+    int ready = (atomic_load_explicit(&header->magic, memory_order_acquire) == PUBLISH_MAGIC) &&
+                (header->version == PUBLISH_VERSION);
+    subscriber->header_size = header->data_offset;
+    subscriber->ring_size = header->ring_size;
+    munmap(header, sizeof(struct shared_header));
+    if (!ready || ((size_t) st.st_size < subscriber->header_size + subscriber->ring_size)) {
+        LOG_ERROR("ice9 subscriber %s: not an ice9 publisher\n", path);
+        goto fail;
+    }
+    subscriber->header = mmap(NULL, subscriber->header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (subscriber->header == MAP_FAILED) {
+        subscriber->header = NULL;
+        goto fail;
+    }
+    subscriber->ring = map_ring(fd, subscriber->header_size, subscriber->ring_size, PROT_READ);
+    if (subscriber->ring == NULL) {
+        goto fail;
+    }
+    subscriber->slot = claim_slot(subscriber->header);
+    if (subscriber->slot == NULL) {
+        LOG_ERROR("ice9 subscriber %s: %s\n", path, ice9_error_string(NoSubscriberSlot));
+        goto fail;
+    }
+    close(fd);
+    // Subscribers start with the next data published.
+    subscriber->position = atomic_load(&subscriber->header->written);
+    atomic_store(&subscriber->slot->position, subscriber->position);
+    return subscriber;
+fail:
+    if (subscriber != NULL) {
+        if (subscriber->ring != NULL) {
+            munmap((void *) subscriber->ring, 2 * subscriber->ring_size);
+        }
+        if (subscriber->header != NULL) {
+            munmap(subscriber->header, subscriber->header_size);
+        }
+        free(subscriber);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void set_position(struct ice9_subscriber *subscriber, uint64_t position) {
+    subscriber->position = position;
+    atomic_store_explicit(&subscriber->slot->position, position, memory_order_relaxed);
+}
+
+static enum Ice9Error lapped(struct ice9_subscriber *subscriber, uint64_t resume) {
+    subscriber->laps++;
+    if (resume > subscriber->position) {
+        subscriber->bytes_lapped += resume - subscriber->position;
+        set_position(subscriber, resume);
+    }
+    return SubscriberLapped;
+}
+
+// Sleep until the publisher writes or closes, the deadline passes, or it is
+// time to check the publisher is still alive.  Returns 0 once the deadline
+// has passed.
+static int wait_for_data(struct ice9_subscriber *subscriber, int timeout_ms, const struct timespec *deadline) {
+    struct shared_header *header = subscriber->header;
+    if (timeout_ms == 0) {
+        return 0;
+    }
+    int64_t ns = PUBLISHER_CHECK_NS;
+    if (timeout_ms > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t left = (deadline->tv_sec - now.tv_sec) * 1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+        if (left <= 0) {
+            return 0;
+        }
+        ns = (left < ns) ? left : ns;
+    }
+    struct timespec timeout = { ns / 1000000000LL, ns % 1000000000LL };
+    uint32_t sequence = atomic_load(&header->sequence);
+    atomic_fetch_add(&header->waiters, 1);
+    if ((atomic_load(&header->written) == subscriber->position) && !atomic_load(&header->closed)) {
+        futex_wait(&header->sequence, sequence, &timeout);
+    }
+    atomic_fetch_sub(&header->waiters, 1);
+    return 1;
+}
+
+enum Ice9Error ice9_subscriber_peek(struct ice9_subscriber *subscriber, const uint8_t **data, int *num_bytes,
+                                    int timeout_ms) {
+    struct shared_header *header = subscriber->header;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    *num_bytes = 0;
+    for (;;) {
+        uint64_t written = atomic_load_explicit(&header->written, memory_order_acquire);
+        uint64_t claimed = atomic_load_explicit(&header->claimed, memory_order_relaxed);
+        if (claimed - subscriber->position > subscriber->ring_size) {
+            return lapped(subscriber, written);
+        }
+        if (written != subscriber->position) {
+            *data = subscriber->ring + subscriber->position % subscriber->ring_size;
+            *num_bytes = (int) MIN(written - subscriber->position, (uint64_t) INT_MAX);
+            return OK;
+        }
+        if (atomic_load(&header->closed)) {
+            return NoDataAvailable;
+        }
+        // A publisher that died never sets closed.
+        if (process_gone(atomic_load(&header->publisher_pid))) {
+            return PublisherGone;
+        }
+        if (!wait_for_data(subscriber, timeout_ms, &deadline)) {
+            return NoDataAvailable;
+        }
+    }
+}
+
+// The check comes after the caller has used the data: if the publisher
+// claimed any of it in the meantime, it may have been half overwritten.
+enum Ice9Error ice9_subscriber_release(struct ice9_subscriber *subscriber, int num_bytes) {
+    struct shared_header *header = subscriber->header;
+    uint64_t written = atomic_load_explicit(&header->written, memory_order_relaxed);
+    if ((num_bytes < 0) || (subscriber->position + num_bytes > written)) {
+        return Error;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t claimed = atomic_load_explicit(&header->claimed, memory_order_relaxed);
+    uint64_t start = subscriber->position;
+    set_position(subscriber, start + num_bytes);
+    subscriber->bytes += num_bytes;
+    if (claimed - start > subscriber->ring_size) {
+        return lapped(subscriber, written);
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_subscriber_read(struct ice9_subscriber *subscriber, uint8_t *data, int num_bytes,
+                                    int timeout_ms) {
+    while (num_bytes > 0) {
+        const uint8_t *src;
+        int available;
+        enum Ice9Error ret = ice9_subscriber_peek(subscriber, &src, &available, timeout_ms);
+        if (ret != OK) {
+            return ret;
+        }
+        int n = MIN(available, num_bytes);
+        memcpy(data, src, n);
+        ret = ice9_subscriber_release(subscriber, n);
+        if (ret != OK) {
+            return ret;
+        }
+        data += n;
+        num_bytes -= n;
+    }
+    return OK;
+}
+
+enum Ice9Error ice9_subscriber_get_stats(struct ice9_subscriber *subscriber, struct ice9_subscriber_stats *stats) {
+    stats->bytes = subscriber->bytes;
+    stats->laps = subscriber->laps;
+    stats->bytes_lapped = subscriber->bytes_lapped;
+    return OK;
+}
+
+void ice9_unsubscribe(struct ice9_subscriber *subscriber) {
+    if (subscriber == NULL) {
+        return;
+    }
+    atomic_store(&subscriber->slot->pid, 0);
+    munmap((void *) subscriber->ring, 2 * subscriber->ring_size);
+    munmap(subscriber->header, subscriber->header_size);
+    free(subscriber);
+}
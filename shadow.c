@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "shadow.h"
+
+void ice9_shadow_init(struct ice9_shadow *shadow) {
+    memset(shadow, 0, sizeof(*shadow));
+}
+
+static int matches(const struct ice9_shadow *shadow, uint8_t address, const uint16_t *data, uint16_t len) {
+    return shadow->valid[address] && (shadow->len[address] == len) &&
+           (memcmp(shadow->words[address], data, len * sizeof(uint16_t)) == 0);
+}
+
+enum ice9_shadow_action ice9_shadow_write(struct ice9_shadow *shadow, uint8_t address,
+                                          const uint16_t *data, uint16_t len) {
+    shadow->generation[address]++;
+    if (shadow->policy[address] == ICE9_REGISTER_VOLATILE) {
+        return SHADOW_WRITE;
+    }
+    if (len > ICE9_SHADOW_WORDS) {
+        // Too big to keep.  Anything pending for the address is superseded.
+        shadow->valid[address] = 0;
+        shadow->dirty[address] = 0;
+        return SHADOW_WRITE;
+    }
+    if (matches(shadow, address, data, len)) {
+        return SHADOW_ELIDED;
+    }
+    memcpy(shadow->words[address], data, len * sizeof(uint16_t));
+    shadow->len[address] = len;
+    shadow->valid[address] = 1;
+    if (!shadow->write_combining) {
+        return SHADOW_WRITE;
+    }
+    if (shadow->dirty[address]) {
+        return SHADOW_COMBINED;
+    }
+    shadow->dirty[address] = 1;
+    shadow->pending[shadow->num_pending++] = address;
+    return SHADOW_DEFERRED;
+}
+
+enum Ice9Error ice9_shadow_read(struct ice9_shadow *shadow, uint8_t address, uint16_t *data, uint16_t len) {
+    switch (shadow->policy[address]) {
+        case ICE9_REGISTER_CACHEABLE:
+        case ICE9_REGISTER_WRITE_ONLY:
+            if (shadow->valid[address] && (shadow->len[address] == len)) {
+                memcpy(data, shadow->words[address], len * sizeof(uint16_t));
+                return OK;
+            }
+            return (shadow->policy[address] == ICE9_REGISTER_WRITE_ONLY) ? RegisterNotReadable : NoDataAvailable;
+        default:
+            return NoDataAvailable;
+    }
+}
+
+void ice9_shadow_fill(struct ice9_shadow *shadow, uint8_t address, const uint16_t *data, uint16_t len,
+                      uint32_t generation) {
+    if ((shadow->policy[address] != ICE9_REGISTER_CACHEABLE) || (len > ICE9_SHADOW_WORDS) ||
+        (shadow->generation[address] != generation)) {
+        return;
+    }
+    memcpy(shadow->words[address], data, len * sizeof(uint16_t));
+    shadow->len[address] = len;
+    shadow->valid[address] = 1;
+}
+
+void ice9_shadow_forget(struct ice9_shadow *shadow, uint8_t address) {
+    shadow->valid[address] = 0;
+    shadow->generation[address]++;
+}
+
+void ice9_shadow_invalidate(struct ice9_shadow *shadow) {
+    for (int i = 0; i < ICE9_SHADOW_ADDRESSES; i++) {
+        // A pending write is still the value the device will hold.
+        if (!shadow->dirty[i]) {
+            shadow->valid[i] = 0;
+        }
+        shadow->generation[i]++;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef _ICE9_SHADOW_H_
+#define _ICE9_SHADOW_H_
+
+#include <stdint.h>
+
+#include "ice9.h"
+
+// Host side copy of the FPGA register space, one block of up to
+// ICE9_SHADOW_WORDS words per address.  Longer transfers go straight to the
+// device and invalidate the address.  Locking is up to the caller.
+#define ICE9_SHADOW_ADDRESSES 256
+#define ICE9_SHADOW_WORDS 8
+
+struct ice9_shadow {
+    uint8_t policy[ICE9_SHADOW_ADDRESSES];
+    uint8_t valid[ICE9_SHADOW_ADDRESSES];
+    uint8_t dirty[ICE9_SHADOW_ADDRESSES];
+    uint16_t len[ICE9_SHADOW_ADDRESSES];
+    uint16_t words[ICE9_SHADOW_ADDRESSES][ICE9_SHADOW_WORDS];
+    // Bumped on every write, so a read that raced one does not fill the
+    // shadow with the value from before it.
+    uint32_t generation[ICE9_SHADOW_ADDRESSES];
+    // Dirty addresses in the order they were first written.
+    uint8_t pending[ICE9_SHADOW_ADDRESSES];
+    int num_pending;
+    int write_combining;
+};
+
+enum ice9_shadow_action {
+    SHADOW_WRITE,       // Send to the device now
+    SHADOW_ELIDED,      // Identical to what the device already holds
+    SHADOW_DEFERRED,    // Held until the next flush
+    SHADOW_COMBINED,    // Replaced a write that was already being held
+};
+
+void ice9_shadow_init(struct ice9_shadow *shadow);
+
+// Decide what to do with a write and update the shadow to match.  data is
+// not looked at when len is over ICE9_SHADOW_WORDS.
+enum ice9_shadow_action ice9_shadow_write(struct ice9_shadow *shadow, uint8_t address,
+                                          const uint16_t *data, uint16_t len);
+
+// Serve a read from the shadow.  Returns OK on a hit, NoDataAvailable if the
+// device must be asked, or RegisterNotReadable for a write-only register that
+// has not been written.
+enum Ice9Error ice9_shadow_read(struct ice9_shadow *shadow, uint8_t address, uint16_t *data, uint16_t len);
+
+// Record a value read from the device, unless the address was written since
+// generation was taken.
+void ice9_shadow_fill(struct ice9_shadow *shadow, uint8_t address, const uint16_t *data, uint16_t len,
+                      uint32_t generation);
+
+// Forget the cached value for an address after a write to it failed, so the
+// same write is sent again rather than elided.
+void ice9_shadow_forget(struct ice9_shadow *shadow, uint8_t address);
+
+// Forget every cached value.  Pending writes are kept.
+void ice9_shadow_invalidate(struct ice9_shadow *shadow);
+
+#endif  // _ICE9_SHADOW_H_
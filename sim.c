@@ -0,0 +1,545 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ice9_sim.h"
+#include "ice9_transport.h"
+
+#define SIM_PACKET_SIZE 512
+#define SIM_STATUS_BYTES 2
+#define SIM_PAYLOAD_SIZE (SIM_PACKET_SIZE - SIM_STATUS_BYTES)
+// FT232H modem status: byte 0 is constant, byte 1 carries the line status
+// where bit 1 flags an overrun.
+#define SIM_MODEM_STATUS 0x32
+#define SIM_LINE_STATUS 0x60
+#define SIM_LINE_OVERRUN 0x02
+// Replies to register reads share the FIFO with stream data but are never
+// dropped, so the FIFO has room for this much on top of fifo_depth.
+#define SIM_REPLY_SLACK (128*1024)
+// Event framing, see ice9_sim.h.
+#define SIM_EVENT_WORD 0x0E
+#define SIM_EVENT_FRAME 0xFE
+#define SIM_EVENT_ESCAPE 0xFF
+#define SIM_FRAME_WORDS 255
+// How far OUT transfers may run ahead of the modelled link before the
+// writer is made to wait.
+#define SIM_OUT_SLACK_NS 200000
+
+enum sim_parse_state {
+    PARSE_COMMAND,
+    PARSE_READ_LENGTH,
+    PARSE_WRITE_LENGTH,
+    PARSE_WRITE_DATA,
+};
+
+// A reply that is waiting out the configured latency before it reaches the FIFO.
+struct sim_reply {
+    struct sim_reply *next;
+    uint64_t ready_ns;
+    int length;
+    uint8_t data[];
+};
+
+struct ice9_sim {
+    pthread_mutex_t lock;
+    struct ice9_sim_config config;
+    uint16_t registers[256][ICE9_SIM_REGISTER_WORDS];
+    // Host to device parser
+    enum sim_parse_state state;
+    int have_low_byte;
+    uint8_t low_byte;
+    uint8_t address;
+    int words_remaining;
+    int word_index;
+    // Device to host FIFO
+    uint8_t *fifo;
+    int fifo_size;
+    uint64_t fifo_head;
+    uint64_t fifo_tail;
+    struct sim_reply *replies;
+    struct sim_reply **replies_tail;
+    int overrun;
+    // Streaming source
+    int streaming;
+    uint16_t stream_counter;
+    uint64_t stream_last_ns;
+    double stream_budget;
+    // Event framing on
+    int events;
+    // Multi-channel streaming: the addresses in the order they were added,
+    // each with its own counter, served round robin.
+    uint8_t channels[256];
+    int num_channels;
+    int next_channel;
+    uint16_t channel_counter[256];
+    // Link pacing
+    uint64_t link_free_ns;
+    struct ice9_sim_stats stats;
+};
+
+static uint64_t sim_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sim_sleep_until(uint64_t when_ns) {
+    uint64_t now = sim_now_ns();
+    if (when_ns <= now) {
+        return;
+    }
+    struct timespec ts = { (when_ns - now) / 1000000000ULL, (when_ns - now) % 1000000000ULL };
+    nanosleep(&ts, NULL);
+}
+
+static int fifo_used(struct ice9_sim *sim) {
+    return sim->fifo_head - sim->fifo_tail;
+}
+
+static void fifo_push(struct ice9_sim *sim, const uint8_t *data, int length) {
+    for (int i = 0; i < length; i++) {
+        sim->fifo[(sim->fifo_head++) % sim->fifo_size] = data[i];
+    }
+}
+
+static void push_reply(struct ice9_sim *sim, const uint8_t *data, int length) {
+    if ((sim->config.latency_us == 0) && (sim->replies == NULL) &&
+        (fifo_used(sim) + length <= sim->fifo_size)) {
+        fifo_push(sim, data, length);
+        return;
+    }
+    struct sim_reply *reply = malloc(sizeof(struct sim_reply) + length);
+    if (reply == NULL) {
+        // Nowhere to hold it, so the reply is lost as if the FIFO overran.
+        sim->overrun = 1;
+        sim->stats.overrun_bytes += length;
+        return;
+    }
+    reply->next = NULL;
+    reply->ready_ns = sim_now_ns() + sim->config.latency_us * 1000ULL;
+    reply->length = length;
+    memcpy(reply->data, data, length);
+    *sim->replies_tail = reply;
+    sim->replies_tail = &reply->next;
+}
+
+// Move replies whose latency has expired into the FIFO, as long as they fit.
+static void release_replies(struct ice9_sim *sim, uint64_t now) {
+    while ((sim->replies != NULL) && (sim->replies->ready_ns <= now) &&
+           (fifo_used(sim) + sim->replies->length <= sim->fifo_size)) {
+        struct sim_reply *reply = sim->replies;
+        fifo_push(sim, reply->data, reply->length);
+        sim->replies = reply->next;
+        if (sim->replies == NULL) {
+            sim->replies_tail = &sim->replies;
+        }
+        free(reply);
+    }
+}
+
+// With events on, a data word that looks like an event header is escaped.
+// Returns the number of bytes written to out (2 or 4).
+static int frame_word(struct ice9_sim *sim, uint16_t word, uint8_t *out) {
+    int n = 0;
+    if ((sim->events || (sim->num_channels > 0)) && ((word >> 8) == SIM_EVENT_WORD)) {
+        out[n++] = SIM_EVENT_ESCAPE;
+        out[n++] = SIM_EVENT_WORD;
+    }
+    out[n++] = word & 0xFF;
+    out[n++] = word >> 8;
+    return n;
+}
+
+// Top the FIFO up with stream data produced since the last call.  Whatever
+// the FPGA produced that did not fit is lost and flagged as an overrun.
+static void generate_stream(struct ice9_sim *sim, uint64_t now) {
+    if (!sim->streaming) {
+        return;
+    }
+    int space = sim->config.fifo_depth - fifo_used(sim);
+    if (space < 0) {
+        space = 0;
+    }
+    int produce;
+    if (sim->config.stream_rate <= 0) {
+        produce = space;
+    } else {
+        sim->stream_budget += sim->config.stream_rate * (now - sim->stream_last_ns) * 1e-9;
+        sim->stream_last_ns = now;
+        int whole_words = (int)(sim->stream_budget / 2);
+        sim->stream_budget -= whole_words * 2;
+        produce = whole_words * 2;
+        if (produce > space) {
+            sim->stats.overrun_bytes += produce - space;
+            sim->overrun = 1;
+            produce = space;
+        }
+    }
+    produce &= ~1;
+    // Each channel's data goes out as frames of up to SIM_FRAME_WORDS, and
+    // the frame headers take their share of the FIFO.
+    while ((sim->num_channels > 0) && (produce > 4)) {
+        uint8_t address = sim->channels[sim->next_channel];
+        sim->next_channel = (sim->next_channel + 1) % sim->num_channels;
+        int words = ((produce - 4) / 2 < SIM_FRAME_WORDS) ? (produce - 4) / 2 : SIM_FRAME_WORDS;
+        uint8_t header[4] = { SIM_EVENT_FRAME, SIM_EVENT_WORD, address, words };
+        fifo_push(sim, header, sizeof(header));
+        for (int i = 0; i < words; i++) {
+            uint16_t value = sim->channel_counter[address]++;
+            uint8_t word[2] = { value & 0xFF, value >> 8 };
+            fifo_push(sim, word, 2);
+        }
+        sim->stats.stream_bytes += words * 2;
+        produce -= 4 + words * 2;
+    }
+    if (sim->num_channels > 0) {
+        // Too little for a frame; it goes in the next one.
+        if (sim->config.stream_rate > 0) {
+            sim->stream_budget += produce;
+        }
+        return;
+    }
+    sim->stats.stream_bytes += produce;
+    for (int i = 0; i < produce; i += 2) {
+        uint8_t word[4];
+        fifo_push(sim, word, frame_word(sim, sim->stream_counter, word));
+        sim->stream_counter++;
+    }
+}
+
+static void start_streaming(struct ice9_sim *sim) {
+    sim->streaming = 1;
+    sim->stream_last_ns = sim_now_ns();
+    sim->stream_budget = 0;
+}
+
+static void process_word(struct ice9_sim *sim, uint16_t word) {
+    switch (sim->state) {
+        case PARSE_COMMAND:
+            sim->stats.commands++;
+            if (word == 0xFFFF) {
+                sim->streaming = 0;
+                if (sim->num_channels > 0) {
+                    // A frame of no words marks the end of the framed data.
+                    uint8_t end[4] = { SIM_EVENT_FRAME, SIM_EVENT_WORD, 0, 0 };
+                    push_reply(sim, end, sizeof(end));
+                    sim->num_channels = 0;
+                    sim->next_channel = 0;
+                }
+            } else if ((word >> 8) == 0x01) {
+                uint8_t reply[2] = { word & 0xFF, word >> 8 };
+                push_reply(sim, reply, 2);
+            } else if ((word >> 8) == 0x02) {
+                sim->address = word & 0xFF;
+                sim->state = PARSE_READ_LENGTH;
+            } else if ((word >> 8) == 0x03) {
+                sim->address = word & 0xFF;
+                sim->state = PARSE_WRITE_LENGTH;
+            } else if ((word >> 8) == 0x05) {
+                sim->address = word & 0xFF;
+                start_streaming(sim);
+            } else if ((word >> 8) == 0x06) {
+                sim->events = word & 0x01;
+            } else if ((word >> 8) == 0x07) {
+                int known = 0;
+                for (int i = 0; i < sim->num_channels; i++) {
+                    known |= sim->channels[i] == (word & 0xFF);
+                }
+                if (!known) {
+                    sim->channels[sim->num_channels++] = word & 0xFF;
+                }
+                if (!sim->streaming) {
+                    start_streaming(sim);
+                }
+            }
+            break;
+        case PARSE_READ_LENGTH: {
+            // Queued in pieces, which keep their order, so a long read needs
+            // no allocation here.
+            uint8_t reply[1024];
+            int length = 0;
+            for (int i = 0; i < word; i++) {
+                length += frame_word(sim, sim->registers[sim->address][i % ICE9_SIM_REGISTER_WORDS], reply + length);
+                if (length > (int) sizeof(reply) - 4) {
+                    push_reply(sim, reply, length);
+                    length = 0;
+                }
+            }
+            if (length > 0) {
+                push_reply(sim, reply, length);
+            }
+            sim->state = PARSE_COMMAND;
+            break;
+        }
+        case PARSE_WRITE_LENGTH:
+            sim->words_remaining = word;
+            sim->word_index = 0;
+            sim->state = word ? PARSE_WRITE_DATA : PARSE_COMMAND;
+            break;
+        case PARSE_WRITE_DATA:
+            sim->registers[sim->address][(sim->word_index++) % ICE9_SIM_REGISTER_WORDS] = word;
+            if (--sim->words_remaining == 0) {
+                sim->state = PARSE_COMMAND;
+            }
+            break;
+    }
+}
+
+struct ice9_sim *ice9_sim_new(const struct ice9_sim_config *config) {
+    struct ice9_sim *sim = calloc(1, sizeof(struct ice9_sim));
+    if (sim == NULL) {
+        return NULL;
+    }
+    if (config != NULL) {
+        sim->config = *config;
+    }
+    if (sim->config.fifo_depth <= 0) {
+        sim->config.fifo_depth = 4096;
+    }
+    if (sim->config.latency_timer_ms <= 0) {
+        sim->config.latency_timer_ms = 1;
+    }
+    sim->fifo_size = sim->config.fifo_depth + SIM_REPLY_SLACK;
+    sim->fifo = malloc(sim->fifo_size);
+    if (sim->fifo == NULL) {
+        free(sim);
+        return NULL;
+    }
+    sim->replies_tail = &sim->replies;
+    pthread_mutex_init(&sim->lock, NULL);
+    return sim;
+}
+
+void ice9_sim_free(struct ice9_sim *sim) {
+    if (sim == NULL) {
+        return;
+    }
+    while (sim->replies != NULL) {
+        struct sim_reply *next = sim->replies->next;
+        free(sim->replies);
+        sim->replies = next;
+    }
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->fifo);
+    free(sim);
+}
+
+// A USB 2.0 bus carries one direction at a time, so OUT transfers share
+// link_bandwidth with IN ones.  Register writes are a few bytes each, far
+// shorter than a sleep can be, so their link time is booked and the writer
+// only waits once it is more than SIM_OUT_SLACK_NS ahead of the link.
+enum Ice9Error ice9_sim_bulk_out(struct ice9_sim *sim, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    pthread_mutex_lock(&sim->lock);
+    if (sim->config.link_bandwidth > 0) {
+        uint64_t now = sim_now_ns();
+        uint64_t start = (sim->link_free_ns > now) ? sim->link_free_ns : now;
+        sim->link_free_ns = start + (uint64_t)(length * 1e9 / sim->config.link_bandwidth);
+        if (sim->link_free_ns > now + SIM_OUT_SLACK_NS) {
+            uint64_t done_ns = sim->link_free_ns;
+            pthread_mutex_unlock(&sim->lock);
+            sim_sleep_until(done_ns);
+            pthread_mutex_lock(&sim->lock);
+        }
+    }
+    for (int i = 0; i < length; i++) {
+        if (!sim->have_low_byte) {
+            sim->low_byte = data[i];
+            sim->have_low_byte = 1;
+        } else {
+            sim->have_low_byte = 0;
+            process_word(sim, sim->low_byte | (data[i] << 8));
+        }
+    }
+    sim->stats.bytes_out += length;
+    pthread_mutex_unlock(&sim->lock);
+    *transferred = length;
+    return OK;
+}
+
+// Work out how long the packet being filled should wait for more data.  Like
+// the FTDI part, a packet goes out when it is full or when the latency timer
+// expires; replies to commands are sent as soon as they are complete.
+static uint64_t packet_wait_until(struct ice9_sim *sim, int room, uint64_t now, uint64_t deadline) {
+    int used = fifo_used(sim);
+    if (used >= room) {
+        return now;
+    }
+    uint64_t wake = deadline;
+    if ((sim->replies != NULL) && (sim->replies->ready_ns < wake)) {
+        wake = sim->replies->ready_ns;
+    }
+    if (sim->streaming && (sim->config.stream_rate > 0)) {
+        uint64_t full = now + (uint64_t)((room - used) * 1e9 / sim->config.stream_rate);
+        if (full < wake) {
+            wake = full;
+        }
+    } else if (used > 0) {
+        return now;
+    }
+    return wake;
+}
+
+enum Ice9Error ice9_sim_bulk_in(struct ice9_sim *sim, uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    *transferred = 0;
+    if (length < SIM_STATUS_BYTES) {
+        return LibUSBOverflow;
+    }
+    pthread_mutex_lock(&sim->lock);
+    uint64_t now = sim_now_ns();
+    uint64_t deadline = now + sim->config.latency_timer_ms * 1000000ULL;
+    int filled = 0;
+    while (length - filled >= SIM_STATUS_BYTES) {
+        int room = length - filled - SIM_STATUS_BYTES;
+        if (room > SIM_PAYLOAD_SIZE) {
+            room = SIM_PAYLOAD_SIZE;
+        }
+        release_replies(sim, now);
+        generate_stream(sim, now);
+        uint64_t wake = packet_wait_until(sim, room, now, deadline);
+        if (wake > now) {
+            // The lock is dropped while waiting so that commands can still be written.
+            pthread_mutex_unlock(&sim->lock);
+            sim_sleep_until(wake);
+            pthread_mutex_lock(&sim->lock);
+            now = sim_now_ns();
+            if (now < deadline) {
+                continue;
+            }
+            release_replies(sim, now);
+            generate_stream(sim, now);
+        }
+        int payload = fifo_used(sim);
+        if (payload > room) {
+            payload = room;
+        }
+        // Only an empty first packet is sent; later ones would just end the transfer.
+        if ((payload == 0) && (filled > 0)) {
+            break;
+        }
+        data[filled] = SIM_MODEM_STATUS;
+        data[filled + 1] = SIM_LINE_STATUS | (sim->overrun ? SIM_LINE_OVERRUN : 0);
+        sim->overrun = 0;
+        for (int i = 0; i < payload; i++) {
+            data[filled + SIM_STATUS_BYTES + i] = sim->fifo[(sim->fifo_tail++) % sim->fifo_size];
+        }
+        filled += SIM_STATUS_BYTES + payload;
+        // A short packet ends the transfer.
+        if (payload < SIM_PAYLOAD_SIZE) {
+            break;
+        }
+        deadline = now + sim->config.latency_timer_ms * 1000000ULL;
+    }
+    sim->stats.bytes_in += filled;
+    uint64_t done_ns = 0;
+    if (sim->config.link_bandwidth > 0) {
+        uint64_t start = (sim->link_free_ns > now) ? sim->link_free_ns : now;
+        sim->link_free_ns = start + (uint64_t)(filled * 1e9 / sim->config.link_bandwidth);
+        done_ns = sim->link_free_ns;
+    }
+    pthread_mutex_unlock(&sim->lock);
+    sim_sleep_until(done_ns);
+    *transferred = filled;
+    return OK;
+}
+
+enum Ice9Error ice9_sim_control(struct ice9_sim *sim, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index) {
+    pthread_mutex_lock(&sim->lock);
+    // FTDI SIO_RESET: 0 resets the port, 1 purges the RX (device to host)
+    // side and 2 purges TX.  Bitmode and latency requests need no modelling.
+    if (request == 0) {
+        if ((value == 0) || (value == 1)) {
+            sim->fifo_tail = sim->fifo_head;
+            sim->overrun = 0;
+        }
+        if ((value == 0) || (value == 2)) {
+            sim->state = PARSE_COMMAND;
+            sim->have_low_byte = 0;
+        }
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return OK;
+}
+
+void ice9_sim_set_register(struct ice9_sim *sim, uint8_t address, const uint16_t *data, int len) {
+    pthread_mutex_lock(&sim->lock);
+    for (int i = 0; i < len; i++) {
+        sim->registers[address][i % ICE9_SIM_REGISTER_WORDS] = data[i];
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void ice9_sim_get_register(struct ice9_sim *sim, uint8_t address, uint16_t *data, int len) {
+    pthread_mutex_lock(&sim->lock);
+    for (int i = 0; i < len; i++) {
+        data[i] = sim->registers[address][i % ICE9_SIM_REGISTER_WORDS];
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void ice9_sim_raise_event(struct ice9_sim *sim, uint8_t event, uint16_t payload) {
+    pthread_mutex_lock(&sim->lock);
+    if (sim->events && (event < SIM_EVENT_FRAME)) {
+        uint8_t frame[4] = { event, SIM_EVENT_WORD, payload & 0xFF, payload >> 8 };
+        push_reply(sim, frame, sizeof(frame));
+        sim->stats.events++;
+    }
+    pthread_mutex_unlock(&sim->lock);
+}
+
+void ice9_sim_get_stats(struct ice9_sim *sim, struct ice9_sim_stats *stats) {
+    pthread_mutex_lock(&sim->lock);
+    *stats = sim->stats;
+    pthread_mutex_unlock(&sim->lock);
+}
+
+// Transport glue, so that a handle can be pointed at the simulator.
+
+struct sim_transport {
+    struct ice9_transport transport;
+    struct ice9_sim *sim;
+};
+
+static enum Ice9Error sim_open(void *context) {
+    return OK;
+}
+
+static void sim_close(void *context) {
+}
+
+static enum Ice9Error sim_submit_out(void *context, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    return ice9_sim_bulk_out(((struct sim_transport *) context)->sim, data, length, transferred, timeout_ms);
+}
+
+static enum Ice9Error sim_submit_in(void *context, uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    return ice9_sim_bulk_in(((struct sim_transport *) context)->sim, data, length, transferred, timeout_ms);
+}
+
+static enum Ice9Error sim_control(void *context, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned int timeout_ms) {
+    return ice9_sim_control(((struct sim_transport *) context)->sim, request_type, request, value, index);
+}
+
+static void sim_destroy(void *context) {
+    free(context);
+}
+
+static const struct ice9_transport_ops sim_ops = {
+    .open = sim_open,
+    .close = sim_close,
+    .submit_out = sim_submit_out,
+    .submit_in = sim_submit_in,
+    .control = sim_control,
+    .handle_events = NULL,
+    .destroy = sim_destroy,
+};
+
+struct ice9_transport *ice9_sim_transport_new(struct ice9_sim *sim) {
+    struct sim_transport *transport = calloc(1, sizeof(struct sim_transport));
+    if (transport == NULL) {
+        return NULL;
+    }
+    transport->transport.ops = &sim_ops;
+    transport->transport.context = transport;
+    transport->sim = sim;
+    return &transport->transport;
+}
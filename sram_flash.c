@@ -39,6 +39,7 @@
 #include "logger.h"
 #include "mpsse.h"
 #include "ice9.h"
+#include "trace.h"
 
 enum device_type {
 	TYPE_NONE = 0,
@@ -219,9 +220,11 @@ static void sram_prepare()
 
 static void sram_read_status()
 {
+    uint64_t span = ice9_trace_begin();
     sram_chip_select();
     send_byte_command(LSC_READ_STATUS);
     uint32_t idcode = read_word_reply();
+    ice9_trace_end(span, "flash", "status", "status", idcode);
     print_ecp5_status_register(idcode);
     sram_chip_deselect();
 }
@@ -234,9 +237,11 @@ static void sram_bitstream_burst()
 
 static void sram_read_id()
 {
+    uint64_t span = ice9_trace_begin();
     sram_chip_select();
     send_byte_command(READ_ID);
     uint32_t idcode = read_word_reply();
+    ice9_trace_end(span, "flash", "read_id", "idcode", idcode);
     print_idcode(idcode);
     sram_chip_deselect();
 }
@@ -272,8 +277,10 @@ enum Ice9Error ice9_flash_fpga(const char *filename) {
     
     LOG_INFO("ice9 reset..\n");
     
+    uint64_t span = ice9_trace_begin();
     sram_reset();
     usleep(100);
+    ice9_trace_end(span, "flash", "reset", NULL, 0);
         
     LOG_INFO("ice9 cdone: %s\n", get_cdone() ? "high" : "low");
 
@@ -282,6 +289,8 @@ enum Ice9Error ice9_flash_fpga(const char *filename) {
     sram_read_status(); 
     sram_prepare();
     sram_read_status();
+    span = ice9_trace_begin();
+    int64_t burst_bytes = 0;
     sram_bitstream_burst();
     while (1) {
         const uint32_t len = 16*1024;
@@ -289,10 +298,12 @@ enum Ice9Error ice9_flash_fpga(const char *filename) {
         int rc = fread(buffer, 1, len, f);
         if (rc <= 0) break;
         if (verbose)
-            LOG_INFO("ice9 sending %d bytes.\n", rc);
+            LOG_DEBUG("ice9 sending %d bytes.\n", rc);
         mpsse_send_spi(buffer, rc);
+        burst_bytes += rc;
     }
     sram_chip_deselect();
+    ice9_trace_end(span, "flash", "burst", "bytes", burst_bytes);
     sram_read_status();
     sram_chip_select();
     send_byte_command(ISC_DISABLE);
@@ -316,8 +327,10 @@ enum Ice9Error ice9_flash_fpga_mem(void *buf, int bufsize) {
 
     LOG_INFO("ice9 reset..\n");
 
+    uint64_t span = ice9_trace_begin();
     sram_reset();
     usleep(100);
+    ice9_trace_end(span, "flash", "reset", NULL, 0);
 
     LOG_INFO("ice9 cdone: %s\n", get_cdone() ? "high" : "low");
 
@@ -326,16 +339,19 @@ enum Ice9Error ice9_flash_fpga_mem(void *buf, int bufsize) {
     sram_read_status();
     sram_prepare();
     sram_read_status();
+    span = ice9_trace_begin();
+    int64_t burst_bytes = bufsize;
     sram_bitstream_burst();
     while (bufsize) {
         const int len = (bufsize < 16*1024) ? bufsize : 16*1024;
         if (verbose)
-            LOG_INFO("Sending %d bytes to Ice9\n", len);
+            LOG_DEBUG("Sending %d bytes to Ice9\n", len);
         mpsse_send_spi(buf, len);
         buf += len;
         bufsize -= len;
     }
     sram_chip_deselect();
+    ice9_trace_end(span, "flash", "burst", "bytes", burst_bytes);
     sram_read_status();
     sram_chip_select();
     send_byte_command(ISC_DISABLE);
@@ -0,0 +1,49 @@
+#include "test_common.h"
+#include "ice9_transport.h"
+
+int test_failures;
+
+int test_open(struct test_device *device, const struct ice9_sim_config *sim_config, struct ice9_config *config) {
+    struct ice9_config defaults = {0};
+    if (config == NULL) {
+        config = &defaults;
+    }
+    device->sim = ice9_sim_new(sim_config);
+    if (device->sim == NULL) {
+        fprintf(stderr, "unable to create simulated device\n");
+        return -1;
+    }
+    config->transport = ice9_sim_transport_new(device->sim);
+    device->hnd = ice9_new_with_config(config);
+    if (device->hnd == NULL) {
+        fprintf(stderr, "unable to create handle\n");
+        ice9_sim_free(device->sim);
+        return -1;
+    }
+    enum Ice9Error ret = ice9_open(device->hnd);
+    if (ret != OK) {
+        fprintf(stderr, "unable to open simulated device: %s\n", ice9_error_string(ret));
+        test_close(device);
+        return -1;
+    }
+    return 0;
+}
+
+void test_close(struct test_device *device) {
+    ice9_close(device->hnd);
+    ice9_free(device->hnd);
+    ice9_sim_free(device->sim);
+    device->hnd = NULL;
+    device->sim = NULL;
+}
+
+void test_run(const char *name, void (*fn)(void)) {
+    int before = test_failures;
+    fn();
+    printf("%s %s\n", (test_failures == before) ? "PASS" : "FAIL", name);
+    fflush(stdout);
+}
+
+int test_result(void) {
+    return (test_failures == 0) ? 0 : 1;
+}
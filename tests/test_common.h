@@ -0,0 +1,51 @@
+#ifndef _ICE9_TEST_COMMON_H_
+#define _ICE9_TEST_COMMON_H_
+
+#include <stdio.h>
+
+#include "ice9.h"
+#include "ice9_sim.h"
+
+// Checks count failures rather than stopping, so one run reports everything
+// that is wrong.  A test program returns test_result() from main.
+extern int test_failures;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                         \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_ERROR(expr, expected)                                                                \
+    do {                                                                                           \
+        enum Ice9Error ret_ = (expr);                                                              \
+        if (ret_ != (expected)) {                                                                  \
+            fprintf(stderr, "%s:%d: %s gave \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #expr, \
+                    ice9_error_string(ret_), ice9_error_string(expected));                         \
+            test_failures++;                                                                       \
+        }                                                                                          \
+    } while (0)
+
+#define CHECK_OK(expr) CHECK_ERROR(expr, OK)
+
+// A handle opened on a simulated device.  The config may be NULL, and its
+// transport is set to the simulator's.
+struct test_device {
+    struct ice9_sim *sim;
+    struct ice9_handle *hnd;
+};
+
+int test_open(struct test_device *device, const struct ice9_sim_config *sim_config, struct ice9_config *config);
+
+void test_close(struct test_device *device);
+
+// Run one test function, reporting its name and whether it passed.
+#define RUN_TEST(fn) test_run(#fn, fn)
+
+void test_run(const char *name, void (*fn)(void));
+
+int test_result(void);
+
+#endif  // _ICE9_TEST_COMMON_H_
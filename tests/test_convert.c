@@ -0,0 +1,131 @@
+// Sample conversion: the vector kernels picked for this CPU against the
+// conversion as documented, then converted reads from the simulator.
+
+#include <stdlib.h>
+
+#include "convert.h"
+#include "test_common.h"
+
+// One sample, done the slow way from the description in ice9.h.
+static float reference(const struct ice9_sample_format *format, const uint8_t *src) {
+    uint32_t value;
+    if (format->sample_bits == 16) {
+        value = (format->flags & ICE9_BYTESWAP) ? (src[0] << 8) | src[1] : src[0] | (src[1] << 8);
+    } else {
+        uint32_t high = src[0] | (src[1] << 8);
+        uint32_t low = src[2] | (src[3] << 8);
+        value = (high << 16) | low;
+        if (format->flags & ICE9_BYTESWAP) {
+            value = __builtin_bswap32(value);
+        }
+    }
+    int bits = format->sign_bits ? format->sign_bits : format->sample_bits;
+    int64_t sample = value & ((1ULL << bits) - 1);
+    if (sample & (1LL << (bits - 1))) {
+        sample -= 1LL << bits;
+    }
+    // Kept apart so the compiler cannot fuse them.
+    volatile float scaled = (float) sample * format->scale;
+    return scaled + format->offset;
+}
+
+static void test_kernels(void) {
+    static uint8_t src[4 * 200 + 8];
+    static float dst[200 + 8];
+    for (int i = 0; i < (int) sizeof(src); i++) {
+        src[i] = (uint8_t) rand();
+    }
+    printf("kernels: %s\n", ice9_convert_isa());
+    static const int sample_bits[2] = { 16, 32 };
+    int bad = 0;
+    for (int b = 0; b < 2; b++) {
+        int size = sample_bits[b] / 8;
+        for (int flags = 0; flags <= ICE9_BYTESWAP; flags++) {
+            for (int sign_bits = 0; sign_bits <= sample_bits[b]; sign_bits += (sign_bits < 2) ? 1 : 5) {
+                struct ice9_sample_format format = { sample_bits[b], sign_bits, flags, 0.37f, -1.5f };
+                struct ice9_conversion conversion;
+                CHECK_OK(ice9_conversion_init(&conversion, &format));
+                // Counts either side of every vector width, at every alignment.
+                for (int count = 0; count <= 200; count += (count < 40) ? 1 : 23) {
+                    for (int align = 0; align < 4; align++) {
+                        ice9_convert_samples(&conversion, src + align, dst + align, count);
+                        for (int i = 0; i < count; i++) {
+                            if (dst[align + i] != reference(&format, src + align + i * size)) {
+                                bad++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    CHECK(bad == 0);
+
+    struct ice9_sample_format format = { 24, 0, 0, 1, 0 };
+    struct ice9_conversion conversion;
+    CHECK_ERROR(ice9_conversion_init(&conversion, &format), BadSampleFormat);
+    format = (struct ice9_sample_format) { 16, 17, 0, 1, 0 };
+    CHECK_ERROR(ice9_conversion_init(&conversion, &format), BadSampleFormat);
+}
+
+// Samples split across calls are held until the rest arrives.
+static void test_split_samples(void) {
+    static uint8_t src[4 * 1000];
+    static float dst[1000];
+    for (int i = 0; i < (int) sizeof(src); i++) {
+        src[i] = (uint8_t) rand();
+    }
+    struct ice9_sample_format format = { 32, 0, 0, 1, 0 };
+    struct ice9_conversion conversion;
+    CHECK_OK(ice9_conversion_init(&conversion, &format));
+    struct ice9_sample_dest dest;
+    ice9_sample_dest_init(&dest, &conversion, dst, 1000);
+    int offset = 0;
+    while (ice9_sample_dest_wanted(&dest) > 0) {
+        offset += ice9_sample_dest_fill(&dest, src + offset, 1 + rand() % 13);
+    }
+    CHECK(offset == (int) sizeof(src));
+    int bad = 0;
+    for (int i = 0; i < 1000; i++) {
+        if (dst[i] != reference(&format, src + 4 * i)) {
+            bad++;
+        }
+    }
+    CHECK(bad == 0);
+}
+
+static void test_stream_samples(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    static float samples[100000];
+    uint8_t word[2];
+    struct ice9_sample_format format = { 16, 0, 0, 1, 0 };
+    CHECK_OK(ice9_enable_streaming(device.hnd, 1));
+    // Converted and byte reads can be mixed.
+    CHECK_OK(ice9_stream_read_samples(device.hnd, &format, samples, 5));
+    CHECK_OK(ice9_stream_read(device.hnd, word, 2));
+    CHECK_OK(ice9_stream_read_samples(device.hnd, &format, samples + 5, 99995));
+    CHECK_OK(ice9_disable_streaming(device.hnd));
+
+    uint16_t first = (uint16_t) (int16_t) samples[0];
+    CHECK((uint16_t) (word[0] | (word[1] << 8)) == (uint16_t) (first + 5));
+    int bad = 0;
+    for (int i = 1; i < 100000; i++) {
+        int16_t expect = (int16_t) (uint16_t) (first + i + (i >= 5));
+        if (samples[i] != (float) expect) {
+            bad++;
+        }
+    }
+    CHECK(bad == 0);
+    test_close(&device);
+}
+
+int main(void) {
+    RUN_TEST(test_kernels);
+    RUN_TEST(test_split_samples);
+    RUN_TEST(test_stream_samples);
+    return test_result();
+}
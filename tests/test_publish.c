@@ -0,0 +1,126 @@
+// Publishing a stream to subscribers through shared memory: delivery, a
+// subscriber being lapped, and the publisher going away.
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+static void fill(uint8_t *data, int num_bytes, uint8_t first) {
+    for (int i = 0; i < num_bytes; i++) {
+        data[i] = (uint8_t) (first + i);
+    }
+}
+
+static int matches(const uint8_t *data, int num_bytes, uint8_t first) {
+    for (int i = 0; i < num_bytes; i++) {
+        if (data[i] != (uint8_t) (first + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_lapping(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "ice9_test_lap_%d", (int) getpid());
+    struct ice9_publisher *publisher = ice9_publisher_new(name, 4096, 2);
+    CHECK(publisher != NULL);
+    if (publisher == NULL) {
+        return;
+    }
+    struct ice9_subscriber *subscriber = ice9_subscribe(name);
+    CHECK(subscriber != NULL);
+    if (subscriber == NULL) {
+        ice9_publisher_free(publisher);
+        return;
+    }
+    static uint8_t data[3 * 4096];
+    static uint8_t read[3 * 4096];
+    const uint8_t *in_place;
+    int available;
+    CHECK_ERROR(ice9_subscriber_peek(subscriber, &in_place, &available, 0), NoDataAvailable);
+
+    // Keeping up.
+    fill(data, 1000, 0);
+    CHECK_OK(ice9_publish(publisher, data, 1000));
+    CHECK_OK(ice9_subscriber_read(subscriber, read, 1000, 100));
+    CHECK(matches(read, 1000, 0));
+
+    // Three rings behind: the subscriber is told, and skips to the newest data.
+    fill(data, sizeof(data), 1);
+    CHECK_OK(ice9_publish(publisher, data, sizeof(data)));
+    CHECK_ERROR(ice9_subscriber_peek(subscriber, &in_place, &available, 0), SubscriberLapped);
+    fill(data, 100, 2);
+    CHECK_OK(ice9_publish(publisher, data, 100));
+    CHECK_OK(ice9_subscriber_peek(subscriber, &in_place, &available, 100));
+    CHECK(available == 100);
+    CHECK(matches(in_place, available, 2));
+    CHECK_OK(ice9_subscriber_release(subscriber, available));
+
+    // Data overwritten while it is being read in place.
+    fill(data, 100, 3);
+    CHECK_OK(ice9_publish(publisher, data, 100));
+    CHECK_OK(ice9_subscriber_peek(subscriber, &in_place, &available, 100));
+    CHECK(available == 100);
+    fill(data, 4096, 4);
+    CHECK_OK(ice9_publish(publisher, data, 4096));
+    CHECK_ERROR(ice9_subscriber_release(subscriber, available), SubscriberLapped);
+
+    struct ice9_subscriber_stats stats;
+    CHECK_OK(ice9_subscriber_get_stats(subscriber, &stats));
+    CHECK(stats.laps == 2);
+    CHECK(stats.bytes_lapped > 0);
+
+    // What is left is read after the publisher has gone, then NoDataAvailable.
+    fill(data, 10, 5);
+    CHECK_OK(ice9_publish(publisher, data, 10));
+    ice9_publisher_free(publisher);
+    CHECK_OK(ice9_subscriber_read(subscriber, read, 10, 100));
+    CHECK(matches(read, 10, 5));
+    CHECK_ERROR(ice9_subscriber_peek(subscriber, &in_place, &available, 100), NoDataAvailable);
+    ice9_unsubscribe(subscriber);
+}
+
+static void test_publisher_gone(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "ice9_test_gone_%d", (int) getpid());
+    struct ice9_subscriber *subscriber = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Exit without ice9_publisher_free, as a crashed publisher would.
+        struct ice9_publisher *publisher = ice9_publisher_new(name, 4096, 2);
+        if (publisher == NULL) {
+            _exit(1);
+        }
+        usleep(200000);
+        _exit(0);
+    }
+    CHECK(pid > 0);
+    for (int i = 0; (i < 100) && (subscriber == NULL); i++) {
+        usleep(10000);
+        subscriber = ice9_subscribe(name);
+    }
+    CHECK(subscriber != NULL);
+    int status;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    if (subscriber != NULL) {
+        const uint8_t *in_place;
+        int available;
+        CHECK_ERROR(ice9_subscriber_peek(subscriber, &in_place, &available, 2000), PublisherGone);
+        ice9_unsubscribe(subscriber);
+    }
+    // Nothing else removes the name of a publisher that died.
+    char path[80];
+    snprintf(path, sizeof(path), "/%s", name);
+    shm_unlink(path);
+}
+
+int main(void) {
+    RUN_TEST(test_lapping);
+    RUN_TEST(test_publisher_gone);
+    return test_result();
+}
@@ -0,0 +1,147 @@
+// Register access against the simulator: 32-bit arrays, waiting on a
+// register, and the shadow with write combining.
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+static void test_ints_round_trip(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    const uint32_t values[4] = { 0x11223344, 0xFFFF0000, 0x0000FFFF, 0x80000001 };
+    uint32_t read[4];
+    uint16_t words[8];
+
+    CHECK_OK(ice9_write_ints(device.hnd, 7, values, 4, 0));
+    // Most significant word first.
+    ice9_sim_get_register(device.sim, 7, words, 8);
+    CHECK(words[0] == 0x1122 && words[1] == 0x3344);
+    CHECK(words[6] == 0x8000 && words[7] == 0x0001);
+    CHECK_OK(ice9_read_ints(device.hnd, 7, read, 4, 0));
+    for (int i = 0; i < 4; i++) {
+        CHECK(read[i] == values[i]);
+    }
+
+    CHECK_OK(ice9_write_ints(device.hnd, 8, values, 4, ICE9_BYTESWAP));
+    ice9_sim_get_register(device.sim, 8, words, 2);
+    CHECK(words[0] == 0x4433 && words[1] == 0x2211);
+    CHECK_OK(ice9_read_ints(device.hnd, 8, read, 4, ICE9_BYTESWAP));
+    for (int i = 0; i < 4; i++) {
+        CHECK(read[i] == values[i]);
+    }
+    // And the single register calls agree with the array ones.
+    uint32_t value;
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 7, &value));
+    CHECK(value == values[0]);
+    test_close(&device);
+}
+
+static void *set_ready(void *arg) {
+    struct ice9_sim *sim = arg;
+    usleep(50000);
+    uint16_t words[2] = { 0x0000, 0x8001 };
+    ice9_sim_set_register(sim, 9, words, 2);
+    return NULL;
+}
+
+static void test_wait_register(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    CHECK_ERROR(ice9_wait_register(device.hnd, 9, 0x8000, 0x8000, 20), WaitTimedOut);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, set_ready, device.sim);
+    CHECK_OK(ice9_wait_register(device.hnd, 9, 0x8000, 0x8000, 2000));
+    pthread_join(thread, NULL);
+
+    // The reads left in flight must not be taken for later replies.
+    uint32_t value;
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 9, &value));
+    CHECK(value == 0x8001);
+    CHECK_OK(ice9_ping_bridge(device.hnd, 4));
+    test_close(&device);
+}
+
+static void test_shadow(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    struct ice9_stats stats;
+    uint32_t value;
+    CHECK_OK(ice9_set_register_policy(device.hnd, 1, ICE9_REGISTER_CACHEABLE));
+    CHECK_OK(ice9_set_register_policy(device.hnd, 2, ICE9_REGISTER_WRITE_ONLY));
+    CHECK_ERROR(ice9_read_int_from_address(device.hnd, 2, &value), RegisterNotReadable);
+
+    CHECK_OK(ice9_write_int_to_address(device.hnd, 1, 5));
+    CHECK_OK(ice9_write_int_to_address(device.hnd, 1, 5));
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 1, &value));
+    CHECK(value == 5);
+    CHECK_OK(ice9_get_stats(device.hnd, &stats));
+    CHECK(stats.register_writes_elided == 1);
+    CHECK(stats.register_reads_cached == 1);
+
+    // A change made behind the handle's back is only seen once invalidated.
+    uint16_t words[2] = { 0, 6 };
+    ice9_sim_set_register(device.sim, 1, words, 2);
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 1, &value));
+    CHECK(value == 5);
+    CHECK_OK(ice9_invalidate_registers(device.hnd));
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 1, &value));
+    CHECK(value == 6);
+    test_close(&device);
+}
+
+static void test_write_combining(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    struct ice9_stats stats;
+    uint16_t words[2];
+    uint32_t value;
+    CHECK_OK(ice9_set_register_policy(device.hnd, 1, ICE9_REGISTER_CACHEABLE));
+    CHECK_OK(ice9_set_register_policy(device.hnd, 2, ICE9_REGISTER_WRITE_ONLY));
+    CHECK_OK(ice9_set_write_combining(device.hnd, 1));
+    for (int i = 0; i < 10; i++) {
+        CHECK_OK(ice9_write_int_to_address(device.hnd, 1, 100 + i));
+    }
+    CHECK_OK(ice9_write_int_to_address(device.hnd, 2, 7));
+
+    // Nothing has reached the device yet.
+    ice9_sim_get_register(device.sim, 1, words, 2);
+    CHECK(words[1] != 109);
+    CHECK_OK(ice9_flush_registers(device.hnd));
+    ice9_sim_get_register(device.sim, 1, words, 2);
+    CHECK(words[0] == 0 && words[1] == 109);
+    ice9_sim_get_register(device.sim, 2, words, 2);
+    CHECK(words[0] == 0 && words[1] == 7);
+    CHECK_OK(ice9_get_stats(device.hnd, &stats));
+    CHECK(stats.register_writes_combined == 9);
+
+    // A held write goes out before any other access.
+    CHECK_OK(ice9_write_int_to_address(device.hnd, 1, 200));
+    CHECK_OK(ice9_set_register_policy(device.hnd, 1, ICE9_REGISTER_VOLATILE));
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 1, &value));
+    CHECK(value == 200);
+    CHECK_OK(ice9_read_int_from_address(device.hnd, 2, &value));
+    CHECK(value == 7);
+    test_close(&device);
+}
+
+int main(void) {
+    RUN_TEST(test_ints_round_trip);
+    RUN_TEST(test_wait_register);
+    RUN_TEST(test_shadow);
+    RUN_TEST(test_write_combining);
+    return test_result();
+}
@@ -0,0 +1,273 @@
+// The IN side against the simulator: events and the escaping that comes
+// with them, multi-channel streaming, pipeline ordering, and recording a
+// session and playing it back.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ice9_transport.h"
+#include "test_common.h"
+
+struct events {
+    int count;
+    uint8_t last_event;
+    uint16_t last_payload;
+};
+
+static void on_event(void *userdata, uint8_t event, uint16_t payload) {
+    struct events *events = userdata;
+    events->count++;
+    events->last_event = event;
+    events->last_payload = payload;
+}
+
+static void test_events(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    struct events events = {0};
+    CHECK_OK(ice9_set_event_callback(device.hnd, on_event, &events));
+    CHECK_OK(ice9_enable_events(device.hnd, 1));
+
+    // An event ahead of a reply is split out of it, and a reply word that
+    // looks like an event is escaped.
+    uint16_t word = 0x0E42;
+    CHECK_OK(ice9_write_data_to_address(device.hnd, 5, &word, 1));
+    ice9_sim_raise_event(device.sim, 3, 0x1234);
+    word = 0;
+    CHECK_OK(ice9_read_data_from_address(device.hnd, 5, &word, 1));
+    CHECK(word == 0x0E42);
+    CHECK(events.count == 1 && events.last_event == 3 && events.last_payload == 0x1234);
+
+    ice9_sim_raise_event(device.sim, 0x0E, 0x0EFF);
+    CHECK_OK(ice9_poll_events(device.hnd));
+    CHECK(events.count == 2 && events.last_event == 0x0E && events.last_payload == 0x0EFF);
+
+    // The stream counter passes through 0x0E00-0x0EFF, all of it escaped,
+    // with events raised in between.
+    static uint16_t data[0x8000];
+    CHECK_OK(ice9_enable_streaming(device.hnd, 1));
+    int bad = 0;
+    int have = 0;
+    uint16_t expect = 0;
+    for (int k = 0; k < 4; k++) {
+        ice9_sim_raise_event(device.sim, 7, k);
+        CHECK_OK(ice9_stream_read(device.hnd, (uint8_t *) data, sizeof(data)));
+        for (int i = 0; i < (int) (sizeof(data) / 2); i++) {
+            if (have && (data[i] != expect)) {
+                bad++;
+            }
+            have = 1;
+            expect = data[i] + 1;
+        }
+    }
+    CHECK_OK(ice9_disable_streaming(device.hnd));
+    CHECK(bad == 0);
+    CHECK(events.count == 6 && events.last_event == 7 && events.last_payload == 3);
+
+    struct ice9_stats stats;
+    CHECK_OK(ice9_get_stats(device.hnd, &stats));
+    CHECK(stats.events == 6);
+    CHECK(stats.frame_errors == 0);
+    test_close(&device);
+}
+
+static void test_channels(void) {
+    struct ice9_sim_config sim_config = { .stream_rate = 20e6 };
+    struct ice9_config config = { .ring_buffer_size = 4 << 20 };
+    struct test_device device;
+    if (test_open(&device, &sim_config, &config) != 0) {
+        test_failures++;
+        return;
+    }
+    struct events events = {0};
+    CHECK_OK(ice9_set_event_callback(device.hnd, on_event, &events));
+    CHECK_OK(ice9_enable_events(device.hnd, 1));
+    // 0x0E is also the escape byte.
+    const uint8_t addresses[3] = { 0x10, 0x11, 0x0E };
+    CHECK_OK(ice9_enable_channels(device.hnd, addresses, 3));
+
+    static uint16_t data[32768];
+    uint16_t expect[3] = {0};
+    int bad = 0;
+    for (int k = 0; k < 12; k++) {
+        int channel = k % 3;
+        int words = 1000 + k * 997;
+        ice9_sim_raise_event(device.sim, 3, k);
+        enum Ice9Error ret = ice9_channel_read(device.hnd, addresses[channel], (uint8_t *) data, words * 2);
+        CHECK_OK(ret);
+        if (ret != OK) {
+            break;
+        }
+        // Each channel has its own counter.
+        for (int i = 0; i < words; i++) {
+            if (data[i] != expect[channel]) {
+                bad++;
+            }
+            expect[channel] = data[i] + 1;
+        }
+    }
+    CHECK_OK(ice9_disable_streaming(device.hnd));
+    CHECK(bad == 0);
+    CHECK(events.count == 12);
+    CHECK_ERROR(ice9_channel_read(device.hnd, 0x20, (uint8_t *) data, 2), ChannelNotEnabled);
+
+    struct ice9_channel_stats stats;
+    CHECK_OK(ice9_get_channel_stats(device.hnd, 0x10, &stats));
+    CHECK(stats.bytes >= (uint64_t) (expect[0] * 2));
+    CHECK(stats.bytes_dropped == 0);
+
+    // Replies still reach the register reads once streaming has stopped.
+    uint16_t word = 0x0E42;
+    CHECK_OK(ice9_write_data_to_address(device.hnd, 5, &word, 1));
+    word = 0;
+    CHECK_OK(ice9_read_data_from_address(device.hnd, 5, &word, 1));
+    CHECK(word == 0x0E42);
+    test_close(&device);
+}
+
+// Pipeline stages and sink checking that the stream counter arrives whole
+// and in order.
+struct sequence {
+    int have;
+    uint16_t expect;
+    long words;
+    long bad;
+};
+
+static void check_sequence(struct sequence *sequence, const uint16_t *data, int words) {
+    for (int i = 0; i < words; i++) {
+        if (sequence->have && (data[i] != sequence->expect)) {
+            sequence->bad++;
+        }
+        sequence->have = 1;
+        sequence->expect = data[i] + 1;
+    }
+    sequence->words += words;
+}
+
+// Takes longer over some chunks than others, so the workers finish them
+// out of order.
+static int uneven_stage(void *context, const void *in, int in_bytes, void *out, int out_capacity) {
+    const uint16_t *words = in;
+    if ((words[0] & 0x1000) != 0) {
+        usleep(500);
+    }
+    memcpy(out, in, in_bytes);
+    return in_bytes;
+}
+
+static int ordered_stage(void *context, const void *in, int in_bytes, void *out, int out_capacity) {
+    check_sequence(context, in, in_bytes / 2);
+    memcpy(out, in, in_bytes);
+    return in_bytes;
+}
+
+static void sequence_sink(void *context, const void *data, int bytes) {
+    check_sequence(context, data, bytes / 2);
+}
+
+static void test_pipeline_order(void) {
+    struct test_device device;
+    if (test_open(&device, NULL, NULL) != 0) {
+        test_failures++;
+        return;
+    }
+    struct ice9_pipeline_config config = { .chunk_size = 4096, .workers = 4 };
+    struct ice9_pipeline *pipeline = ice9_pipeline_new(device.hnd, &config);
+    CHECK(pipeline != NULL);
+    if (pipeline == NULL) {
+        test_close(&device);
+        return;
+    }
+    struct sequence staged = {0};
+    struct sequence sunk = {0};
+    CHECK_OK(ice9_pipeline_add_stage(pipeline, uneven_stage, NULL, 0, 0));
+    CHECK_OK(ice9_pipeline_add_stage(pipeline, ordered_stage, &staged, 0, ICE9_STAGE_ORDERED));
+    CHECK_OK(ice9_pipeline_add_stage(pipeline, uneven_stage, NULL, 0, 0));
+    CHECK_OK(ice9_pipeline_set_sink(pipeline, sequence_sink, &sunk));
+    CHECK_OK(ice9_enable_streaming(device.hnd, 1));
+    CHECK_OK(ice9_pipeline_start(pipeline));
+    usleep(300000);
+    CHECK_OK(ice9_pipeline_stop(pipeline));
+    CHECK_OK(ice9_disable_streaming(device.hnd));
+
+    struct ice9_pipeline_stats stats;
+    CHECK_OK(ice9_pipeline_get_stats(pipeline, &stats));
+    CHECK(stats.chunks > 0);
+    CHECK(stats.bytes_in == stats.bytes_out);
+    CHECK((uint64_t) sunk.words * 2 == stats.bytes_out);
+    CHECK(staged.words == sunk.words);
+    CHECK(staged.bad == 0);
+    CHECK(sunk.bad == 0);
+    ice9_pipeline_free(pipeline);
+    test_close(&device);
+}
+
+// The same session, on a live simulator and when played back.
+struct session {
+    uint32_t ints[4];
+    uint8_t stream[200000];
+};
+
+static enum Ice9Error run_session(struct ice9_handle *hnd, struct session *session) {
+    static const uint32_t values[4] = { 1, 0x12345678, 0xDEADBEEF, 0xFFFFFFFF };
+    enum Ice9Error ret = ice9_open(hnd);
+    if (ret == OK) {
+        ret = ice9_write_ints(hnd, 3, values, 4, 0);
+    }
+    if (ret == OK) {
+        ret = ice9_read_ints(hnd, 3, session->ints, 4, 0);
+    }
+    if (ret == OK) {
+        ret = ice9_enable_streaming(hnd, 3);
+    }
+    if (ret == OK) {
+        ret = ice9_stream_read(hnd, session->stream, sizeof(session->stream));
+    }
+    return ret;
+}
+
+static void test_record_replay(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ice9_test_%d.rec", (int) getpid());
+    static struct session recorded;
+    static struct session replayed;
+
+    struct ice9_sim *sim = ice9_sim_new(NULL);
+    struct ice9_config config = {0};
+    config.transport = ice9_recording_transport_new(ice9_sim_transport_new(sim), path);
+    CHECK(config.transport != NULL);
+    struct ice9_handle *hnd = ice9_new_with_config(&config);
+    CHECK_OK(run_session(hnd, &recorded));
+    CHECK_OK(ice9_disable_streaming(hnd));
+    ice9_close(hnd);
+    ice9_free(hnd);
+    ice9_sim_free(sim);
+    CHECK(recorded.ints[1] == 0x12345678 && recorded.ints[3] == 0xFFFFFFFF);
+
+    config.transport = ice9_replay_transport_new(path, 0);
+    CHECK(config.transport != NULL);
+    if (config.transport != NULL) {
+        hnd = ice9_new_with_config(&config);
+        CHECK_OK(run_session(hnd, &replayed));
+        CHECK(memcmp(recorded.ints, replayed.ints, sizeof(recorded.ints)) == 0);
+        CHECK(memcmp(recorded.stream, replayed.stream, sizeof(recorded.stream)) == 0);
+        // Reading past the end of the recording says so.
+        CHECK_ERROR(ice9_stream_read(hnd, replayed.stream, sizeof(replayed.stream)), EndOfReplay);
+        ice9_close(hnd);
+        ice9_free(hnd);
+    }
+    unlink(path);
+}
+
+int main(void) {
+    RUN_TEST(test_events);
+    RUN_TEST(test_channels);
+    RUN_TEST(test_pipeline_order);
+    RUN_TEST(test_record_replay);
+    return test_result();
+}
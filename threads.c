@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logger.h"
+#include "threads.h"
+
+static int to_sched_policy(int policy) {
+    switch (policy) {
+        case ICE9_SCHED_FIFO: return SCHED_FIFO;
+        case ICE9_SCHED_RR: return SCHED_RR;
+        default: return SCHED_OTHER;
+    }
+}
+
+static void *probe_thread(void *arg) {
+    return NULL;
+}
+
+enum Ice9Error ice9_thread_settings_init(struct ice9_thread_settings *settings,
+                                         const struct ice9_thread_config *config) {
+    memset(settings, 0, sizeof(*settings));
+    CPU_ZERO(&settings->cpus);
+    settings->policy = SCHED_OTHER;
+    strcpy(settings->name_prefix, "ice9");
+    if (config == NULL) {
+        return OK;
+    }
+    for (int i = 0; i < config->num_cpus; i++) {
+        if ((config->cpus[i] < 0) || (config->cpus[i] >= CPU_SETSIZE)) {
+            LOG_ERROR("ice9 thread config: cpu %d out of range\n", config->cpus[i]);
+            return InvalidThreadConfig;
+        }
+        CPU_SET(config->cpus[i], &settings->cpus);
+        settings->use_affinity = 1;
+    }
+    if ((config->policy != ICE9_SCHED_OTHER) && (config->policy != ICE9_SCHED_FIFO) &&
+        (config->policy != ICE9_SCHED_RR)) {
+        LOG_ERROR("ice9 thread config: unknown scheduling policy %d\n", config->policy);
+        return InvalidThreadConfig;
+    }
+    settings->policy = to_sched_policy(config->policy);
+    if (settings->policy != SCHED_OTHER) {
+        int lo = sched_get_priority_min(settings->policy);
+        int hi = sched_get_priority_max(settings->policy);
+        if ((config->priority < lo) || (config->priority > hi)) {
+            LOG_ERROR("ice9 thread config: priority %d outside %d..%d\n", config->priority, lo, hi);
+            return InvalidThreadConfig;
+        }
+        settings->priority = config->priority;
+    }
+    if (config->name_prefix != NULL) {
+        snprintf(settings->name_prefix, sizeof(settings->name_prefix), "%s", config->name_prefix);
+    }
+    // Start (and immediately join) a thread with these settings, so that a
+    // missing capability is reported now and not when streaming starts.
+    pthread_t probe;
+    enum Ice9Error ret = ice9_thread_start(settings, "probe", probe_thread, NULL, &probe);
+    if (ret != OK) {
+        return ret;
+    }
+    pthread_join(probe, NULL);
+    return OK;
+}
+
+enum Ice9Error ice9_thread_start(const struct ice9_thread_settings *settings, const char *role,
+                                 void *(*fn)(void *), void *arg, pthread_t *thread) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (settings->use_affinity) {
+        if (pthread_attr_setaffinity_np(&attr, sizeof(settings->cpus), &settings->cpus) != 0) {
+            pthread_attr_destroy(&attr);
+            LOG_ERROR("ice9 thread %s: unable to set cpu affinity\n", role);
+            return ThreadAffinityFailed;
+        }
+    }
+    if (settings->policy != SCHED_OTHER) {
+        struct sched_param param = { .sched_priority = settings->priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, settings->policy);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    int ret = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    if (ret == EPERM) {
+        LOG_ERROR("ice9 thread %s: not permitted to use %s priority %d (needs CAP_SYS_NICE or RLIMIT_RTPRIO)\n",
+                  role, settings->policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", settings->priority);
+        return ThreadPermissionDenied;
+    }
+    if (ret == EINVAL && settings->use_affinity) {
+        LOG_ERROR("ice9 thread %s: cpu set contains no usable cpus\n", role);
+        return ThreadAffinityFailed;
+    }
+    if (ret != 0) {
+        LOG_ERROR("ice9 thread %s: pthread_create failed: %s\n", role, strerror(ret));
+        return ThreadStartFailed;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%s-%s", settings->name_prefix, role);
+    pthread_setname_np(*thread, name);
+    return OK;
+}
@@ -0,0 +1,33 @@
+#ifndef _ICE9_THREADS_H_
+#define _ICE9_THREADS_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "ice9.h"
+
+// Resolved form of struct ice9_thread_config, owned by a handle and applied
+// to every thread the library starts on that handle's behalf.
+struct ice9_thread_settings {
+    int use_affinity;
+    cpu_set_t cpus;
+    int policy;
+    int priority;
+    char name_prefix[12];
+};
+
+// Convert and validate a user supplied config.  A NULL config gives the
+// default settings (inherit affinity and scheduling from the creating thread).
+enum Ice9Error ice9_thread_settings_init(struct ice9_thread_settings *settings,
+                                         const struct ice9_thread_config *config);
+
+// Start a thread with the given settings.  The thread is named
+// "<prefix>-<role>", truncated to the 15 characters the kernel allows.
+enum Ice9Error ice9_thread_start(const struct ice9_thread_settings *settings, const char *role,
+                                 void *(*fn)(void *), void *arg, pthread_t *thread);
+
+#endif  // _ICE9_THREADS_H_
@@ -0,0 +1,165 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+struct trace_event {
+    // slot + 1 once the event is written, 0 while it is being written, so a
+    // dump can skip events that are torn or from an earlier lap.
+    _Atomic uint64_t sequence;
+    const char *category;
+    const char *name;
+    const char *arg_name;
+    int64_t arg;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint32_t tid;
+};
+
+// A ring and the size it was allocated with, published together so a
+// recorder never indexes one ring with another's capacity.
+struct trace_ring {
+    uint64_t capacity;
+    uint64_t origin_ns;
+    _Atomic uint64_t next_event;
+    struct trace_ring *retired;
+    struct trace_event events[];
+};
+
+_Atomic int ice9_trace_enabled;
+
+// The ring is kept after ice9_trace_stop so it can still be dumped.  A ring
+// replaced by ice9_trace_start is never freed, since a span that began
+// before the restart may still be writing to it; it is reused by the next
+// start that asks for the same size instead.
+static _Atomic(struct trace_ring *) current;
+static struct trace_ring *retired;
+
+static uint32_t current_tid(void) {
+    static _Thread_local uint32_t tid;
+    if (tid == 0) {
+        tid = (uint32_t) syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+static struct trace_ring *take_retired(uint64_t capacity) {
+    for (struct trace_ring **link = &retired; *link != NULL; link = &(*link)->retired) {
+        struct trace_ring *ring = *link;
+        if (ring->capacity == capacity) {
+            *link = ring->retired;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+enum Ice9Error ice9_trace_start(int max_events) {
+    if (max_events <= 0) {
+        return Error;
+    }
+    atomic_store(&ice9_trace_enabled, 0);
+    struct trace_ring *ring = take_retired(max_events);
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(struct trace_ring) + max_events * sizeof(struct trace_event));
+        if (ring == NULL) {
+            return BufferAllocationFailed;
+        }
+        ring->capacity = max_events;
+    }
+    for (uint64_t i = 0; i < ring->capacity; i++) {
+        atomic_store_explicit(&ring->events[i].sequence, 0, memory_order_relaxed);
+    }
+    ring->retired = NULL;
+    ring->origin_ns = ice9_now_ns();
+    atomic_store(&ring->next_event, 0);
+    struct trace_ring *previous = atomic_exchange(&current, ring);
+    if (previous != NULL) {
+        previous->retired = retired;
+        retired = previous;
+    }
+    atomic_store(&ice9_trace_enabled, 1);
+    return OK;
+}
+
+void ice9_trace_stop(void) {
+    atomic_store(&ice9_trace_enabled, 0);
+}
+
+void ice9_trace_end(uint64_t start_ns, const char *category, const char *name, const char *arg_name, int64_t arg) {
+    if (start_ns == 0) {
+        return;
+    }
+    uint64_t end_ns = ice9_now_ns();
+    // Spans still open when tracing stopped are dropped.
+    struct trace_ring *ring = atomic_load_explicit(&current, memory_order_acquire);
+    if ((ring == NULL) || !atomic_load_explicit(&ice9_trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    // Claiming a slot is the only shared write, so any number of threads can
+    // record at once.  Once the ring wraps the oldest spans are overwritten.
+    uint64_t slot = atomic_fetch_add_explicit(&ring->next_event, 1, memory_order_relaxed);
+    struct trace_event *event = &ring->events[slot % ring->capacity];
+    atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->category = category;
+    event->name = name;
+    event->arg_name = arg_name;
+    event->arg = arg;
+    event->start_ns = start_ns;
+    event->duration_ns = end_ns - start_ns;
+    event->tid = current_tid();
+    atomic_store_explicit(&event->sequence, slot + 1, memory_order_release);
+}
+
+// Chrome trace-event format: complete ("X") events with microsecond
+// timestamps, relative to ice9_trace_start.
+enum Ice9Error ice9_trace_dump(const char *filename) {
+    const struct trace_ring *ring = atomic_load_explicit(&current, memory_order_acquire);
+    if (ring == NULL) {
+        return Error;
+    }
+    FILE *f = fopen(filename, "w");
+    if (f == NULL) {
+        return UnableToWriteTraceFile;
+    }
+    uint64_t capacity = ring->capacity;
+    uint64_t recorded = atomic_load(&ring->next_event);
+    uint64_t first = (recorded > capacity) ? recorded - capacity : 0;
+    int pid = getpid();
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"ice9\"}}", pid);
+    for (uint64_t i = first; i < recorded; i++) {
+        const struct trace_event *slot = &ring->events[i % capacity];
+        // Copy the event out, then check nobody started rewriting it.
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        struct trace_event event;
+        event.category = slot->category;
+        event.name = slot->name;
+        event.arg_name = slot->arg_name;
+        event.arg = slot->arg;
+        event.start_ns = slot->start_ns;
+        event.duration_ns = slot->duration_ns;
+        event.tid = slot->tid;
+        atomic_thread_fence(memory_order_acquire);
+        if ((sequence != i + 1) || (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence) ||
+            (event.start_ns < ring->origin_ns)) {
+            continue;
+        }
+        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, "
+                "\"ts\": %.3f, \"dur\": %.3f",
+                event.name, event.category, pid, event.tid,
+                (event.start_ns - ring->origin_ns) / 1e3, event.duration_ns / 1e3);
+        if (event.arg_name != NULL) {
+            fprintf(f, ", \"args\": {\"%s\": %lld}", event.arg_name, (long long) event.arg);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) {
+        return UnableToWriteTraceFile;
+    }
+    return OK;
+}
@@ -0,0 +1,35 @@
+#ifndef _ICE9_TRACE_H_
+#define _ICE9_TRACE_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "ice9.h"
+#include "histogram.h"
+
+// Timeline tracing behind ice9_trace_start/ice9_trace_dump.  Spans from every
+// thread go into one process wide ring.  When tracing is off a span costs a
+// single relaxed load:
+//
+//   uint64_t t = ice9_trace_begin();
+//   ...
+//   ice9_trace_end(t, "usb", "bulk_in", "bytes", transferred);
+//
+// name, category and arg_name must be string literals (or otherwise outlive
+// the trace); only the pointers are stored.
+
+extern _Atomic int ice9_trace_enabled;
+
+// Start of a span, or 0 if tracing is off.
+static inline uint64_t ice9_trace_begin(void) {
+    if (!atomic_load_explicit(&ice9_trace_enabled, memory_order_relaxed)) {
+        return 0;
+    }
+    return ice9_now_ns();
+}
+
+// Record a span that started at start_ns.  Does nothing if start_ns is 0.
+// arg_name may be NULL when there is no argument.
+void ice9_trace_end(uint64_t start_ns, const char *category, const char *name, const char *arg_name, int64_t arg);
+
+#endif  // _ICE9_TRACE_H_
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ice9_transport.h"
+#include "logger.h"
+
+// Recording file layout (host byte order):
+//   8 byte magic, then one record_header per transport call, each followed by
+//   `transferred` bytes of data for IN and OUT records.
+#define RECORDING_MAGIC "ICE9REC1"
+
+enum record_type {
+    RECORD_OUT = 1,
+    RECORD_IN = 2,
+    RECORD_CONTROL = 3,
+};
+
+struct record_header {
+    uint64_t submit_ns;      // Since the transport was opened
+    uint64_t complete_ns;
+    int32_t status;          // enum Ice9Error returned by the call
+    uint32_t length;         // Requested length
+    uint32_t transferred;    // Bytes of data that follow
+    uint16_t value;
+    uint16_t index;
+    uint8_t type;
+    uint8_t request_type;
+    uint8_t request;
+    uint8_t reserved;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------
+// Recording
+// ---------------------------------------------------------
+
+struct recording_transport {
+    struct ice9_transport transport;
+    struct ice9_transport *inner;
+    FILE *file;
+    pthread_mutex_t lock;
+    uint64_t start_ns;
+};
+
+static void write_record(struct recording_transport *rec, struct record_header *header, const uint8_t *data) {
+    pthread_mutex_lock(&rec->lock);
+    header->submit_ns -= rec->start_ns;
+    header->complete_ns -= rec->start_ns;
+    fwrite(header, sizeof(*header), 1, rec->file);
+    if (header->transferred > 0) {
+        fwrite(data, 1, header->transferred, rec->file);
+    }
+    pthread_mutex_unlock(&rec->lock);
+}
+
+static enum Ice9Error recording_open(void *context) {
+    struct recording_transport *rec = context;
+    // Replay paces from its own open, so time is counted from here rather
+    // than from when the transport was created.
+    pthread_mutex_lock(&rec->lock);
+    rec->start_ns = now_ns();
+    pthread_mutex_unlock(&rec->lock);
+    return rec->inner->ops->open(rec->inner->context);
+}
+
+static void recording_close(void *context) {
+    struct recording_transport *rec = context;
+    fflush(rec->file);
+    rec->inner->ops->close(rec->inner->context);
+}
+
+static enum Ice9Error recording_submit_out(void *context, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    struct recording_transport *rec = context;
+    struct record_header header = { .type = RECORD_OUT, .length = length };
+    header.submit_ns = now_ns();
+    enum Ice9Error ret = rec->inner->ops->submit_out(rec->inner->context, data, length, transferred, timeout_ms);
+    header.complete_ns = now_ns();
+    header.status = ret;
+    header.transferred = (*transferred > 0) ? *transferred : 0;
+    write_record(rec, &header, data);
+    return ret;
+}
+
+static enum Ice9Error recording_submit_in(void *context, uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    struct recording_transport *rec = context;
+    struct record_header header = { .type = RECORD_IN, .length = length };
+    header.submit_ns = now_ns();
+    enum Ice9Error ret = rec->inner->ops->submit_in(rec->inner->context, data, length, transferred, timeout_ms);
+    header.complete_ns = now_ns();
+    header.status = ret;
+    header.transferred = (*transferred > 0) ? *transferred : 0;
+    write_record(rec, &header, data);
+    return ret;
+}
+
+static enum Ice9Error recording_control(void *context, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned int timeout_ms) {
+    struct recording_transport *rec = context;
+    struct record_header header = { .type = RECORD_CONTROL, .request_type = request_type,
+                                    .request = request, .value = value, .index = index };
+    header.submit_ns = now_ns();
+    enum Ice9Error ret = rec->inner->ops->control(rec->inner->context, request_type, request, value, index, timeout_ms);
+    header.complete_ns = now_ns();
+    header.status = ret;
+    write_record(rec, &header, NULL);
+    return ret;
+}
+
+static enum Ice9Error recording_handle_events(void *context, unsigned int timeout_ms) {
+    struct recording_transport *rec = context;
+    if (rec->inner->ops->handle_events == NULL) {
+        return OK;
+    }
+    return rec->inner->ops->handle_events(rec->inner->context, timeout_ms);
+}
+
+static void recording_destroy(void *context) {
+    struct recording_transport *rec = context;
+    fclose(rec->file);
+    ice9_transport_free(rec->inner);
+    pthread_mutex_destroy(&rec->lock);
+    free(rec);
+}
+
+static const struct ice9_transport_ops recording_ops = {
+    .open = recording_open,
+    .close = recording_close,
+    .submit_out = recording_submit_out,
+    .submit_in = recording_submit_in,
+    .control = recording_control,
+    .handle_events = recording_handle_events,
+    .destroy = recording_destroy,
+};
+
+struct ice9_transport *ice9_recording_transport_new(struct ice9_transport *inner, const char *path) {
+    if (inner == NULL) {
+        return NULL;
+    }
+    struct recording_transport *rec = calloc(1, sizeof(struct recording_transport));
+    if (rec == NULL) {
+        return NULL;
+    }
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        LOG_ERROR("Unable to create recording %s\n", path);
+        free(rec);
+        return NULL;
+    }
+    // Streaming produces a record per transfer, so buffer generously.
+    setvbuf(rec->file, NULL, _IOFBF, 1024*1024);
+    fwrite(RECORDING_MAGIC, 1, 8, rec->file);
+    pthread_mutex_init(&rec->lock, NULL);
+    rec->inner = inner;
+    rec->start_ns = now_ns();
+    rec->transport.ops = &recording_ops;
+    rec->transport.context = rec;
+    return &rec->transport;
+}
+
+// ---------------------------------------------------------
+// Replay
+// ---------------------------------------------------------
+
+struct replay_transport {
+    struct ice9_transport transport;
+    int flags;
+    const uint8_t *map;
+    size_t map_size;
+    size_t in_cursor;
+    size_t first_in;
+    uint64_t start_ns;
+    uint64_t loop_offset_ns;
+    uint64_t last_complete_ns;
+    pthread_mutex_t lock;
+};
+
+// Records are packed back to back, so a header in the map is usually not
+// aligned for its uint64_t fields; it is copied out instead of read in place.
+static int record_at(struct replay_transport *rep, size_t offset, struct record_header *header) {
+    if (offset + sizeof(struct record_header) > rep->map_size) {
+        return 0;
+    }
+    memcpy(header, rep->map + offset, sizeof(struct record_header));
+    return offset + sizeof(struct record_header) + header->transferred <= rep->map_size;
+}
+
+static size_t next_record(size_t offset, const struct record_header *header) {
+    return offset + sizeof(struct record_header) + header->transferred;
+}
+
+// Find the first IN record at or after offset.
+static size_t find_in(struct replay_transport *rep, size_t offset) {
+    struct record_header header;
+    while (record_at(rep, offset, &header) && (header.type != RECORD_IN)) {
+        offset = next_record(offset, &header);
+    }
+    return offset;
+}
+
+static enum Ice9Error replay_open(void *context) {
+    struct replay_transport *rep = context;
+    pthread_mutex_lock(&rep->lock);
+    rep->in_cursor = rep->first_in;
+    rep->start_ns = now_ns();
+    rep->loop_offset_ns = 0;
+    pthread_mutex_unlock(&rep->lock);
+    return OK;
+}
+
+static void replay_close(void *context) {
+}
+
+// The device side is fixed by the recording, so writes are simply accepted.
+static enum Ice9Error replay_submit_out(void *context, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    *transferred = length;
+    return OK;
+}
+
+static enum Ice9Error replay_submit_in(void *context, uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    struct replay_transport *rep = context;
+    *transferred = 0;
+    pthread_mutex_lock(&rep->lock);
+    struct record_header header;
+    int found = record_at(rep, rep->in_cursor, &header);
+    if (!found && (rep->flags & ICE9_REPLAY_LOOP) && record_at(rep, rep->first_in, &header)) {
+        rep->loop_offset_ns += rep->last_complete_ns;
+        rep->in_cursor = rep->first_in;
+        found = 1;
+    }
+    if (!found) {
+        pthread_mutex_unlock(&rep->lock);
+        return EndOfReplay;
+    }
+    int count = header.transferred;
+    if (count > length) {
+        LOG_ERROR("replay IN record of %d bytes truncated to %d\n", count, length);
+        count = length;
+    }
+    memcpy(data, rep->map + rep->in_cursor + sizeof(struct record_header), count);
+    uint64_t due_ns = rep->start_ns + rep->loop_offset_ns + header.complete_ns;
+    enum Ice9Error ret = header.status;
+    rep->last_complete_ns = header.complete_ns;
+    rep->in_cursor = find_in(rep, next_record(rep->in_cursor, &header));
+    pthread_mutex_unlock(&rep->lock);
+    if (rep->flags & ICE9_REPLAY_PACED) {
+        uint64_t now = now_ns();
+        if (due_ns > now) {
+            struct timespec ts = { (due_ns - now) / 1000000000ULL, (due_ns - now) % 1000000000ULL };
+            nanosleep(&ts, NULL);
+        }
+    }
+    *transferred = count;
+    return ret;
+}
+
+static enum Ice9Error replay_control(void *context, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned int timeout_ms) {
+    return OK;
+}
+
+static void replay_destroy(void *context) {
+    struct replay_transport *rep = context;
+    munmap((void *) rep->map, rep->map_size);
+    pthread_mutex_destroy(&rep->lock);
+    free(rep);
+}
+
+static const struct ice9_transport_ops replay_ops = {
+    .open = replay_open,
+    .close = replay_close,
+    .submit_out = replay_submit_out,
+    .submit_in = replay_submit_in,
+    .control = replay_control,
+    .handle_events = NULL,
+    .destroy = replay_destroy,
+};
+
+struct ice9_transport *ice9_replay_transport_new(const char *path, int flags) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Unable to open recording %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < 8)) {
+        LOG_ERROR("Recording %s is truncated\n", path);
+        close(fd);
+        return NULL;
+    }
+    // The whole recording is mapped so that replay costs no more than a memcpy.
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Unable to map recording %s\n", path);
+        return NULL;
+    }
+    if (memcmp(map, RECORDING_MAGIC, 8) != 0) {
+        LOG_ERROR("%s is not an ice9 recording\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    struct replay_transport *rep = calloc(1, sizeof(struct replay_transport));
+    if (rep == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    rep->flags = flags;
+    rep->map = map;
+    rep->map_size = st.st_size;
+    rep->first_in = find_in(rep, 8);
+    rep->in_cursor = rep->first_in;
+    rep->start_ns = now_ns();
+    pthread_mutex_init(&rep->lock, NULL);
+    rep->transport.ops = &replay_ops;
+    rep->transport.context = rep;
+    return &rep->transport;
+}
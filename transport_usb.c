@@ -0,0 +1,113 @@
+#include <libusb-1.0/libusb.h>
+#include <stdlib.h>
+
+#include "ice9_transport.h"
+
+#define ICE9_VENDOR_ID 0x3524
+#define ICE9_DATA_PRODUCT_ID 0x0002
+
+#define ICE9_DATA_IN_ENDPOINT 0x81
+#define ICE9_DATA_OUT_ENDPOINT 0x02
+
+struct usb_transport {
+    struct ice9_transport transport;
+    struct libusb_context *context;
+    struct libusb_device_handle *device;
+};
+
+static enum Ice9Error from_libusb_error(int code) {
+    switch (code) {
+        case LIBUSB_SUCCESS: return OK;
+        case LIBUSB_ERROR_IO: return LibUSBIOError;
+        case LIBUSB_ERROR_INVALID_PARAM: return LibUSBInvalidParameter;
+        case LIBUSB_ERROR_ACCESS: return LibUSBAccessDenied;
+        case LIBUSB_ERROR_NO_DEVICE: return LibUSBNoDeviceFound;
+        case LIBUSB_ERROR_NOT_FOUND: return LibUSBEntityNotFound;
+        case LIBUSB_ERROR_BUSY: return LibUSBResourceBusy;
+        case LIBUSB_ERROR_TIMEOUT: return LibUSBTimeout;
+        case LIBUSB_ERROR_OVERFLOW: return LibUSBOverflow;
+        case LIBUSB_ERROR_PIPE: return LibUSBPipeError;
+        case LIBUSB_ERROR_INTERRUPTED: return LibUSBInterrupted;
+        case LIBUSB_ERROR_NO_MEM: return LibUSBInsufficientMemory;
+        case LIBUSB_ERROR_NOT_SUPPORTED: return LibUSBOperationNotSupported;
+        default: return (code < 0) ? LibUSBOtherError : OK;
+    }
+}
+
+static enum Ice9Error usb_open(void *context) {
+    struct usb_transport *usb = context;
+    usb->device = libusb_open_device_with_vid_pid(usb->context, ICE9_VENDOR_ID, ICE9_DATA_PRODUCT_ID);
+    if (usb->device == NULL) {
+        return USBDeviceNotFound;
+    }
+    return OK;
+}
+
+static void usb_close(void *context) {
+    struct usb_transport *usb = context;
+    if (usb->device != NULL) {
+        libusb_close(usb->device);
+        usb->device = NULL;
+    }
+}
+
+static enum Ice9Error usb_submit_out(void *context, const uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    struct usb_transport *usb = context;
+    return from_libusb_error(libusb_bulk_transfer(usb->device, ICE9_DATA_OUT_ENDPOINT, (unsigned char *) data,
+                                                  length, transferred, timeout_ms));
+}
+
+static enum Ice9Error usb_submit_in(void *context, uint8_t *data, int length, int *transferred, unsigned int timeout_ms) {
+    struct usb_transport *usb = context;
+    return from_libusb_error(libusb_bulk_transfer(usb->device, ICE9_DATA_IN_ENDPOINT, data,
+                                                  length, transferred, timeout_ms));
+}
+
+static enum Ice9Error usb_control(void *context, uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, unsigned int timeout_ms) {
+    struct usb_transport *usb = context;
+    return from_libusb_error(libusb_control_transfer(usb->device, request_type, request, value, index,
+                                                     NULL, 0, timeout_ms));
+}
+
+static enum Ice9Error usb_handle_events(void *context, unsigned int timeout_ms) {
+    struct usb_transport *usb = context;
+    struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+    return from_libusb_error(libusb_handle_events_timeout(usb->context, &timeout));
+}
+
+static void usb_destroy(void *context) {
+    struct usb_transport *usb = context;
+    usb_close(usb);
+    libusb_exit(usb->context);
+    free(usb);
+}
+
+static const struct ice9_transport_ops usb_ops = {
+    .open = usb_open,
+    .close = usb_close,
+    .submit_out = usb_submit_out,
+    .submit_in = usb_submit_in,
+    .control = usb_control,
+    .handle_events = usb_handle_events,
+    .destroy = usb_destroy,
+};
+
+struct ice9_transport *ice9_libusb_transport_new(void) {
+    struct usb_transport *usb = calloc(1, sizeof(struct usb_transport));
+    if (usb == NULL) {
+        return NULL;
+    }
+    if (libusb_init(&usb->context) < 0) {
+        free(usb);
+        return NULL;
+    }
+    usb->transport.ops = &usb_ops;
+    usb->transport.context = usb;
+    return &usb->transport;
+}
+
+void ice9_transport_free(struct ice9_transport *transport) {
+    if (transport != NULL) {
+        transport->ops->destroy(transport->context);
+    }
+}